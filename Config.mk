@@ -10,6 +10,8 @@ TESTDIR = $(ROOT)/tests
 SRCDIR_TEST = $(ROOT)/tests
 BINDIR_TEST = $(ROOT)/tests/bin
 LIBDIR_TEST = $(ROOT)/tests/libtap
+TOOLDIR = $(ROOT)/tools
+BINDIR_TOOL = $(ROOT)/tools/bin
 
 LIBSRC_TEST = $(LIBDIR_TEST)/tap.c
 LIBOBJ_TEST = $(BINDIR_TEST)/tap.o
@@ -28,6 +30,8 @@ HEXT = h
 OEXT = o
 CEXT_TEST = test.c
 OEXT_TEST = test.o
+CEXT_BENCH = bench.c
+OEXT_BENCH = bench.o
 
 OUTBIN = output.bin
 OUTNAME = output.elf
@@ -69,11 +73,14 @@ AFLAGS   := $(MCUAFLAGS)
 ARFLAGS  := $(MCUCFLAGS)
 CCFLAGS  := -c -Wall $(MCUCFLAGS) -Os -ffunction-sections -fsigned-char -fomit-frame-pointer -fsingle-precision-constant
 CFLAGS   := $(CCFLAGS) -std=gnu99 -Werror=implicit-function-declaration
+# Uncomment to run the flywheel in fixed point, with TBH (see fixed.h)
+# CFLAGS += -DCONTROL_FIXED
 CPPFLAGS := $(CCFLAGS) -fno-exceptions -fno-rtti -felide-constructors
 LDFLAGS  := -Wall $(MCUCFLAGS) $(MCULFLAGS) -Wl,--gc-sections
 
-CFLAGS_TEST := -c -Wall -std=gnu99 -Werror=implicit-function-declaration
+CFLAGS_TEST := -c -Wall -O2 -std=gnu99 -Werror=implicit-function-declaration
 LDFLAGS_TEST := -Wall -Wl,--gc-sections
+LIBRARIES_TEST := -lm
 
 
 #
@@ -10,14 +10,16 @@ else
 endif
 
 INCLUDE := -I$(INCDIR) -I$(SRCDIR)
-BINDIRS := $(BINDIR) $(BINDIR_TEST)
+BINDIRS := $(BINDIR) $(BINDIR_TEST) $(BINDIR_TOOL)
 
 INCLUDE_TEST = $(INCLUDE) -I$(LIBDIR_TEST)
+INCLUDE_TOOL = $(INCLUDE) -I$(TOOLDIR)
 
 HEADERS := \
 	$(wildcard $(SRCDIR)/*.$(HEXT)) \
 	$(wildcard $(INCDIR)/*.$(HEXT)) \
-	$(wildcard $(LIBDIR_TEST)/*.$(HEXT))
+	$(wildcard $(LIBDIR_TEST)/*.$(HEXT)) \
+	$(wildcard $(TOOLDIR)/*.$(HEXT))
 
 ASMSRC := $(wildcard $(SRCDIR)/*.$(ASMEXT))
 CPPSRC := $(wildcard $(SRCDIR)/*.$(CPPEXT))
@@ -29,5 +31,15 @@ COBJ   := $(patsubst $(SRCDIR)/%.$(CEXT), $(BINDIR)/%.$(OEXT), $(CSRC))
 CSRC_TEST := $(wildcard $(SRCDIR_TEST)/*.$(CEXT_TEST))
 COBJ_TEST := $(patsubst $(SRCDIR)/%.$(CEXT), $(BINDIR_TEST)/%.$(OEXT), $(CSRC))
 TESTOBJ   := $(patsubst $(SRCDIR_TEST)/%.$(CEXT_TEST), $(BINDIR_TEST)/%.$(OEXT_TEST), $(CSRC_TEST))
+CSRC_BENCH := $(wildcard $(SRCDIR_TEST)/*.$(CEXT_BENCH))
+BENCHOBJ   := $(patsubst $(SRCDIR_TEST)/%.$(CEXT_BENCH), $(BINDIR_TEST)/%.$(OEXT_BENCH), $(CSRC_BENCH))
 OUT := $(BINDIR)/$(OUTNAME)
 OUT_TEST := $(patsubst %.$(OEXT_TEST), %$(EXESUFFIX), $(TESTOBJ))
+OUT_BENCH := $(patsubst %.$(OEXT_BENCH), %.bench$(EXESUFFIX), $(BENCHOBJ))
+
+# Host tools, built from the same pigeon sources as the tests
+TOOLOBJ := $(BINDIR_TOOL)/ingest.$(OEXT) $(BINDIR_TEST)/pigeon-frame.$(OEXT)
+OUT_TOOL := \
+	$(BINDIR_TOOL)/pigeon-ingest$(EXESUFFIX) \
+	$(BINDIR_TOOL)/kalman-gains$(EXESUFFIX)
+OUT_TOOL_BENCH := $(BINDIR_TOOL)/ingest.bench$(EXESUFFIX)
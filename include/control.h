@@ -2,6 +2,7 @@
 #define CONTROL_H_
 
 #include "pigeon.h"
+#include "fixed.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -73,6 +74,70 @@ tbhSetup(ControlHandle, Portal*);
 float
 tbhDummyEstimator(float target);
 
+//
+// PID and TBH in Q16.16 fixed point, for CONTROL_FIXED builds. They step
+// the same as the float versions, but on a FixedSystem, so nothing is
+// converted on the way in or out. TBH's estimator is still a float
+// function; it's only called once a target.
+//
+typedef Fixed
+(*FixedUpdater)(ControlHandle, FixedSystem*);
+
+ControlHandle
+pidFixedInit(float gainP, float gainI, float gainD);
+
+void
+pidFixedReset(ControlHandle);
+
+Fixed
+pidFixedUpdate(ControlHandle, FixedSystem*);
+
+void
+pidFixedSetup(ControlHandle, Portal*);
+
+ControlHandle
+tbhFixedInit(TbhConfig);
+
+void
+tbhFixedReset(ControlHandle);
+
+Fixed
+tbhFixedUpdate(ControlHandle, FixedSystem*);
+
+void
+tbhFixedSetup(ControlHandle, Portal*);
+
+//
+// Two degree of freedom controller: the estimator's steady state command
+// as feedforward, with PID feedback on top. The integral is clamped and
+// unwinds by back-calculation while the action is saturated, and the
+// derivative is taken on the measurement so target changes don't kick.
+//
+typedef struct
+TwoDofConfig
+{
+    float gainP;
+    float gainI;
+    float gainD;
+    float integralMax;
+    float actionMax;
+    float tracking;
+    TbhEstimator estimator;
+}
+TwoDofConfig;
+
+ControlHandle
+twoDofInit(TwoDofConfig);
+
+void
+twoDofReset(ControlHandle);
+
+float
+twoDofUpdate(ControlHandle, ControlSystem*);
+
+void
+twoDofSetup(ControlHandle, Portal*);
+
 void *
 bangBangInit
 (
@@ -29,7 +29,7 @@ DiffsteerSetup
     char * id;
     Pigeon * pigeon;
 
-    ReckonerState * state;
+    Reckoner * reckoner;
 
     float gainDistance;
     float gainHeading;
@@ -0,0 +1,99 @@
+#ifndef FEEDFORWARD_H_
+#define FEEDFORWARD_H_
+
+#include "pigeon.h"
+#include "control.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Learned flywheel feedforward.
+//
+// A piecewise-linear table of the steady state command against target rpm,
+// evenly spaced from 0 to rpmMax. It starts out as the hand fitted curve
+// and learns from the command the flywheel actually settled at each time
+// it became ready. Commands are stored as if at FEEDFORWARD_VOLTAGE and
+// scaled by the battery voltage both ways, so a flat battery doesn't
+// teach the table the wrong curve.
+//
+// The table is kept in a flash file, so it carries over between power
+// cycles. A low priority task writes it out once it has changed, but only
+// while the robot is disabled or every flywheel with a table is stopped, as
+// a flash write stalls every task.
+//
+
+
+
+#define FEEDFORWARD_POINTS 16
+#define FEEDFORWARD_VOLTAGE 7.2f
+
+
+
+// Typedefs {{{
+
+struct Feedforward;
+typedef struct Feedforward Feedforward;
+
+typedef struct
+FeedforwardSetup
+{
+    // Flash file name, at most 8 characters. NULL to not keep it.
+    const char * file;
+
+    float rpmMax;
+    float learningRate;
+
+    // Shortest time between writes to flash, in milliseconds
+    unsigned long saveInterval;
+
+    // Hand fitted curve the table starts from
+    TbhEstimator fallback;
+}
+FeedforwardSetup;
+
+// }}}
+
+
+
+// Methods {{{
+
+Feedforward *
+feedforwardInit(FeedforwardSetup);
+
+// Usable from a TbhEstimator, for TbhConfig.estimator
+float
+feedforwardEstimate(Feedforward*, float target);
+
+// The flywheel settled at target with this action. Quick enough for the
+// control task, as it only marks the table to be saved.
+void
+feedforwardRecord(Feedforward*, float target, float action);
+
+// Writes the table to flash if it changed and the save interval is up.
+// Called by the saver task with the actuators stopped; blocks while flash
+// is written.
+void
+feedforwardSave(Feedforward*);
+
+// The owner calls this every frame, with whether its actuators are stopped
+void
+feedforwardSetStopped(Feedforward*, bool stopped);
+
+void
+feedforwardSetup(Feedforward*, Portal*);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
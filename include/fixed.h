@@ -0,0 +1,136 @@
+#ifndef FIXED_H_
+#define FIXED_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Q16.16 fixed point, for control maths on the Cortex-M3, which has no FPU.
+//
+// Range is about +-32767 with a resolution of 1/65536, which covers rpm,
+// rpm/s short of a stall, and motor commands. Multiplies go through 64
+// bits, which the M3 does in one instruction; divides are slow, so the
+// control paths avoid them.
+//
+// Build with -DCONTROL_FIXED to run the flywheel in fixed point, from the
+// encoder reading to the motor command. The flywheel keeps a FixedSystem
+// for its filter and controller, and copies it out to floats only for
+// telemetry and its ready and shot checks. Telemetry still reads and
+// writes engineering units.
+//
+
+
+
+// Typedefs {{{
+
+typedef int32_t Fixed;
+
+#define FIXED_SHIFT 16
+#define FIXED_ONE ((Fixed)1 << FIXED_SHIFT)
+#define FIXED_HALF ((Fixed)1 << (FIXED_SHIFT - 1))
+#define FIXED_FROM_INT(x) ((Fixed)(x) << FIXED_SHIFT)
+
+// ControlSystem, in fixed point
+typedef struct
+FixedSystem
+{
+    unsigned long microTime;
+    Fixed dt;
+    Fixed target;
+    Fixed measured;
+    Fixed derivative;
+    Fixed error;
+    Fixed action;
+}
+FixedSystem;
+
+// }}}
+
+
+
+// Methods {{{
+
+// Saturates, as a float out of range would be undefined to convert
+static inline Fixed
+fixedFromFloat(float x)
+{
+    float scaled = x * 65536.0f;
+    if (scaled >= 2147483647.0f) return INT32_MAX;
+    if (scaled <= -2147483648.0f) return INT32_MIN;
+    return (Fixed)(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+}
+
+static inline float
+fixedToFloat(Fixed x)
+{
+    return x / 65536.0f;
+}
+
+static inline Fixed
+fixedMul(Fixed a, Fixed b)
+{
+    return (Fixed)(((int64_t)a * b) >> FIXED_SHIFT);
+}
+
+// Saturates, as fixedFromFloat does, rather than wrapping to the other sign
+static inline Fixed
+fixedAdd(Fixed a, Fixed b)
+{
+    int64_t sum = (int64_t)a + b;
+    if (sum > INT32_MAX) return INT32_MAX;
+    if (sum < INT32_MIN) return INT32_MIN;
+    return (Fixed)sum;
+}
+
+static inline Fixed
+fixedDiv(Fixed a, Fixed b)
+{
+    return (Fixed)(((int64_t)a << FIXED_SHIFT) / b);
+}
+
+// Rounds to the nearest whole number
+static inline int
+fixedToInt(Fixed x)
+{
+    return (x + FIXED_HALF) >> FIXED_SHIFT;
+}
+
+// Whole part, towards zero, as (int) does to a float
+static inline int
+fixedTruncate(Fixed x)
+{
+    return x < 0 ? -(-x >> FIXED_SHIFT) : x >> FIXED_SHIFT;
+}
+
+// Seconds in a number of microseconds, without dividing
+Fixed
+fixedFromMicros(unsigned long micros);
+
+// flywheel.c's low-pass filter, given 1 / smoothing
+void
+fixedLowPass(FixedSystem*, Fixed rpm, Fixed smoothingReciprocal);
+
+// Formats with four decimal places, in integer maths
+void
+fixedFormat(Fixed, char * destination);
+
+// Portal handler for a Fixed, read and written in engineering units
+void
+fixedHandler(void * handle, char * message, char * response);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
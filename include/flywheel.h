@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include "pigeon.h"
 #include "control.h"
+#include "feedforward.h"
 #include "shims.h"
 
 #ifdef __cplusplus
@@ -19,6 +20,12 @@ typedef void (*FlywheelHandler)(void*);
 struct Flywheel;
 typedef struct Flywheel Flywheel;
 
+struct FlywheelGroup;
+typedef struct FlywheelGroup FlywheelGroup;
+
+#define FLYWHEEL_GROUP_MAX 4
+#define FLYWHEEL_READY_WINDOW 32
+
 typedef enum
 FlywheelController
 {
@@ -28,6 +35,26 @@ FlywheelController
 }
 FlywheelController;
 
+//
+// Constant gain Kalman filter over the flywheel's speed, in place of the
+// low-pass filter. The model is
+//
+//   acceleration = gain * action - decay * speed + disturbance
+//
+// with the disturbance, anything the model misses, as a random walk. The
+// gains are for one fixed frame delay, from tools/bin/kalman-gains.
+// Leaving gainSpeed at zero keeps the low-pass filter.
+//
+typedef struct
+FlywheelKalman
+{
+    float decay;
+    float gain;
+    float gainSpeed;
+    float gainDisturbance;
+}
+FlywheelKalman;
+
 typedef struct
 FlywheelSetup
 {
@@ -36,9 +63,16 @@ FlywheelSetup
 
     float gearing;
     float smoothing;
+    FlywheelKalman kalman;
 
+    // Built with CONTROL_FIXED, the controller runs on the flywheel's
+    // FixedSystem, so it has to be one of the fixed point controllers
     ControlSetup controlSetup;
+#ifdef CONTROL_FIXED
+    FixedUpdater controlUpdater;
+#else
     ControlUpdater controlUpdater;
+#endif
     ControlResetter controlResetter;
     ControlHandle control;
 
@@ -54,17 +88,48 @@ FlywheelSetup
     unsigned long frameDelayReady;
     unsigned long frameDelayActive;
 
+    // Checked every frame, over the errors of the last readyWindow frames
+    // (at most FLYWHEEL_READY_WINDOW). Ready once the window is full, every
+    // error in it is within thresholdError, their mean within thresholdMean
+    // and their standard deviation within thresholdDeviation, and the
+    // derivative is within thresholdDerivative. Leaving thresholdMean or
+    // thresholdDeviation at zero skips that rule.
     float thresholdError;
     float thresholdDerivative;
-    int checkCycle;
+    float thresholdMean;
+    float thresholdDeviation;
+    int readyWindow;
+
+    // A shot is a drop faster than shotDerivative (rpm/s, negative) while
+    // ready. The controller then hands over to the action it held before
+    // the shot plus shotBoost, for shotBoostTime milliseconds. Leaving
+    // shotDerivative at zero turns this off.
+    float shotDerivative;
+    float shotBoost;
+    unsigned long shotBoostTime;
 
     FlywheelHandler onready;
     void * onreadyHandle;
     FlywheelHandler onactive;
     void * onactiveHandle;
+
+    // Learns from each time it becomes ready, if not NULL
+    Feedforward * feedforward;
 }
 FlywheelSetup;
 
+//
+// Flywheels updated together from one task, at the shortest of their frame
+// delays, all from the same sample time. Each keeps its own portal.
+//
+typedef struct
+FlywheelGroupSetup
+{
+    Flywheel * flywheels[FLYWHEEL_GROUP_MAX];
+    unsigned int priority;
+}
+FlywheelGroupSetup;
+
 // }}}
 
 
@@ -83,6 +148,17 @@ flywheelSet(Flywheel * flywheel, float rpm);
 void
 waitUntilFlywheelReady(Flywheel * flywheel, const unsigned long blockTime);
 
+// Grouped flywheels are only ever run by their group, at its priority.
+FlywheelGroup *
+flywheelGroupInit(FlywheelGroupSetup setup);
+
+void
+flywheelGroupRun(FlywheelGroup * group);
+
+// Returns whether every flywheel was ready at once before blockTime ran out.
+bool
+waitUntilGroupReady(FlywheelGroup * group, const unsigned long blockTime);
+
 // }}}
 
 
@@ -30,8 +30,9 @@ extern Pigeon * pigeon;
 extern Drive * drive;
 extern Flywheel * fwAbove;
 extern Flywheel * fwBelow;
-extern Encoder fwBelowEncoder;
-extern Encoder fwAboveEncoder;
+extern FlywheelGroup * fwGroup;
+extern EncoderHandle fwBelowEncoder;
+extern EncoderHandle fwAboveEncoder;
 extern Flap * fwFlap;
 extern Reckoner * reckoner;
 extern Diffsteer * diffsteer;
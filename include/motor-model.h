@@ -1,8 +1,3 @@
-#if 0
-
-// {{{ Disabled for now
-
-
 // 
 // Motor model.
 //
@@ -17,7 +12,7 @@
 
 
 #ifndef MOTOR_MODEL_H_
-#define MOTOR_H_
+#define MOTOR_MODEL_H_
 
 #include <stdbool.h>
 
@@ -93,6 +88,9 @@ typedef struct MotorModelMeasurements
 MotorModelMeasurements;
 
 
+void motorModelInit(MotorModel *m, MotorModelSetup setup);
+
+
 // Also returns the amount of current.
 //float motorModelUpdate(MotorModel *m, MotorModelMeasurements measurements);
 float motorModelUpdate(MotorModel *m, int command, float rpm, float batteryVoltage, float timeChange);
@@ -105,8 +103,3 @@ float motorModelUpdate(MotorModel *m, int command, float rpm, float batteryVolta
 
 // End include guard
 #endif
-
-
-// }}}
-
-#endif
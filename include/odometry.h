@@ -0,0 +1,148 @@
+#ifndef ODOMETRY_H_
+#define ODOMETRY_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Dead reckoning for a differential drive, from how far each side's wheels
+// rolled since the last update.
+//
+// Between updates the robot is taken to have driven a constant curvature
+// arc, which is exact for any path where both sides roll at a steady ratio.
+// The arc's chord points along the heading halfway through the turn, so
+// nothing depends on the time between updates or on a filtered velocity.
+//
+// A gyro can be fused in: the wheels give the fine, quick changes of
+// heading and the gyro, which doesn't slip, slowly pulls it back in line.
+// While the wheels are still, whatever the gyro turns is taken to be drift,
+// and its rate learned as the bias to take off once moving.
+//
+// A history of timestamped poses answers where the robot was at a given
+// time, interpolating between the two samples either side of it.
+//
+// Like pigeon-frame, this has no PROS dependencies.
+//
+
+#define ODOMETRY_HISTORY 64
+
+
+
+// Typedefs {{{
+
+typedef struct
+OdometryPose
+{
+    float x;
+    float y;
+    float heading;
+}
+OdometryPose;
+
+typedef struct
+OdometryGyro
+{
+    // Seconds for the heading to close most of the way to the gyro's
+    float timeConstant;
+    // How quickly the bias follows the drift while still, per second
+    float biasRate;
+    // Each side moving less than this over an update counts as still
+    float stillDistance;
+
+    // Filled in as it goes; zero to start
+    bool started;
+    float origin;
+    float drift;
+    float bias;
+    float last;
+}
+OdometryGyro;
+
+typedef struct
+OdometrySample
+{
+    unsigned long microTime;
+    float x;
+    float y;
+    float heading;
+    float velocity;
+}
+OdometrySample;
+
+// Ring of the latest ODOMETRY_HISTORY samples, oldest first from start.
+// Times must go forward, but may wrap around like micros().
+typedef struct
+OdometryHistory
+{
+    OdometrySample samples[ODOMETRY_HISTORY];
+    int start;
+    int count;
+}
+OdometryHistory;
+
+// }}}
+
+
+
+// Methods {{{
+
+// Moves the pose along the arc the two wheel displacements describe.
+// Heading is kept within -pi to pi.
+void
+odometryUpdate(
+    OdometryPose*,
+    float leftChange,
+    float rightChange,
+    float wheelSeparation
+);
+
+// odometryUpdate, with the heading corrected toward the gyro's angle, in
+// radians, taken dt seconds after the last.
+void
+odometryFuse(
+    OdometryPose*,
+    OdometryGyro*,
+    float leftChange,
+    float rightChange,
+    float wheelSeparation,
+    float gyroAngle,
+    float dt
+);
+
+// Wraps an angle into -pi to pi
+float
+odometryWrap(float heading);
+
+void
+odometryHistoryClear(OdometryHistory*);
+
+// Adds the newest sample, dropping the oldest once full
+void
+odometryHistoryPush(OdometryHistory*, OdometrySample);
+
+// Pose at the given time, by binary search and linear interpolation.
+// Outside the history it gives the nearest end and returns false, as it
+// does with nothing in the history (leaving the sample untouched).
+bool
+odometryHistoryAt(
+    const OdometryHistory*,
+    unsigned long microTime,
+    OdometrySample * sample
+);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
@@ -0,0 +1,151 @@
+#ifndef PIGEON_FRAME_H_
+#define PIGEON_FRAME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Pigeon wire formats.
+//
+// Text lines look like "[00001234|portal.key  ] message".
+//
+// Binary frames look like:
+//
+//   sync | length | portal | entry | timestamp (4) | payload... | check (2)
+//
+// where length counts the bytes from portal to the end of the payload, the
+// timestamp is little endian millis, and check is a Fletcher-16 checksum of
+// every byte from length to the end of the payload. The payload is a
+// sequence of values, each one a type byte followed by its data.
+//
+// A portal's stream values go out with entry PIGEON_FRAME_STREAM. In delta
+// mode most of them instead go out with entry PIGEON_FRAME_DELTA, carrying
+// a uint bitmask of the stream values that changed followed by only those
+// values, in stream order. Every so often a full stream frame is sent again
+// as a keyframe, so a host can pick up part way through.
+//
+// This file has no PROS dependencies so host tools can decode frames too.
+//
+
+#define PIGEON_FRAME_SYNC 0xA5
+#define PIGEON_FRAME_STREAM 0xFF
+#define PIGEON_FRAME_DELTA 0xFE
+#define PIGEON_FRAME_HEADERSIZE 8
+#define PIGEON_FRAME_CHECKSIZE 2
+#define PIGEON_FRAME_MAXSIZE 96
+#define PIGEON_FRAME_MAXVALUES 16
+
+
+
+// Typedefs {{{
+
+typedef enum
+PigeonType
+{
+    PIGEON_TYPE_TEXT,   // length byte + chars
+    PIGEON_TYPE_FLOAT,  // IEEE 754 single, little endian
+    PIGEON_TYPE_INT,    // 32 bit two's complement, little endian
+    PIGEON_TYPE_UINT,   // 32 bit, little endian
+    PIGEON_TYPE_BOOL,   // 1 byte
+    PIGEON_TYPE_NAME    // like text, but names a portal or an entry
+}
+PigeonType;
+
+typedef struct
+PigeonValue
+{
+    PigeonType type;
+    union
+    {
+        float f;
+        long i;
+        unsigned long u;
+        bool b;
+        const char * text;
+    }
+    as;
+}
+PigeonValue;
+
+typedef struct
+PigeonFrame
+{
+    unsigned char portal;
+    unsigned char entry;
+    unsigned long timestamp;
+    int count;
+    PigeonValue values[PIGEON_FRAME_MAXVALUES];
+
+    // Decoded text values point in here
+    char strings[PIGEON_FRAME_MAXSIZE];
+}
+PigeonFrame;
+
+typedef struct
+PigeonDecoder
+{
+    unsigned char buffer[PIGEON_FRAME_MAXSIZE];
+    int size;
+    unsigned long frames;
+    unsigned long errors;
+}
+PigeonDecoder;
+
+// }}}
+
+
+
+// Methods {{{
+
+int
+pigeonFormatText(
+    char * destination,
+    int size,
+    unsigned long millis,
+    const char * id,
+    const char * key,
+    const char * message
+);
+
+int
+pigeonFrameEncode(const PigeonFrame*, unsigned char * destination, int size);
+
+bool
+pigeonFrameDecode(PigeonFrame*, const unsigned char * source, int size);
+
+void
+pigeonFrameCopy(PigeonFrame * destination, const PigeonFrame * source);
+
+bool
+pigeonFrameDelta(
+    const PigeonFrame * last,
+    const PigeonFrame * current,
+    PigeonFrame * delta
+);
+
+bool
+pigeonFrameApplyDelta(PigeonFrame * state, const PigeonFrame * delta);
+
+void
+pigeonDecoderInit(PigeonDecoder*);
+
+bool
+pigeonDecoderPush(PigeonDecoder*, unsigned char byte, PigeonFrame*);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
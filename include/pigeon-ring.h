@@ -0,0 +1,106 @@
+#ifndef PIGEON_RING_H_
+#define PIGEON_RING_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Bounded lock-free queue of outgoing pigeon records.
+//
+// Any number of tasks may push and pop at the same time without a mutex:
+// each slot carries a sequence number that says whether it is free, being
+// filled, or ready to read (Vyukov's bounded queue). Records are copied in
+// and out whole, so a slow reader never holds up a writer.
+//
+// Like pigeon-frame, this has no PROS dependencies.
+//
+
+#define PIGEON_RING_SLOTSIZE 96
+
+
+
+// Typedefs {{{
+
+// What to do when pushing onto a full ring
+typedef enum
+PigeonOverflow
+{
+    PIGEON_OVERFLOW_DROP_OLDEST,
+    PIGEON_OVERFLOW_DROP_NEWEST,
+    PIGEON_OVERFLOW_BLOCK     // push fails, the caller waits and retries
+}
+PigeonOverflow;
+
+struct PigeonRing;
+typedef struct PigeonRing PigeonRing;
+
+// A record claimed off the ring, read in place until it is released
+typedef struct
+PigeonRingRecord
+{
+    unsigned char tag;
+    int size;
+    const void * data;
+    unsigned long position;
+}
+PigeonRingRecord;
+
+// }}}
+
+
+
+// Methods {{{
+
+// Capacity is rounded up to a power of two.
+PigeonRing *
+pigeonRingInit(int capacity);
+
+bool
+pigeonRingPush(
+    PigeonRing*,
+    PigeonOverflow,
+    unsigned char tag,
+    const void * data,
+    int size
+);
+
+// Returns the size of the record copied into destination, or -1 if empty.
+// Destination must hold PIGEON_RING_SLOTSIZE bytes.
+int
+pigeonRingPop(PigeonRing*, unsigned char * tag, void * destination);
+
+// Pops in two steps, reading the record in place in between. Until the
+// record is released its slot can't be pushed to, so release it promptly.
+// Claim returns false if empty.
+bool
+pigeonRingClaim(PigeonRing*, PigeonRingRecord*);
+
+void
+pigeonRingRelease(PigeonRing*, PigeonRingRecord*);
+
+// Records waiting to be popped. Only a snapshot if others are pushing.
+int
+pigeonRingCount(PigeonRing*);
+
+unsigned long
+pigeonRingDropped(PigeonRing*);
+
+int
+pigeonRingCapacity(PigeonRing*);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
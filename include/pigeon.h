@@ -2,6 +2,9 @@
 #define PIGEON_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include "pigeon-frame.h"
+#include "pigeon-ring.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +15,20 @@ extern "C" {
 #define PIGEON_ALIGNSIZE 4
 #define PIGEON_LINESIZE 80
 
+// Longest line of input, which may hold several ';' separated commands
+#define PIGEON_INPUTSIZE 256
+
+// Output records queued for the writer task
+#define PIGEON_RINGSIZE 32
+
+// Stream frames between keyframes in delta mode, by default
+#define PIGEON_KEYFRAMEEVERY 25
+
+// Bytes set aside for all portals, entries and stream lists
+#ifndef PIGEON_ARENASIZE
+#define PIGEON_ARENASIZE 12288
+#endif
+
 
 
 // Typedefs {{{
@@ -25,6 +42,9 @@ typedef char *
 typedef void
 (*PigeonOut)(const char * message); // puts
 
+typedef void
+(*PigeonWrite)(const char * data, size_t size); // fwrite
+
 typedef unsigned long
 (*PigeonMillis)(); // millis
 
@@ -34,6 +54,19 @@ typedef struct Pigeon Pigeon;
 struct Portal;
 typedef struct Portal Portal;
 
+// Index of an entry within its portal, stable once added.
+typedef int PortalEntryRef;
+#define PORTAL_ENTRY_NONE (-1)
+
+typedef enum
+PigeonMode
+{
+    PIGEON_MODE_TEXT,
+    PIGEON_MODE_BINARY,
+    PIGEON_MODE_DELTA       // binary, with delta stream frames
+}
+PigeonMode;
+
 typedef struct
 PortalEntrySetup
 {
@@ -43,6 +76,13 @@ PortalEntrySetup
     bool stream;
     bool onchange;
     bool manual;
+
+    // Optional, numeric onchange entries are not written until they move
+    // this far from the last value written
+    float deadband;
+
+    // Optional, receives the entry's ref when added
+    PortalEntryRef * ref;
 }
 PortalEntrySetup;
 
@@ -52,10 +92,10 @@ PortalEntrySetup;
 
 // Methods {{{
 
-void
+PortalEntryRef
 portalAdd(Portal*, PortalEntrySetup);
 
-void
+PortalEntryRef
 portalAddBatch(Portal*, PortalEntrySetup*);
 
 void
@@ -65,15 +105,40 @@ portalSet(
     const char * message
 );
 
+void
+portalSetRef(
+    Portal*,
+    PortalEntryRef,
+    const char * message
+);
+
 void
 portalGetStreamKeys(Portal*, char * destination);
 
+// A stream has to go out as one binary frame: at most
+// PIGEON_FRAME_MAXVALUES values, with keys short enough for the manifest.
+// Keys that won't fit are refused, as are entries added past that.
 bool
 portalSetStreamKeys(Portal*, char * sequence);
 
+void
+portalSetStreamRate(Portal*, unsigned int every, unsigned long interval);
+
+void
+portalSetDeadband(Portal*, PortalEntryRef, float deadband);
+
+// Mutex is a PROS Mutex, taken while a line of commands sets the portal's
+// plain values (float, int, uint, ulong and bool handlers). Other handlers
+// run without it, so they may use the owner's API.
+void
+portalSetMutex(Portal*, void * mutex);
+
 void
 portalUpdate(Portal*, const char * key);
 
+void
+portalUpdateRef(Portal*, PortalEntryRef);
+
 void
 portalFlush(Portal*);
 
@@ -87,7 +152,7 @@ void
 portalDisable(Portal*);
 
 Pigeon *
-pigeonInit(PigeonIn, PigeonOut, PigeonMillis);
+pigeonInit(PigeonIn, PigeonOut, PigeonWrite, PigeonMillis);
 
 Portal *
 pigeonCreatePortal(Pigeon*, const char * id);
@@ -95,6 +160,17 @@ pigeonCreatePortal(Pigeon*, const char * id);
 void
 pigeonReady(Pigeon*);
 
+void
+pigeonSetMode(Pigeon*, PigeonMode);
+
+void
+pigeonSetOverflow(Pigeon*, PigeonOverflow);
+
+// Runs one line of ';' separated commands, as the input task does with
+// each line it reads. Note: line will be modified
+void
+pigeonInput(Pigeon*, char * line);
+
 void
 portalFloatHandler(void * handle, char * message, char * response);
 
@@ -1,6 +1,7 @@
 #ifndef RECKONER_H_
 #define RECKONER_H_
 
+#include "odometry.h"
 #include "pigeon.h"
 #include "shims.h"
 
@@ -16,6 +17,8 @@ typedef struct Reckoner Reckoner;
 typedef struct
 ReckonerState
 {
+    // micros() of the encoder readings it came from
+    unsigned long microTime;
     float velocity;
     float heading;
     float x;
@@ -41,10 +44,22 @@ ReckonerSetup
     float wheelSeparation;
     float smoothing;
 
+    // For reckonerRun: task priority, and milliseconds between updates
+    unsigned int priority;
+    unsigned long frameDelay;
+
     EncoderGetter encoderLeftGetter;
     EncoderHandle encoderLeft;
     EncoderGetter encoderRightGetter;
     EncoderHandle encoderRight;
+
+    // Optional, from gyroInit, fused with the wheels' heading; see
+    // odometry.h. Reversed if it reads clockwise as positive.
+    Gyro gyro;
+    bool gyroReversed;
+    float gyroTimeConstant;
+    float gyroBiasRate;
+    float gyroStillDistance;
 }
 ReckonerSetup;
 
@@ -54,9 +69,22 @@ reckonerInit(ReckonerSetup);
 void
 reckonerUpdate(Reckoner*);
 
-ReckonerState *
+// Updates from its own task every frameDelay, against absolute deadlines
+void
+reckonerRun(Reckoner*);
+
+// The pose from the latest complete update. Safe from any task, and never
+// waits on the reckoner's mutex.
+ReckonerState
 reckonerGetState(Reckoner*);
 
+// Where it was at a micros() time, interpolated from the last
+// ODOMETRY_HISTORY updates, for acting on a pose from a while ago. Outside
+// them it gives the nearest end and returns false. Never allocates, and
+// like reckonerGetState never waits on the mutex.
+bool
+reckonerGetStateAt(Reckoner*, unsigned long microTime, ReckonerState*);
+
 
 
 // End C++ export structure
@@ -65,6 +65,24 @@ encoderResetter(EncoderHandle);
 EncoderHandle
 encoderGetHandle(Encoder);
 
+//
+// Quadrature encoder read from its own edge interrupts instead of PROS's
+// encoder driver. Every edge is timestamped with micros(), so at low speed
+// the rpm comes from the time between edges rather than from the few ticks
+// counted since the last read. At high speed, where the count is already
+// fine grained, it blends over to the count.
+//
+// Takes over both pins' interrupts, so don't also encoderInit them.
+//
+EncoderReading
+edgeEncoderGetter(EncoderHandle);
+
+void
+edgeEncoderResetter(EncoderHandle);
+
+EncoderHandle
+edgeEncoderGetHandle(unsigned char portTop, unsigned char portBottom, bool reversed);
+
 EncoderReading
 imeGetter(EncoderHandle);
 
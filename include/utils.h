@@ -26,6 +26,24 @@ char * stringAppend(char * destination, const char * source, size_t);
 bool stringToFloat(const char * string, float * dest);
 bool stringToUlong(const char * string, unsigned long * dest);
 
+//
+// Fast maths for the control paths, in place of libm's soft-float routines.
+// None of them divide except fastAtan2, once. Errors are the worst found
+// against libm by tests/utils.test.c.
+//
+
+// Wraps an angle into -pi to pi, without fmodf. Out by no more than the
+// angle's own rounding, 1e-4 at a thousand radians.
+float fastWrap(float angle);
+// Absolute error under 1e-7 within a hundred radians of zero
+float fastSin(float angle);
+float fastCos(float angle);
+// Absolute error under 2e-5 radians
+float fastAtan2(float y, float x);
+// Relative error under 5e-6; zero for anything not above zero
+float fastInvSqrt(float x);
+float fastSqrt(float x);
+
 // TODO: Move these ticks per rev to somewhere meaningful.
 
 #define TICKS_PER_REVOLUTION_MOTOR_269 (float)(240.448f)
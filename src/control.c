@@ -4,6 +4,7 @@
 #include "control.h"
 #include "pigeon.h"
 #include "utils.h"
+#include "fixed.h"
 
 
 #define UNUSED(x) (void)(x)
@@ -15,6 +16,11 @@ typedef struct
 Pid
 {
     Portal * portal;
+    struct
+    {
+        PortalEntryRef integral;
+    }
+    refs;
     float gainP;
     float gainI;
     float gainD;
@@ -30,6 +36,7 @@ pidInit(float gainP, float gainI, float gainD)
     pid->gainP = gainP;
     pid->gainI = gainI;
     pid->gainD = gainD;
+    pid->refs.integral = PORTAL_ENTRY_NONE;
     pidReset(pid);
     return pid;
 }
@@ -39,7 +46,7 @@ pidReset(ControlHandle handle)
 {
     Pid * pid = handle;
     pid->integral = 0;
-    portalUpdate(pid->portal, "integral");
+    portalUpdateRef(pid->portal, pid->refs.integral);
 }
 
 float
@@ -50,12 +57,12 @@ pidUpdate(ControlHandle handle, ControlSystem * system)
     pid->integral += system->error * system->dt;
 
     float partP = pid->gainP * system->error;
-    float partI = pid->gainI * system->error;
-    float partD = pid->gainD * system->error;
+    float partI = pid->gainI * pid->integral;
+    float partD = pid->gainD * system->derivative;
 
     system->action = partP + partI + partD;
 
-    portalUpdate(pid->portal, "integral");
+    portalUpdateRef(pid->portal, pid->refs.integral);
 
     return system->action;
 }
@@ -85,7 +92,8 @@ pidSetup(ControlHandle handle, Portal * portal)
         {
             .key = "integral",
             .handler = portalFloatHandler,
-            .handle = &pid->integral
+            .handle = &pid->integral,
+            .ref = &pid->refs.integral
         },
 
         // End terminating struct
@@ -107,6 +115,14 @@ typedef struct
 Tbh
 {
     Portal * portal;
+    struct
+    {
+        PortalEntryRef lastAction;
+        PortalEntryRef lastError;
+        PortalEntryRef lastTarget;
+        PortalEntryRef crossed;
+    }
+    refs;
     TbhEstimator estimator;
     float gain;
     float slewPositive;
@@ -139,10 +155,10 @@ tbhReset(ControlHandle handle)
     tbh->lastError = 0.0f;
     tbh->lastTarget = 0.0f;
     tbh->crossed = false;
-    portalUpdate(tbh->portal, "last-action");
-    portalUpdate(tbh->portal, "last-error");
-    portalUpdate(tbh->portal, "last-target");
-    portalUpdate(tbh->portal, "crossed");
+    portalUpdateRef(tbh->portal, tbh->refs.lastAction);
+    portalUpdateRef(tbh->portal, tbh->refs.lastError);
+    portalUpdateRef(tbh->portal, tbh->refs.lastTarget);
+    portalUpdateRef(tbh->portal, tbh->refs.crossed);
 }
 
 float
@@ -162,8 +178,8 @@ tbhUpdate(ControlHandle handle, ControlSystem * system)
     {
         tbh->crossed = false;
         tbh->lastTarget = system->target;
-        portalUpdate(tbh->portal, "crossed");
-        portalUpdate(tbh->portal, "last-target");
+        portalUpdateRef(tbh->portal, tbh->refs.crossed);
+        portalUpdateRef(tbh->portal, tbh->refs.lastTarget);
     }
 
     // Detect first +ve overshoot before it happens
@@ -179,7 +195,7 @@ tbhUpdate(ControlHandle handle, ControlSystem * system)
         if (!tbh->crossed)
         {
             tbh->crossed = true;
-            portalUpdate(tbh->portal, "crossed");
+            portalUpdateRef(tbh->portal, tbh->refs.crossed);
         }
         // Detect first crossover
         /*
@@ -187,7 +203,7 @@ tbhUpdate(ControlHandle handle, ControlSystem * system)
         {
             system->action = tbh->estimator(system->target);
             tbh->crossed = true;
-            portalUpdate(tbh->portal, "crossed");
+            portalUpdateRef(tbh->portal, tbh->refs.crossed);
         }
         else
         {
@@ -199,7 +215,7 @@ tbhUpdate(ControlHandle handle, ControlSystem * system)
             system->action = 0.5f * (system->action + tbh->lastAction);
         }
         tbh->lastAction = system->action;
-        portalUpdate(tbh->portal, "last-action");
+        portalUpdateRef(tbh->portal, tbh->refs.lastAction);
     }
 
     // Prevent floating zero-rpm commands
@@ -213,7 +229,7 @@ tbhUpdate(ControlHandle handle, ControlSystem * system)
     }
 
     tbh->lastError = system->error;
-    portalUpdate(tbh->portal, "last-error");
+    portalUpdateRef(tbh->portal, tbh->refs.lastError);
     return system->action;
 }
 
@@ -232,22 +248,26 @@ tbhSetup(ControlHandle handle, Portal * portal)
         {
             .key = "last-action",
             .handler = portalFloatHandler,
-            .handle = &tbh->lastAction
+            .handle = &tbh->lastAction,
+            .ref = &tbh->refs.lastAction
         },
         {
             .key = "last-error",
             .handler = portalFloatHandler,
-            .handle = &tbh->lastError
+            .handle = &tbh->lastError,
+            .ref = &tbh->refs.lastError
         },
         {
             .key = "last-target",
             .handler = portalFloatHandler,
-            .handle = &tbh->lastTarget
+            .handle = &tbh->lastTarget,
+            .ref = &tbh->refs.lastTarget
         },
         {
             .key = "crossed",
             .handler = portalBoolHandler,
-            .handle = &tbh->crossed
+            .handle = &tbh->crossed,
+            .ref = &tbh->refs.crossed
         },
 
         // End terminating struct
@@ -270,6 +290,423 @@ tbhDummyEstimator(float target)
 // }}}
 
 
+// Fixed Point Controllers {{{
+
+typedef struct
+PidFixed
+{
+    Portal * portal;
+    struct
+    {
+        PortalEntryRef integral;
+    }
+    refs;
+    Fixed gainP;
+    Fixed gainI;
+    Fixed gainD;
+    Fixed integral;
+}
+PidFixed;
+
+ControlHandle
+pidFixedInit(float gainP, float gainI, float gainD)
+{
+    PidFixed * pid = malloc(sizeof(PidFixed));
+    pid->portal = NULL;
+    pid->gainP = fixedFromFloat(gainP);
+    pid->gainI = fixedFromFloat(gainI);
+    pid->gainD = fixedFromFloat(gainD);
+    pid->refs.integral = PORTAL_ENTRY_NONE;
+    pidFixedReset(pid);
+    return pid;
+}
+
+void
+pidFixedReset(ControlHandle handle)
+{
+    PidFixed * pid = handle;
+    pid->integral = 0;
+    portalUpdateRef(pid->portal, pid->refs.integral);
+}
+
+// Sums saturate, so a long held error pins the integral rather than
+// wrapping it round to the other sign.
+Fixed
+pidFixedUpdate(ControlHandle handle, FixedSystem * system)
+{
+    PidFixed * pid = handle;
+
+    pid->integral = fixedAdd(pid->integral, fixedMul(system->error, system->dt));
+
+    Fixed partP = fixedMul(pid->gainP, system->error);
+    Fixed partI = fixedMul(pid->gainI, pid->integral);
+    Fixed partD = fixedMul(pid->gainD, system->derivative);
+
+    system->action = fixedAdd(fixedAdd(partP, partI), partD);
+
+    portalUpdateRef(pid->portal, pid->refs.integral);
+
+    return system->action;
+}
+
+void
+pidFixedSetup(ControlHandle handle, Portal * portal)
+{
+    PidFixed * pid = handle;
+    pid->portal = portal;
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "gain-p",
+            .handler = fixedHandler,
+            .handle = &pid->gainP
+        },
+        {
+            .key = "gain-i",
+            .handler = fixedHandler,
+            .handle = &pid->gainI
+        },
+        {
+            .key = "gain-d",
+            .handler = fixedHandler,
+            .handle = &pid->gainD
+        },
+        {
+            .key = "integral",
+            .handler = fixedHandler,
+            .handle = &pid->integral,
+            .ref = &pid->refs.integral
+        },
+
+        // End terminating struct
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+}
+
+typedef struct
+TbhFixed
+{
+    Portal * portal;
+    struct
+    {
+        PortalEntryRef lastAction;
+        PortalEntryRef lastError;
+        PortalEntryRef lastTarget;
+        PortalEntryRef crossed;
+    }
+    refs;
+    TbhEstimator estimator;
+    Fixed gain;
+    Fixed slewPositive;
+    Fixed slewNegative;
+    Fixed lastAction;
+    Fixed lastError;
+    Fixed lastTarget;
+    bool crossed;
+}
+TbhFixed;
+
+ControlHandle
+tbhFixedInit(TbhConfig config)
+{
+    TbhFixed * tbh = malloc(sizeof(TbhFixed));
+    tbh->portal = NULL;
+    tbh->estimator = config.estimator;
+    tbh->gain = fixedFromFloat(config.gain);
+    tbh->slewPositive = fixedFromFloat(config.slewPositive);
+    tbh->slewNegative = fixedFromFloat(config.slewNegative);
+    tbh->refs.lastAction = PORTAL_ENTRY_NONE;
+    tbh->refs.lastError = PORTAL_ENTRY_NONE;
+    tbh->refs.lastTarget = PORTAL_ENTRY_NONE;
+    tbh->refs.crossed = PORTAL_ENTRY_NONE;
+    tbhFixedReset(tbh);
+    return tbh;
+}
+
+void
+tbhFixedReset(ControlHandle handle)
+{
+    TbhFixed * tbh = handle;
+    tbh->lastAction = 0;
+    tbh->lastError = 0;
+    tbh->lastTarget = 0;
+    tbh->crossed = false;
+    portalUpdateRef(tbh->portal, tbh->refs.lastAction);
+    portalUpdateRef(tbh->portal, tbh->refs.lastError);
+    portalUpdateRef(tbh->portal, tbh->refs.lastTarget);
+    portalUpdateRef(tbh->portal, tbh->refs.crossed);
+}
+
+// Step for step the same as tbhUpdate, which has the comments.
+Fixed
+tbhFixedUpdate(ControlHandle handle, FixedSystem * system)
+{
+    TbhFixed * tbh = handle;
+
+    Fixed actionDiff = -fixedMul(system->error, tbh->gain);
+    if (actionDiff > tbh->slewPositive) actionDiff = tbh->slewPositive;
+    else if (actionDiff < -tbh->slewNegative) actionDiff = -tbh->slewNegative;
+    system->action += fixedMul(actionDiff, system->dt);
+
+    if (system->target != tbh->lastTarget)
+    {
+        tbh->crossed = false;
+        tbh->lastTarget = system->target;
+        portalUpdateRef(tbh->portal, tbh->refs.crossed);
+        portalUpdateRef(tbh->portal, tbh->refs.lastTarget);
+    }
+
+    if (!tbh->crossed && system->error < 0 && system->error > -(system->target >> 1))
+    {
+        // Once a target, so the estimator can stay in floats
+        float target = fixedToFloat(system->target);
+        system->action = fixedFromFloat(tbh->estimator(target));
+        tbh->crossed = true;
+    }
+    else if (signOf(fixedTruncate(system->error)) != signOf(fixedTruncate(tbh->lastError)))
+    {
+        if (!tbh->crossed)
+        {
+            tbh->crossed = true;
+            portalUpdateRef(tbh->portal, tbh->refs.crossed);
+        }
+        else
+        {
+            system->action = (system->action + tbh->lastAction) >> 1;
+        }
+        tbh->lastAction = system->action;
+        portalUpdateRef(tbh->portal, tbh->refs.lastAction);
+    }
+
+    bool errorNearZero = system->error > -FIXED_ONE && system->error < FIXED_ONE;
+    if (system->target == 0 && errorNearZero)
+    {
+        system->action = 0;
+    }
+
+    tbh->lastError = system->error;
+    portalUpdateRef(tbh->portal, tbh->refs.lastError);
+
+    return system->action;
+}
+
+void
+tbhFixedSetup(ControlHandle handle, Portal * portal)
+{
+    TbhFixed * tbh = handle;
+    tbh->portal = portal;
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "gain",
+            .handler = fixedHandler,
+            .handle = &tbh->gain
+        },
+        {
+            .key = "last-action",
+            .handler = fixedHandler,
+            .handle = &tbh->lastAction,
+            .ref = &tbh->refs.lastAction
+        },
+        {
+            .key = "last-error",
+            .handler = fixedHandler,
+            .handle = &tbh->lastError,
+            .ref = &tbh->refs.lastError
+        },
+        {
+            .key = "last-target",
+            .handler = fixedHandler,
+            .handle = &tbh->lastTarget,
+            .ref = &tbh->refs.lastTarget
+        },
+        {
+            .key = "crossed",
+            .handler = portalBoolHandler,
+            .handle = &tbh->crossed,
+            .ref = &tbh->refs.crossed
+        },
+
+        // End terminating struct
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+}
+
+// }}}
+
+
+// Two-DOF Controller {{{
+
+typedef struct
+TwoDof
+{
+    Portal * portal;
+    struct
+    {
+        PortalEntryRef feedforward;
+        PortalEntryRef integral;
+    }
+    refs;
+    TbhEstimator estimator;
+    float gainP;
+    float gainI;
+    float gainD;
+    float integralMax;
+    float actionMax;
+    float tracking;
+    float feedforward;
+    float integral;
+}
+TwoDof;
+
+ControlHandle
+twoDofInit(TwoDofConfig config)
+{
+    TwoDof * control = malloc(sizeof(TwoDof));
+    control->portal = NULL;
+    control->estimator = config.estimator;
+    control->gainP = config.gainP;
+    control->gainI = config.gainI;
+    control->gainD = config.gainD;
+    control->integralMax = config.integralMax;
+    control->actionMax = config.actionMax;
+    control->tracking = config.tracking;
+    control->refs.feedforward = PORTAL_ENTRY_NONE;
+    control->refs.integral = PORTAL_ENTRY_NONE;
+    twoDofReset(control);
+    return control;
+}
+
+void
+twoDofReset(ControlHandle handle)
+{
+    TwoDof * control = handle;
+    control->feedforward = 0.0f;
+    control->integral = 0.0f;
+    portalUpdateRef(control->portal, control->refs.feedforward);
+    portalUpdateRef(control->portal, control->refs.integral);
+}
+
+float
+twoDofUpdate(ControlHandle handle, ControlSystem * system)
+{
+    TwoDof * control = handle;
+
+    // Spinning down to zero shouldn't hold any current through the motor
+    if (system->target == 0.0f)
+    {
+        twoDofReset(control);
+        system->action = 0.0f;
+        return system->action;
+    }
+
+    // Error is measured - target, so feedback pushes against it
+    float feedforward = control->estimator(system->target);
+    float partP = -control->gainP * system->error;
+    float partI = control->gainI * control->integral;
+    float partD = -control->gainD * system->derivative;
+    float action = feedforward + partP + partI + partD;
+
+    float saturated = action;
+    if (saturated > control->actionMax) saturated = control->actionMax;
+    if (saturated < -control->actionMax) saturated = -control->actionMax;
+
+    // Back-calculation: whatever the motor couldn't deliver bleeds back
+    // out of the integral, so it doesn't wind up while saturated.
+    float integralChange = -system->error;
+    integralChange += control->tracking * (saturated - action);
+    control->integral += integralChange * system->dt;
+    if (control->integral > control->integralMax)
+    {
+        control->integral = control->integralMax;
+    }
+    if (control->integral < -control->integralMax)
+    {
+        control->integral = -control->integralMax;
+    }
+
+    control->feedforward = feedforward;
+    system->action = saturated;
+
+    portalUpdateRef(control->portal, control->refs.feedforward);
+    portalUpdateRef(control->portal, control->refs.integral);
+
+    return system->action;
+}
+
+void
+twoDofSetup(ControlHandle handle, Portal * portal)
+{
+    TwoDof * control = handle;
+    control->portal = portal;
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "gain-p",
+            .handler = portalFloatHandler,
+            .handle = &control->gainP
+        },
+        {
+            .key = "gain-i",
+            .handler = portalFloatHandler,
+            .handle = &control->gainI
+        },
+        {
+            .key = "gain-d",
+            .handler = portalFloatHandler,
+            .handle = &control->gainD
+        },
+        {
+            .key = "integral-max",
+            .handler = portalFloatHandler,
+            .handle = &control->integralMax
+        },
+        {
+            .key = "action-max",
+            .handler = portalFloatHandler,
+            .handle = &control->actionMax
+        },
+        {
+            .key = "tracking",
+            .handler = portalFloatHandler,
+            .handle = &control->tracking
+        },
+        {
+            .key = "feedforward",
+            .handler = portalFloatHandler,
+            .handle = &control->feedforward,
+            .ref = &control->refs.feedforward
+        },
+        {
+            .key = "integral",
+            .handler = portalFloatHandler,
+            .handle = &control->integral,
+            .ref = &control->refs.integral
+        },
+
+        // End terminating struct
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+}
+
+// }}}
+
+
 // Bang Bang Controller {{{
 
 typedef struct
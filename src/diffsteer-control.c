@@ -12,7 +12,9 @@ struct Diffsteer
 {
     Portal * portal;
 
-    ReckonerState * state;
+    Reckoner * reckoner;
+    // Snapshot taken at the start of each update
+    ReckonerState state;
 
     DiffsteerMode mode;
     float targetX;
@@ -42,7 +44,8 @@ diffsteerInit(DiffsteerSetup setup)
 
     setupPortal(d, setup);
 
-    d->state = setup.state;
+    d->reckoner = setup.reckoner;
+    d->state = reckonerGetState(d->reckoner);
 
     d->mode = DIFFSTEER_IDLE;
     d->targetX = 0.0f;
@@ -67,7 +70,7 @@ diffsteerRotate(Diffsteer * d, float heading)
 {
     mutexTake(d->mutex, -1);
     d->mode = DIFFSTEER_ROTATING;
-    heading = fmodf(heading + PI, TAU) - PI;
+    heading = fastWrap(heading);
     d->targetHeading = heading;
     mutexGive(d->mutex);
 }
@@ -94,6 +97,7 @@ void
 diffsteerUpdate(Diffsteer * d)
 {
     mutexTake(d->mutex, -1);
+    d->state = reckonerGetState(d->reckoner);
     switch (d->mode)
     {
     case DIFFSTEER_IDLE:
@@ -112,7 +116,7 @@ diffsteerUpdate(Diffsteer * d)
 static void
 updateRotate(Diffsteer * d)
 {
-    float errorHeading = d->targetHeading - d->state->heading;
+    float errorHeading = d->targetHeading - d->state.heading;
     float command = errorHeading * 0.5f * d->gainHeading;
 
     d->motorLeftSet(d->motorLeft, -(int)command);
@@ -122,15 +126,15 @@ updateRotate(Diffsteer * d)
 static void
 updateMove(Diffsteer * d)
 {
-    float errorX = d->targetX - d->state->x;
-    float errorY = d->targetY - d->state->y;
-    float distance = sqrtf(errorX * errorX + errorY * errorY);
+    float errorX = d->targetX - d->state.x;
+    float errorY = d->targetY - d->state.y;
+    float distance = fastSqrt(errorX * errorX + errorY * errorY);
 
-    float targetHeading = atan2f(errorY, errorX);
-    float errorHeading = targetHeading - d->state->heading;
+    float targetHeading = fastAtan2(errorY, errorX);
+    float errorHeading = targetHeading - d->state.heading;
 
     float command = distance * d->gainDistance;
-    command *= cosf(errorHeading);
+    command *= fastCos(errorHeading);
 
     float commandDiff = errorHeading * d->gainHeading;
     float commandLeft = command - 0.5f * commandDiff;
@@ -216,9 +220,10 @@ static void
 modeHandler(void * handle, char * message, char * response)
 {
     if (handle == NULL) return;
+    if (message == NULL) return;
     if (response == NULL) return;
     Diffsteer * d = handle;
-    if (message == NULL)
+    if (message[0] == '\0')
     {
         switch(d->mode)
         {
@@ -0,0 +1,384 @@
+#include "feedforward.h"
+
+#include <API.h>
+#include <string.h>
+#include <stdbool.h>
+#include "pigeon.h"
+
+
+#define UNUSED(x) (void)(x)
+
+// "FFWD", then the version, to tell a table file from anything else
+#define MAGIC 0x44574646UL
+#define VERSION 1UL
+
+// Below this, the battery reading is taken as missing
+#define VOLTAGE_MIN 5.0f
+
+// How often the saver task looks for a changed table, in ms
+#define SAVE_CHECK 500
+
+// Most tables kept in flash, across all flywheels
+#define TABLES 4
+
+
+// Typedefs {{{
+
+struct Feedforward
+{
+    Portal * portal;
+    struct
+    {
+        PortalEntryRef learned;
+    }
+    refs;
+
+    const char * file;
+    float rpmMax;
+    float learningRate;
+    unsigned long saveInterval;
+    unsigned long lastSave;
+    bool changed;
+
+    // Set by the owner while its actuators are stopped
+    volatile bool stopped;
+
+    // Learned points, at FEEDFORWARD_VOLTAGE
+    float actions[FEEDFORWARD_POINTS];
+    float confidence[FEEDFORWARD_POINTS];
+    unsigned int learned;
+};
+
+typedef struct
+FeedforwardFile
+{
+    unsigned long magic;
+    unsigned long version;
+    float rpmMax;
+    float actions[FEEDFORWARD_POINTS];
+    float confidence[FEEDFORWARD_POINTS];
+}
+FeedforwardFile;
+
+// }}}
+
+
+
+
+// Private variables {{{
+
+// Tables kept in flash, all written by the one saver task
+static Feedforward * tables[TABLES];
+static int tableCount = 0;
+static TaskHandle saver = NULL;
+
+// }}}
+
+
+
+
+// Private functions, forward declarations. {{{
+
+static float batteryVoltage();
+static float spacing(Feedforward*);
+static void learn(Feedforward*, int point, float action, float rate);
+static bool load(Feedforward*);
+static void save(Feedforward*);
+static bool canSave();
+static void saveHandler(void * handle, char * message, char * response);
+static void saverTask(void * none);
+
+// }}}
+
+
+
+
+// Public methods {{{
+
+Feedforward *
+feedforwardInit(FeedforwardSetup setup)
+{
+    Feedforward * feedforward = malloc(sizeof(Feedforward));
+
+    feedforward->portal = NULL;
+    feedforward->refs.learned = PORTAL_ENTRY_NONE;
+
+    feedforward->file = setup.file;
+    feedforward->rpmMax = setup.rpmMax;
+    feedforward->learningRate = setup.learningRate;
+    feedforward->saveInterval = setup.saveInterval;
+    feedforward->lastSave = 0;
+    feedforward->changed = false;
+    feedforward->stopped = true;
+
+    // Past TABLES, it's only kept until power off
+    if (feedforward->file != NULL && tableCount >= TABLES)
+    {
+        feedforward->file = NULL;
+    }
+
+    if (!load(feedforward))
+    {
+        for (int i = 0; i < FEEDFORWARD_POINTS; i++)
+        {
+            float rpm = i * spacing(feedforward);
+            feedforward->actions[i] = setup.fallback(rpm);
+            feedforward->confidence[i] = 0.0f;
+        }
+    }
+
+    feedforward->learned = 0;
+    for (int i = 0; i < FEEDFORWARD_POINTS; i++)
+    {
+        if (feedforward->confidence[i] > 0.0f) feedforward->learned++;
+    }
+
+    // Flash writes are slow, so they're kept off the control task
+    if (feedforward->file != NULL)
+    {
+        tables[tableCount++] = feedforward;
+        if (saver == NULL)
+        {
+            saver = taskCreate(
+                saverTask,
+                TASK_DEFAULT_STACK_SIZE,
+                NULL,
+                TASK_PRIORITY_LOWEST
+            );
+        }
+    }
+
+    return feedforward;
+}
+
+
+float
+feedforwardEstimate(Feedforward * feedforward, float target)
+{
+    float position = target / spacing(feedforward);
+    if (position < 0.0f) position = 0.0f;
+    if (position > FEEDFORWARD_POINTS - 1) position = FEEDFORWARD_POINTS - 1;
+
+    int point = (int)position;
+    if (point > FEEDFORWARD_POINTS - 2) point = FEEDFORWARD_POINTS - 2;
+    float fraction = position - point;
+
+    float action = feedforward->actions[point] * (1.0f - fraction);
+    action += feedforward->actions[point + 1] * fraction;
+
+    return action * FEEDFORWARD_VOLTAGE / batteryVoltage();
+}
+
+
+void
+feedforwardRecord(Feedforward * feedforward, float target, float action)
+{
+    if (target <= 0.0f || target > feedforward->rpmMax) return;
+
+    // Same command at a lower voltage would have been less
+    float normalised = action * batteryVoltage() / FEEDFORWARD_VOLTAGE;
+
+    // Pull the two points either side, each by how close it is
+    float position = target / spacing(feedforward);
+    int point = (int)position;
+    if (point > FEEDFORWARD_POINTS - 2) point = FEEDFORWARD_POINTS - 2;
+    float fraction = position - point;
+
+    float rate = feedforward->learningRate;
+    learn(feedforward, point, normalised, rate * (1.0f - fraction));
+    learn(feedforward, point + 1, normalised, rate * fraction);
+
+    // Only marked here, as this runs in the control task. The saver
+    // task writes it out.
+    feedforward->changed = true;
+
+    portalUpdateRef(feedforward->portal, feedforward->refs.learned);
+}
+
+
+void
+feedforwardSave(Feedforward * feedforward)
+{
+    if (!feedforward->changed) return;
+    if (millis() - feedforward->lastSave < feedforward->saveInterval) return;
+    save(feedforward);
+}
+
+
+void
+feedforwardSetStopped(Feedforward * feedforward, bool stopped)
+{
+    feedforward->stopped = stopped;
+}
+
+
+void
+feedforwardSetup(Feedforward * feedforward, Portal * portal)
+{
+    feedforward->portal = portal;
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "ff-rate",
+            .handler = portalFloatHandler,
+            .handle = &feedforward->learningRate
+        },
+        {
+            .key = "ff-learned",
+            .handler = portalUintHandler,
+            .handle = &feedforward->learned,
+            .onchange = true,
+            .ref = &feedforward->refs.learned
+        },
+        {
+            .key = "ff-save",
+            .handler = saveHandler,
+            .handle = feedforward,
+            .manual = true
+        },
+
+        // End terminating struct
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+}
+
+// }}}
+
+
+
+
+// Private functions {{{
+
+static float
+batteryVoltage()
+{
+    float voltage = powerLevelMain() / 1000.0f;
+    if (voltage < VOLTAGE_MIN) return FEEDFORWARD_VOLTAGE;
+    return voltage;
+}
+
+
+static float
+spacing(Feedforward * feedforward)
+{
+    return feedforward->rpmMax / (FEEDFORWARD_POINTS - 1);
+}
+
+
+static void
+learn(Feedforward * feedforward, int point, float action, float rate)
+{
+    if (rate <= 0.0f) return;
+    if (feedforward->confidence[point] == 0.0f) feedforward->learned++;
+
+    feedforward->actions[point] += (action - feedforward->actions[point]) * rate;
+    feedforward->confidence[point] += (1.0f - feedforward->confidence[point]) * rate;
+}
+
+
+static bool
+load(Feedforward * feedforward)
+{
+    if (feedforward->file == NULL) return false;
+
+    FILE * file = fopen(feedforward->file, "r");
+    if (file == NULL) return false;
+
+    FeedforwardFile contents;
+    // PROS counts bytes, not items
+    size_t read = fread(&contents, sizeof(FeedforwardFile), 1, file);
+    fclose(file);
+
+    if (read != sizeof(FeedforwardFile)) return false;
+    if (contents.magic != MAGIC || contents.version != VERSION) return false;
+
+    // Points would be at different speeds, so start over
+    if (contents.rpmMax != feedforward->rpmMax) return false;
+
+    memcpy(feedforward->actions, contents.actions, sizeof(contents.actions));
+    memcpy(feedforward->confidence, contents.confidence, sizeof(contents.confidence));
+    return true;
+}
+
+
+// Flash writes stall every task for a frame or so, so this is only called
+// with the actuators stopped. A failed write is retried next interval.
+static void
+save(Feedforward * feedforward)
+{
+    feedforward->lastSave = millis();
+    if (feedforward->file == NULL)
+    {
+        feedforward->changed = false;
+        return;
+    }
+
+    FeedforwardFile contents;
+    contents.magic = MAGIC;
+    contents.version = VERSION;
+    contents.rpmMax = feedforward->rpmMax;
+    memcpy(contents.actions, feedforward->actions, sizeof(contents.actions));
+    memcpy(contents.confidence, feedforward->confidence, sizeof(contents.confidence));
+
+    FILE * file = fopen(feedforward->file, "w");
+    if (file == NULL) return;
+    size_t written = fwrite(&contents, sizeof(FeedforwardFile), 1, file);
+    fclose(file);
+
+    if (written == sizeof(FeedforwardFile)) feedforward->changed = false;
+}
+
+
+// Disabled, or every flywheel with a table stopped. Anything else would
+// stall on the flash write.
+static bool
+canSave()
+{
+    if (!isEnabled()) return true;
+    for (int i = 0; i < tableCount; i++)
+    {
+        if (!tables[i]->stopped) return false;
+    }
+    return true;
+}
+
+
+// Setting it to anything has the saver task write the table as soon as
+// the flywheels are stopped.
+static void
+saveHandler(void * handle, char * message, char * response)
+{
+    UNUSED(response);
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (message[0] == '\0') return;
+
+    Feedforward * feedforward = handle;
+    feedforward->changed = true;
+    feedforward->lastSave = millis() - feedforward->saveInterval;
+}
+
+
+static void
+saverTask(void * none)
+{
+    UNUSED(none);
+    while (true)
+    {
+        if (canSave())
+        {
+            for (int i = 0; i < tableCount; i++)
+            {
+                feedforwardSave(tables[i]);
+            }
+        }
+        delay(SAVE_CHECK);
+    }
+}
+
+// }}}
@@ -0,0 +1,77 @@
+#include "fixed.h"
+
+#include <API.h>
+#include <stdbool.h>
+#include "utils.h"
+
+
+// 65536 / 1000000, scaled by another 2^16: microseconds to Q16.16 seconds
+// with a multiply and a shift. Out by less than one part in 100000.
+#define MICROS_TO_FIXED 4295
+
+
+Fixed
+fixedFromMicros(unsigned long micros)
+{
+    return (Fixed)(((uint64_t)micros * MICROS_TO_FIXED) >> FIXED_SHIFT);
+}
+
+
+//
+// Same as the float filter, rearranged so that nothing is divided:
+// change * dt / smoothing / dt is just change / smoothing.
+//
+void
+fixedLowPass(FixedSystem * system, Fixed rpm, Fixed smoothingReciprocal)
+{
+    Fixed rate = fixedMul(system->dt, smoothingReciprocal);
+    Fixed difference = rpm - system->measured;
+    Fixed measureChange = fixedMul(difference, rate);
+    Fixed derivative = fixedMul(difference, smoothingReciprocal);
+    Fixed derivativeChange = fixedMul(derivative - system->derivative, rate);
+
+    system->measured += measureChange;
+    system->derivative += derivativeChange;
+}
+
+
+void
+fixedFormat(Fixed x, char * destination)
+{
+    bool negative = x < 0;
+    uint32_t magnitude = negative ? -(int64_t)x : x;
+
+    // Round to four places
+    uint32_t whole = magnitude >> FIXED_SHIFT;
+    uint32_t fraction = magnitude & (FIXED_ONE - 1);
+    uint32_t places = (fraction * 10000 + FIXED_HALF) >> FIXED_SHIFT;
+    if (places >= 10000)
+    {
+        whole++;
+        places -= 10000;
+    }
+
+    sprintf(
+        destination,
+        "%s%lu.%04lu",
+        negative ? "-" : "",
+        (unsigned long)whole,
+        (unsigned long)places
+    );
+}
+
+
+void
+fixedHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Fixed * var = handle;
+    if (message[0] == '\0') fixedFormat(*var, response);
+    else
+    {
+        float value;
+        if (stringToFloat(message, &value)) *var = fixedFromFloat(value);
+    }
+}
@@ -9,6 +9,11 @@
 struct Flap
 {
     Portal * portal;
+    struct
+    {
+        PortalEntryRef state;
+    }
+    refs;
 
     float slew;
     float command;
@@ -103,7 +108,7 @@ flapOpen(Flap * flap)
 {
     mutexTake(flap->mutex, -1);
     flap->state = FLAP_OPENING;
-    portalUpdate(flap->portal, "state");
+    portalUpdateRef(flap->portal, flap->refs.state);
     mutexGive(flap->mutex);
 }
 
@@ -112,7 +117,7 @@ flapClose(Flap * flap)
 {
     mutexTake(flap->mutex, -1);
     flap->state = FLAP_CLOSING;
-    portalUpdate(flap->portal, "state");
+    portalUpdateRef(flap->portal, flap->refs.state);
     mutexGive(flap->mutex);
 }
 
@@ -187,7 +192,7 @@ update(Flap * flap)
         if (!isClosed)
         {
             flap->state = FLAP_CLOSING;
-            portalUpdate(flap->portal, "state");
+            portalUpdateRef(flap->portal, flap->refs.state);
             flap->command = -127;
             activate(flap);
         }
@@ -197,7 +202,7 @@ update(Flap * flap)
         if (isOpened)
         {
             flap->state = FLAP_OPENED;
-            portalUpdate(flap->portal, "state");
+            portalUpdateRef(flap->portal, flap->refs.state);
             readify(flap);
             semaphoreGive(flap->semaphoreOpened);
         }
@@ -214,7 +219,7 @@ update(Flap * flap)
         if (!isOpened)
         {
             flap->state = FLAP_OPENING;
-            portalUpdate(flap->portal, "state");
+            portalUpdateRef(flap->portal, flap->refs.state);
             flap->command = 127;
             activate(flap);
         }
@@ -224,7 +229,7 @@ update(Flap * flap)
         if (isClosed)
         {
             flap->state = FLAP_CLOSED;
-            portalUpdate(flap->portal, "state");
+            portalUpdateRef(flap->portal, flap->refs.state);
             readify(flap);
             semaphoreGive(flap->semaphoreClosed);
         }
@@ -267,7 +272,8 @@ initPortal(Flap * flap, FlapSetup setup)
             .key = "state",
             .handler = stateHandler,
             .handle = flap,
-            .onchange = true
+            .onchange = true,
+            .ref = &flap->refs.state
         },
         {
             .key = "open",
@@ -315,9 +321,10 @@ static void
 stateHandler(void * handle, char * message, char * response)
 {
     if (handle == NULL) return;
+    if (message == NULL) return;
     if (response == NULL) return;
     Flap * flap = handle;
-    if (message == NULL)
+    if (message[0] == '\0')
     {
         switch (flap->state)
         {
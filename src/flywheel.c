@@ -5,28 +5,71 @@
 #include <stdbool.h>
 #include "pigeon.h"
 #include "control.h"
+#include "fixed.h"
 #include "utils.h"
 #include "shims.h"
 
 
 #define UNUSED(x) (void)(x)
 
+// With no target and under this, the flywheel counts as stopped, in rpm
+#define STOPPED_RPM 10.0f
+
+// Period jitter histogram bucket edges, in microseconds either side of
+// the frame delay. The last bucket takes everything beyond them.
+#define JITTERBUCKETS 5
+static const unsigned long jitterEdges[JITTERBUCKETS - 1] =
+{
+    250, 500, 1000, 2000
+};
+
 
 // Typedefs {{{
 
 struct Flywheel
 {
     Portal * portal;
+    struct
+    {
+        PortalEntryRef dt;
+        PortalEntryRef target;
+        PortalEntryRef measured;
+        PortalEntryRef derivative;
+        PortalEntryRef error;
+        PortalEntryRef action;
+        PortalEntryRef raw;
+        PortalEntryRef ready;
+        PortalEntryRef delay;
+        PortalEntryRef overruns;
+        PortalEntryRef shots;
+        PortalEntryRef shotRecovery;
+    }
+    refs;
 
     ControlSystem system;
+#ifdef CONTROL_FIXED
+    // What the filter and controller run on. system is a copy of it, for
+    // telemetry and the ready and shot checks.
+    FixedSystem fixed;
+    uint32_t targetBits;
+    FixedUpdater controlUpdate;
+#else
     ControlUpdater controlUpdate;
+#endif
     ControlResetter controlReset;
     ControlHandle control;
+    Feedforward * feedforward;
 
     float measuredRaw;
+    FlywheelKalman kalman;
+    float disturbance;
 
     float gearing;
     float smoothing;
+
+    // For the fixed point filter, set along with smoothing, so it doesn't
+    // divide every frame
+    Fixed smoothingReciprocal;
     EncoderGetter encoderGet;
     EncoderResetter encoderReset;
     EncoderHandle encoder;
@@ -42,7 +85,33 @@ struct Flywheel
     unsigned long frameDelayActive;
     float thresholdError;
     float thresholdDerivative;
-    int checkCycle;
+    float thresholdMean;
+    float thresholdDeviation;
+
+    // Ring of the last readyWindow errors, for checkReady
+    int readyWindow;
+    float errors[FLYWHEEL_READY_WINDOW];
+    int errorCount;
+    int errorNext;
+    float errorMean;
+    float errorDeviation;
+
+    // Shot detection and recovery
+    float shotDerivative;
+    float shotBoost;
+    unsigned long shotBoostTime;
+    bool boosting;
+    float boostBase;
+    unsigned long boostUntil;
+    bool recovering;
+    unsigned long shotTime;
+    unsigned long shots;
+    unsigned long shotRecovery;
+
+    // Frame timing, against absolute deadlines
+    unsigned long overruns;
+    unsigned long lastWake;
+    unsigned long jitter[JITTERBUCKETS];
 
     Semaphore readySemaphore;
     FlywheelHandler onready;
@@ -52,6 +121,15 @@ struct Flywheel
 
     Mutex mutex;
     TaskHandle task;
+    bool grouped;
+};
+
+struct FlywheelGroup
+{
+    Flywheel * flywheels[FLYWHEEL_GROUP_MAX];
+    int count;
+    unsigned int priority;
+    TaskHandle task;
 };
 
 /// }}}
@@ -62,15 +140,32 @@ struct Flywheel
 // Private functions, forward declarations. {{{
 
 static void task(void * flywheelPointer);
-static void update(Flywheel*);
-static void updateSystem(Flywheel*);
+static void groupTask(void * groupPointer);
+static void waitForNextFrame(
+    Flywheel ** flywheels,
+    int count,
+    unsigned long period,
+    unsigned long * deadline
+);
+static void update(Flywheel*, unsigned long microTime);
+static void updateSystem(Flywheel*, unsigned long microTime);
+#ifdef CONTROL_FIXED
+static void updateSystemFixed(Flywheel*, unsigned long microTime);
+#endif
+static void filterLowPass(Flywheel*, float rpm, float dt);
+static void filterKalman(Flywheel*, float rpm, float dt);
 static void updateControl(Flywheel*);
+static void checkShot(Flywheel*);
+static void updateBoost(Flywheel*);
 static void updateMotor(Flywheel*);
 static void checkReady(Flywheel*);
+static bool windowReady(Flywheel*);
 static void activate(Flywheel*);
 static void readify(Flywheel*);
 static void setupPortal(Flywheel*, FlywheelSetup);
 static void readyHandler(void * handle, char * message, char * response);
+static void jitterHandler(void * handle, char * message, char * response);
+static void smoothingHandler(void * handle, char * message, char * response);
 
 static void printDebugInfo(Flywheel*);
 
@@ -95,14 +190,28 @@ flywheelInit(FlywheelSetup setup)
     flywheel->system.derivative = 0.0f;
     flywheel->system.error = 0.0f;
     flywheel->system.action = 0.0f;
+#ifdef CONTROL_FIXED
+    memset(&flywheel->fixed, 0, sizeof(FixedSystem));
+    flywheel->fixed.microTime = flywheel->system.microTime;
+    flywheel->targetBits = 0;
+#endif
 
     flywheel->controlUpdate = setup.controlUpdater;
     flywheel->controlReset = setup.controlResetter;
     flywheel->control = setup.control;
     setup.controlSetup(setup.control, flywheel->portal);
 
+    flywheel->feedforward = setup.feedforward;
+    if (flywheel->feedforward != NULL)
+    {
+        feedforwardSetup(flywheel->feedforward, flywheel->portal);
+    }
+
     flywheel->gearing = setup.gearing;
     flywheel->smoothing = setup.smoothing;
+    flywheel->smoothingReciprocal = fixedFromFloat(1.0f / setup.smoothing);
+    flywheel->kalman = setup.kalman;
+    flywheel->disturbance = 0.0f;
     flywheel->encoderGet = setup.encoderGetter;
     flywheel->encoderReset = setup.encoderResetter;
     flywheel->encoder = setup.encoder;
@@ -123,8 +232,29 @@ flywheelInit(FlywheelSetup setup)
 
     flywheel->thresholdError = setup.thresholdError;
     flywheel->thresholdDerivative = setup.thresholdDerivative;
-
-    flywheel->checkCycle = setup.checkCycle;
+    flywheel->thresholdMean = setup.thresholdMean;
+    flywheel->thresholdDeviation = setup.thresholdDeviation;
+
+    flywheel->readyWindow = setup.readyWindow;
+    flywheel->errorCount = 0;
+    flywheel->errorNext = 0;
+    flywheel->errorMean = 0.0f;
+    flywheel->errorDeviation = 0.0f;
+
+    flywheel->shotDerivative = setup.shotDerivative;
+    flywheel->shotBoost = setup.shotBoost;
+    flywheel->shotBoostTime = setup.shotBoostTime;
+    flywheel->boosting = false;
+    flywheel->boostBase = 0.0f;
+    flywheel->boostUntil = 0;
+    flywheel->recovering = false;
+    flywheel->shotTime = 0;
+    flywheel->shots = 0;
+    flywheel->shotRecovery = 0;
+
+    flywheel->overruns = 0;
+    flywheel->lastWake = 0;
+    memset(flywheel->jitter, 0, sizeof(flywheel->jitter));
 
     flywheel->readySemaphore = semaphoreCreate();
     flywheel->onready = setup.onready;
@@ -133,7 +263,9 @@ flywheelInit(FlywheelSetup setup)
     flywheel->onactiveHandle = setup.onactiveHandle;
 
     flywheel->mutex = mutexCreate();
+    portalSetMutex(flywheel->portal, flywheel->mutex);
     flywheel->task = NULL;
+    flywheel->grouped = false;
 
     portalReady(flywheel->portal);
 
@@ -149,11 +281,19 @@ flywheelReset(Flywheel * flywheel)
     flywheel->system.derivative = 0.0f;
     flywheel->system.error = 0.0f;
     flywheel->system.action = 0.0f;
-
-    portalUpdate(flywheel->portal, "measured");
-    portalUpdate(flywheel->portal, "derivative");
-    portalUpdate(flywheel->portal, "error");
-    portalUpdate(flywheel->portal, "action");
+#ifdef CONTROL_FIXED
+    flywheel->fixed.measured = 0;
+    flywheel->fixed.derivative = 0;
+    flywheel->fixed.error = 0;
+    flywheel->fixed.action = 0;
+#endif
+    flywheel->disturbance = 0.0f;
+    flywheel->errorCount = 0;
+
+    portalUpdateRef(flywheel->portal, flywheel->refs.measured);
+    portalUpdateRef(flywheel->portal, flywheel->refs.derivative);
+    portalUpdateRef(flywheel->portal, flywheel->refs.error);
+    portalUpdateRef(flywheel->portal, flywheel->refs.action);
 
     flywheel->controlReset(flywheel->control);
     flywheel->encoderReset(flywheel->encoder);
@@ -167,7 +307,7 @@ flywheelSet(Flywheel * flywheel, float rpm)
     flywheel->system.target = rpm;
     mutexGive(flywheel->mutex);
 
-    portalUpdate(flywheel->portal, "target");
+    portalUpdateRef(flywheel->portal, flywheel->refs.target);
 
     if (flywheel->ready)
     {
@@ -178,6 +318,7 @@ flywheelSet(Flywheel * flywheel, float rpm)
 void
 flywheelRun(Flywheel * flywheel)
 {
+    if (flywheel->grouped) return;
     if (flywheel->task == NULL)
     {
         flywheelReset(flywheel);
@@ -197,6 +338,72 @@ waitUntilFlywheelReady(Flywheel * flywheel, const unsigned long blockTime)
     semaphoreTake(flywheel->readySemaphore, blockTime);
 }
 
+FlywheelGroup *
+flywheelGroupInit(FlywheelGroupSetup setup)
+{
+    FlywheelGroup * group = malloc(sizeof(FlywheelGroup));
+    group->count = 0;
+    for (int i = 0; i < FLYWHEEL_GROUP_MAX && setup.flywheels[i]; i++)
+    {
+        group->flywheels[i] = setup.flywheels[i];
+        group->flywheels[i]->grouped = true;
+        group->count++;
+    }
+    group->priority = setup.priority;
+    group->task = NULL;
+    return group;
+}
+
+void
+flywheelGroupRun(FlywheelGroup * group)
+{
+    if (group->task == NULL)
+    {
+        for (int i = 0; i < group->count; i++)
+        {
+            flywheelReset(group->flywheels[i]);
+        }
+        group->task = taskCreate(
+            groupTask,
+            TASK_DEFAULT_STACK_SIZE,
+            group,
+            group->priority
+        );
+    }
+}
+
+bool
+waitUntilGroupReady(FlywheelGroup * group, const unsigned long blockTime)
+{
+    unsigned long start = millis();
+    while (true)
+    {
+        Flywheel * waiting = NULL;
+        for (int i = 0; i < group->count; i++)
+        {
+            if (!group->flywheels[i]->ready)
+            {
+                waiting = group->flywheels[i];
+                break;
+            }
+        }
+        if (waiting == NULL) return true;
+
+        // One can go active again while waiting on another, so keep
+        // checking all of them until the time runs out.
+        unsigned long elapsed = millis() - start;
+        if (blockTime != (unsigned long)-1)
+        {
+            if (elapsed >= blockTime) return false;
+            waitUntilFlywheelReady(waiting, blockTime - elapsed);
+        }
+        else
+        {
+            waitUntilFlywheelReady(waiting, blockTime);
+        }
+    }
+}
+
 // }}}
 
 
@@ -208,18 +415,87 @@ static void
 task(void * flywheelPointer)
 {
     Flywheel * flywheel = flywheelPointer;
-    int i = 0;
+    unsigned long deadline = millis();
+    flywheel->lastWake = micros();
     while (true)
     {
-        i = flywheel->checkCycle;
-        while (i)
+        update(flywheel, micros());
+        printDebugInfo(flywheel);
+        checkReady(flywheel);
+        waitForNextFrame(&flywheel, 1, flywheel->frameDelay, &deadline);
+    }
+}
+
+
+static void
+groupTask(void * groupPointer)
+{
+    FlywheelGroup * group = groupPointer;
+    unsigned long deadline = millis();
+    unsigned long start = micros();
+    for (int i = 0; i < group->count; i++)
+    {
+        group->flywheels[i]->lastWake = start;
+    }
+    while (true)
+    {
+        unsigned long microTime = micros();
+        unsigned long period = (unsigned long)-1;
+        for (int i = 0; i < group->count; i++)
         {
-            update(flywheel);
+            Flywheel * flywheel = group->flywheels[i];
+            update(flywheel, microTime);
             printDebugInfo(flywheel);
-            delay(flywheel->frameDelay);
-            --i;
+            checkReady(flywheel);
+            if (flywheel->frameDelay < period) period = flywheel->frameDelay;
         }
-        checkReady(flywheel);
+        waitForNextFrame(group->flywheels, group->count, period, &deadline);
+    }
+}
+
+
+// Sleeps until one frame delay after the last deadline, so the period
+// doesn't stretch with however long the update took. A frame that ran
+// past its deadline is counted and skipped, keeping the phase instead of
+// running a burst of late frames to catch up. Changing the frame delay
+// takes effect from the last deadline, so that keeps its phase too.
+// Every flywheel given shares the loop, so each counts its timing.
+static void
+waitForNextFrame(
+    Flywheel ** flywheels,
+    int count,
+    unsigned long period,
+    unsigned long * deadline)
+{
+    if (period == 0) period = 1;
+
+    unsigned long now = millis();
+    unsigned long missed = 0;
+    if (now - *deadline >= period)
+    {
+        missed = (now - *deadline) / period;
+        *deadline += missed * period;
+    }
+    taskDelayUntil(deadline, period);
+
+    unsigned long wake = micros();
+    for (int i = 0; i < count; i++)
+    {
+        Flywheel * flywheel = flywheels[i];
+        if (missed > 0)
+        {
+            flywheel->overruns += missed;
+            portalUpdateRef(flywheel->portal, flywheel->refs.overruns);
+        }
+
+        unsigned long actual = wake - flywheel->lastWake;
+        unsigned long expected = period * 1000;
+        unsigned long jitter = actual > expected ? actual - expected : expected - actual;
+        flywheel->lastWake = wake;
+
+        int bucket = 0;
+        while (bucket < JITTERBUCKETS - 1 && jitter >= jitterEdges[bucket]) bucket++;
+        flywheel->jitter[bucket]++;
     }
 }
 
@@ -240,54 +516,158 @@ printDebugInfo(Flywheel * flywheel)
 
 
 static void
-update(Flywheel * flywheel)
+update(Flywheel * flywheel, unsigned long microTime)
 {
     mutexTake(flywheel->mutex, -1);
-    updateSystem(flywheel);
-    updateControl(flywheel);
+    updateSystem(flywheel, microTime);
+    checkShot(flywheel);
+    if (flywheel->boosting) updateBoost(flywheel);
+    else updateControl(flywheel);
     updateMotor(flywheel);
+    if (flywheel->feedforward != NULL)
+    {
+        bool stopped = flywheel->system.target == 0.0f &&
+            isWithin(flywheel->system.measured, STOPPED_RPM);
+        feedforwardSetStopped(flywheel->feedforward, stopped);
+    }
     portalFlush(flywheel->portal);
     mutexGive(flywheel->mutex);
 }
 
 
 static void
-updateSystem(Flywheel * flywheel)
+updateSystem(Flywheel * flywheel, unsigned long microTime)
 {
-    float dt = timeUpdate(&flywheel->system.microTime);
+#ifdef CONTROL_FIXED
+    updateSystemFixed(flywheel, microTime);
+#else
+    float dt = (microTime - flywheel->system.microTime) / 1000000.0f;
+    flywheel->system.microTime = microTime;
     flywheel->system.dt = dt;
 
     // Raw rpm
     float rpm = flywheel->encoderGet(flywheel->encoder).rpm;
     rpm *= flywheel->gearing;
+    flywheel->measuredRaw = rpm;
+
+    if (flywheel->kalman.gainSpeed > 0.0f) filterKalman(flywheel, rpm, dt);
+    else filterLowPass(flywheel, rpm, dt);
 
-    // Low-pass filter
+    // Calculate error
+    float error = flywheel->system.measured - flywheel->system.target;
+    flywheel->system.error = error;
+#endif
+
+    portalUpdateRef(flywheel->portal, flywheel->refs.dt);
+    portalUpdateRef(flywheel->portal, flywheel->refs.raw);
+    portalUpdateRef(flywheel->portal, flywheel->refs.measured);
+    portalUpdateRef(flywheel->portal, flywheel->refs.derivative);
+    portalUpdateRef(flywheel->portal, flywheel->refs.error);
+}
+
+
+#ifdef CONTROL_FIXED
+// Converts only the reading, and a new target. The Kalman filter is float
+// only, so with it on the speed is converted back each frame.
+static void
+updateSystemFixed(Flywheel * flywheel, unsigned long microTime)
+{
+    FixedSystem * fixed = &flywheel->fixed;
+    fixed->dt = fixedFromMicros(microTime - fixed->microTime);
+    fixed->microTime = microTime;
+
+    // Raw rpm
+    float rpm = flywheel->encoderGet(flywheel->encoder).rpm;
+    rpm *= flywheel->gearing;
+    flywheel->measuredRaw = rpm;
+
+    if (flywheel->kalman.gainSpeed > 0.0f)
+    {
+        filterKalman(flywheel, rpm, fixedToFloat(fixed->dt));
+        fixed->measured = fixedFromFloat(flywheel->system.measured);
+        fixed->derivative = fixedFromFloat(flywheel->system.derivative);
+    }
+    else
+    {
+        fixedLowPass(fixed, fixedFromFloat(rpm), flywheel->smoothingReciprocal);
+    }
+
+    // The target is set as a float, from flywheelSet or the portal, so it's
+    // only converted when it changes. Its bits are compared, as comparing
+    // floats is a call too.
+    uint32_t targetBits;
+    memcpy(&targetBits, &flywheel->system.target, sizeof(targetBits));
+    if (targetBits != flywheel->targetBits)
+    {
+        flywheel->targetBits = targetBits;
+        fixed->target = fixedFromFloat(flywheel->system.target);
+    }
+
+    fixed->error = fixed->measured - fixed->target;
+
+    flywheel->system.microTime = microTime;
+    flywheel->system.dt = fixedToFloat(fixed->dt);
+    flywheel->system.measured = fixedToFloat(fixed->measured);
+    flywheel->system.derivative = fixedToFloat(fixed->derivative);
+    flywheel->system.error = fixedToFloat(fixed->error);
+}
+#endif
+
+
+static void
+filterLowPass(Flywheel * flywheel, float rpm, float dt)
+{
     float measureChange = (rpm - flywheel->system.measured);
     measureChange *= dt / flywheel->smoothing;
     float derivative = measureChange / dt;
     float derivativeChange = (derivative - flywheel->system.derivative);
     derivativeChange *= dt / flywheel->smoothing;
 
-    // Update
-    flywheel->measuredRaw = rpm;
     flywheel->system.measured += measureChange;
     flywheel->system.derivative += derivativeChange;
+}
 
-    // Calculate error
-    float error = flywheel->system.measured - flywheel->system.target;
-    flywheel->system.error = error;
 
-    portalUpdate(flywheel->portal, "dt");
-    portalUpdate(flywheel->portal, "raw");
-    portalUpdate(flywheel->portal, "measured");
-    portalUpdate(flywheel->portal, "derivative");
-    portalUpdate(flywheel->portal, "error");
+static void
+filterKalman(Flywheel * flywheel, float rpm, float dt)
+{
+    FlywheelKalman * kalman = &flywheel->kalman;
+    ControlSystem * system = &flywheel->system;
+
+    // Predict from the action that drove it over the last frame
+    float acceleration = kalman->gain * system->action;
+    acceleration -= kalman->decay * system->measured;
+    acceleration += flywheel->disturbance;
+    float predicted = system->measured + acceleration * dt;
+
+    // Correct
+    float innovation = rpm - predicted;
+    system->measured = predicted + kalman->gainSpeed * innovation;
+    flywheel->disturbance += kalman->gainDisturbance * innovation;
+
+    system->derivative = kalman->gain * system->action;
+    system->derivative -= kalman->decay * system->measured;
+    system->derivative += flywheel->disturbance;
 }
 
 
 static void
 updateControl(Flywheel * flywheel)
 {
+#ifdef CONTROL_FIXED
+    FixedSystem * fixed = &flywheel->fixed;
+    flywheel->controlUpdate(flywheel->control, fixed);
+
+    if (fixed->action > FIXED_FROM_INT(127))
+    {
+        fixed->action = FIXED_FROM_INT(127);
+    }
+    if (fixed->action < FIXED_FROM_INT(-127))
+    {
+        fixed->action = FIXED_FROM_INT(-127);
+    }
+    flywheel->system.action = fixedToFloat(fixed->action);
+#else
     flywheel->controlUpdate(flywheel->control, &flywheel->system);
 
     if (flywheel->system.action > 127)
@@ -298,34 +678,97 @@ updateControl(Flywheel * flywheel)
     {
         flywheel->system.action = -127;
     }
-    portalUpdate(flywheel->portal, "action");
+#endif
+    portalUpdateRef(flywheel->portal, flywheel->refs.action);
+}
+
+
+// A ball going through drags the speed down much faster than anything the
+// controller does, so a steep drop while ready is taken to be a shot.
+static void
+checkShot(Flywheel * flywheel)
+{
+    if (flywheel->shotDerivative >= 0.0f) return;
+    if (!flywheel->ready || flywheel->boosting) return;
+    if (flywheel->system.derivative > flywheel->shotDerivative) return;
+
+    flywheel->boosting = true;
+    flywheel->boostBase = flywheel->system.action;
+    flywheel->boostUntil = millis() + flywheel->shotBoostTime;
+    flywheel->recovering = true;
+    flywheel->shotTime = millis();
+    flywheel->shots++;
+    portalUpdateRef(flywheel->portal, flywheel->refs.shots);
+
+    activate(flywheel);
+}
+
+
+// Holds the pre-shot action plus the boost, then hands back to the
+// controller from the pre-shot action, as if the shot never pushed it off.
+static void
+updateBoost(Flywheel * flywheel)
+{
+    if ((long)(millis() - flywheel->boostUntil) >= 0)
+    {
+        flywheel->boosting = false;
+        flywheel->system.action = flywheel->boostBase;
+#ifdef CONTROL_FIXED
+        flywheel->fixed.action = fixedFromFloat(flywheel->boostBase);
+#endif
+        updateControl(flywheel);
+        return;
+    }
+
+    flywheel->system.action = flywheel->boostBase + flywheel->shotBoost;
+    if (flywheel->system.action > 127)
+    {
+        flywheel->system.action = 127;
+    }
+#ifdef CONTROL_FIXED
+    // Only while boosting, after a shot
+    flywheel->fixed.action = fixedFromFloat(flywheel->system.action);
+#endif
+    portalUpdateRef(flywheel->portal, flywheel->refs.action);
 }
 
 
 static void
 updateMotor(Flywheel * flywheel)
 {
+#ifdef CONTROL_FIXED
+    int command = fixedTruncate(flywheel->fixed.action);
+#else
     int command = (int)flywheel->system.action;
+#endif
     for (int i = 0; flywheel->motorSet[i] && i < 8; i++)
     {
         MotorHandle handle = flywheel->motors[i];
-        printf("Flywheel motor #%d:\n", i);
         flywheel->motorSet[i](handle, command);
     }
 }
 
 
+// Runs every frame, so it goes ready the frame the window settles, and
+// active again the frame an error leaves the threshold.
 static void
 checkReady(Flywheel * flywheel)
 {
-    bool errorReady =
-        isWithin(flywheel->system.error, flywheel->thresholdError);
     bool derivativeReady =
         isWithin(flywheel->system.derivative, flywheel->thresholdDerivative);
-    bool ready = errorReady && derivativeReady;
+    bool ready = windowReady(flywheel) && derivativeReady;
 
     if (ready && !flywheel->ready)
     {
+        // Settled on its own, so the action is what this target needs
+        if (flywheel->feedforward != NULL)
+        {
+            feedforwardRecord(
+                flywheel->feedforward,
+                flywheel->system.target,
+                flywheel->system.action
+            );
+        }
         readify(flywheel);
     }
     else if (!ready && flywheel->ready)
@@ -335,17 +778,63 @@ checkReady(Flywheel * flywheel)
 }
 
 
+// Adds this frame's error to the window and checks the rules over it.
+// The window is short, so the statistics are worked out afresh each time
+// rather than kept as running sums that would drift.
+static bool
+windowReady(Flywheel * flywheel)
+{
+    int window = flywheel->readyWindow;
+    if (window < 1) window = 1;
+    if (window > FLYWHEEL_READY_WINDOW) window = FLYWHEEL_READY_WINDOW;
+    if (flywheel->errorNext >= window) flywheel->errorNext = 0;
+    if (flywheel->errorCount > window) flywheel->errorCount = window;
+
+    flywheel->errors[flywheel->errorNext] = flywheel->system.error;
+    flywheel->errorNext = (flywheel->errorNext + 1) % window;
+    if (flywheel->errorCount < window) flywheel->errorCount++;
+
+    bool withinError = true;
+    float sum = 0.0f;
+    for (int i = 0; i < flywheel->errorCount; i++)
+    {
+        float error = flywheel->errors[i];
+        if (!isWithin(error, flywheel->thresholdError)) withinError = false;
+        sum += error;
+    }
+    float mean = sum / flywheel->errorCount;
+    float variance = 0.0f;
+    for (int i = 0; i < flywheel->errorCount; i++)
+    {
+        float difference = flywheel->errors[i] - mean;
+        variance += difference * difference;
+    }
+    variance /= flywheel->errorCount;
+    flywheel->errorMean = mean;
+    flywheel->errorDeviation = fastSqrt(variance);
+
+    if (flywheel->errorCount < window) return false;
+    if (!withinError) return false;
+    if (flywheel->thresholdMean > 0.0f &&
+        !isWithin(mean, flywheel->thresholdMean)) return false;
+    float deviation = flywheel->thresholdDeviation;
+    if (deviation > 0.0f && variance > deviation * deviation) return false;
+    return true;
+}
+
+
 static void
 activate(Flywheel * flywheel)
 {
     flywheel->ready = false;
+    flywheel->errorCount = 0;
     flywheel->frameDelay = flywheel->frameDelayActive;
     if (flywheel->task)
     {
         taskPrioritySet(flywheel->task, flywheel->priorityActive);
     }
-    portalUpdate(flywheel->portal, "ready");
-    portalUpdate(flywheel->portal, "delay");
+    portalUpdateRef(flywheel->portal, flywheel->refs.ready);
+    portalUpdateRef(flywheel->portal, flywheel->refs.delay);
 
     if (flywheel->onactive != NULL)
     {
@@ -359,14 +848,21 @@ activate(Flywheel * flywheel)
 static void
 readify(Flywheel * flywheel)
 {
+    if (flywheel->recovering)
+    {
+        flywheel->recovering = false;
+        flywheel->shotRecovery = millis() - flywheel->shotTime;
+        portalUpdateRef(flywheel->portal, flywheel->refs.shotRecovery);
+    }
+
     flywheel->ready = true;
     flywheel->frameDelay = flywheel->frameDelayReady;
     if (flywheel->task)
     {
         taskPrioritySet(flywheel->task, flywheel->priorityReady);
     }
-    portalUpdate(flywheel->portal, "ready");
-    portalUpdate(flywheel->portal, "delay");
+    portalUpdateRef(flywheel->portal, flywheel->refs.ready);
+    portalUpdateRef(flywheel->portal, flywheel->refs.delay);
 
     if (flywheel->onready != NULL)
     {
@@ -398,42 +894,64 @@ setupPortal(Flywheel * flywheel, FlywheelSetup setup)
         {
             .key = "dt",
             .handler = portalFloatHandler,
-            .handle = &flywheel->system.dt
+            .handle = &flywheel->system.dt,
+            .ref = &flywheel->refs.dt
         },
         {
             .key = "target",
             .handler = portalFloatHandler,
             .handle = &flywheel->system.target,
             .stream = true,
-            .onchange = true
+            .onchange = true,
+            .ref = &flywheel->refs.target
         },
         {
             .key = "measured",
             .handler = portalFloatHandler,
             .handle = &flywheel->system.measured,
-            .stream = true
+            .stream = true,
+            .ref = &flywheel->refs.measured
         },
         {
             .key = "derivative",
             .handler = portalFloatHandler,
             .handle = &flywheel->system.derivative,
-            .stream = true
+            .stream = true,
+            .ref = &flywheel->refs.derivative
         },
         {
             .key = "error",
             .handler = portalFloatHandler,
-            .handle = &flywheel->system.error
+            .handle = &flywheel->system.error,
+            .ref = &flywheel->refs.error
         },
         {
             .key = "action",
             .handler = portalFloatHandler,
             .handle = &flywheel->system.action,
-            .stream = true
+            .stream = true,
+            .ref = &flywheel->refs.action
         },
         {
             .key = "raw",
             .handler = portalFloatHandler,
-            .handle = &flywheel->measuredRaw
+            .handle = &flywheel->measuredRaw,
+            .ref = &flywheel->refs.raw
+        },
+        {
+            .key = "disturbance",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->disturbance
+        },
+        {
+            .key = "kalman-gain-speed",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->kalman.gainSpeed
+        },
+        {
+            .key = "kalman-gain-disturbance",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->kalman.gainDisturbance
         },
         {
             .key = "gearing",
@@ -442,14 +960,15 @@ setupPortal(Flywheel * flywheel, FlywheelSetup setup)
         },
         {
             .key = "smoothing",
-            .handler = portalFloatHandler,
-            .handle = &flywheel->smoothing
+            .handler = smoothingHandler,
+            .handle = flywheel
         },
         {
             .key = "ready",
             .handler = readyHandler,
             .handle = flywheel,
-            .onchange = true
+            .onchange = true,
+            .ref = &flywheel->refs.ready
         },
         {
             .key = "priority-ready",
@@ -465,7 +984,8 @@ setupPortal(Flywheel * flywheel, FlywheelSetup setup)
             .key = "delay",
             .handler = portalUlongHandler,
             .handle = &flywheel->frameDelay,
-            .onchange = true
+            .onchange = true,
+            .ref = &flywheel->refs.delay
         },
         {
             .key = "delay-ready",
@@ -488,9 +1008,70 @@ setupPortal(Flywheel * flywheel, FlywheelSetup setup)
             .handle = &flywheel->thresholdDerivative
         },
         {
-            .key = "check-cycle",
+            .key = "overruns",
+            .handler = portalUlongHandler,
+            .handle = &flywheel->overruns,
+            .onchange = true,
+            .ref = &flywheel->refs.overruns
+        },
+        {
+            .key = "jitter",
+            .handler = jitterHandler,
+            .handle = flywheel
+        },
+        {
+            .key = "shot-derivative",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->shotDerivative
+        },
+        {
+            .key = "shot-boost",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->shotBoost
+        },
+        {
+            .key = "shot-boost-time",
+            .handler = portalUlongHandler,
+            .handle = &flywheel->shotBoostTime
+        },
+        {
+            .key = "shots",
+            .handler = portalUlongHandler,
+            .handle = &flywheel->shots,
+            .onchange = true,
+            .ref = &flywheel->refs.shots
+        },
+        {
+            .key = "shot-recovery",
+            .handler = portalUlongHandler,
+            .handle = &flywheel->shotRecovery,
+            .onchange = true,
+            .ref = &flywheel->refs.shotRecovery
+        },
+        {
+            .key = "threshold-mean",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->thresholdMean
+        },
+        {
+            .key = "threshold-deviation",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->thresholdDeviation
+        },
+        {
+            .key = "ready-window",
             .handler = portalIntHandler,
-            .handle = &flywheel->checkCycle
+            .handle = &flywheel->readyWindow
+        },
+        {
+            .key = "error-mean",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->errorMean
+        },
+        {
+            .key = "error-deviation",
+            .handler = portalFloatHandler,
+            .handle = &flywheel->errorDeviation
         },
         {
             .key = "keys",
@@ -512,9 +1093,10 @@ static void
 readyHandler(void * handle, char * message, char * response)
 {
     if (handle == NULL) return;
+    if (message == NULL) return;
     if (response == NULL) return;
     Flywheel * flywheel = handle;
-    if (message == NULL)
+    if (message[0] == '\0')
     {
         strcpy(response, flywheel->ready? "true" : "false");
     }
@@ -522,4 +1104,41 @@ readyHandler(void * handle, char * message, char * response)
     else if (strcmp(message, "false") == 0) activate(flywheel);
 }
 
+// Reads how many periods were off by under 250us, 500us, 1ms, 2ms and
+// more, as "<250 <500 <1000 <2000 more". Setting it to anything resets it.
+static void
+jitterHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Flywheel * flywheel = handle;
+    if (message[0] != '\0')
+    {
+        memset(flywheel->jitter, 0, sizeof(flywheel->jitter));
+        return;
+    }
+    unsigned long * jitter = flywheel->jitter;
+    sprintf(
+        response,
+        "%lu %lu %lu %lu %lu",
+        jitter[0],
+        jitter[1],
+        jitter[2],
+        jitter[3],
+        jitter[4]
+    );
+}
+
+// Sets smoothing, and the reciprocal the fixed point filter uses with it
+static void
+smoothingHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    Flywheel * flywheel = handle;
+    portalFloatHandler(&flywheel->smoothing, message, response);
+    if (flywheel->smoothing <= 0.0f) return;
+    flywheel->smoothingReciprocal = fixedFromFloat(1.0f / flywheel->smoothing);
+}
+
 // }}}
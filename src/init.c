@@ -12,27 +12,40 @@
 
 #define UNUSED(x) (void)(x)
 
+// TBH in fixed point, for builds with -DCONTROL_FIXED
+#ifdef CONTROL_FIXED
+#define TBH(name) tbhFixed##name
+#else
+#define TBH(name) tbh##name
+#endif
+
 Pigeon * pigeon = NULL;
 Drive * drive = NULL;
 Flywheel * fwAbove = NULL;
 Flywheel * fwBelow = NULL;
-Encoder fwAboveEncoder = NULL;
-Encoder fwBelowEncoder = NULL;
+FlywheelGroup * fwGroup = NULL;
+EncoderHandle fwAboveEncoder = NULL;
+EncoderHandle fwBelowEncoder = NULL;
 Flap * fwFlap = NULL;
 Reckoner * reckoner = NULL;
 Diffsteer * diffsteer = NULL;
+static Feedforward * fwAboveFeedforward = NULL;
+static Feedforward * fwBelowFeedforward = NULL;
 
 unsigned char fwBelowLED = 7;
 unsigned char fwAboveLED = 8;
 
 static float fwAboveEstimator(float target);
 static float fwBelowEstimator(float target);
+static float fwAboveCurve(float target);
+static float fwBelowCurve(float target);
 static void fwAboveReadied(void*);
 static void fwBelowReadied(void*);
 static void fwAboveActivated(void*);
 static void fwBelowActivated(void*);
 static char * pigeonGets(char * buffer, int maxSize);
 static void pigeonPuts(const char * message);
+static void pigeonWrite(const char * data, size_t size);
 
 void initializeIO()
 {
@@ -50,13 +63,34 @@ void initialize()
     // Note: no joystick, no link, exit promptly
     // Purpose:
     //  - Init sensors, LCDs, Global vars, IMEs
-    fwBelowEncoder = encoderInit(1, 2, false);
-    fwAboveEncoder = encoderInit(3, 4, false);
+    fwBelowEncoder = edgeEncoderGetHandle(1, 2, false);
+    fwAboveEncoder = edgeEncoderGetHandle(3, 4, false);
 
     MotorHandle motorDriveLeft = motorGetHandle(7, false);
     MotorHandle motorDriveRight = motorGetHandle(6, false);
 
-    pigeon = pigeonInit(pigeonGets, pigeonPuts, millis);
+    pigeon = pigeonInit(pigeonGets, pigeonPuts, pigeonWrite, millis);
+
+    fwBelowFeedforward = feedforwardInit(
+        (FeedforwardSetup)
+        {
+            .file = "ffbelow",
+            .rpmMax = 3000.0f,
+            .learningRate = 0.3f,
+            .saveInterval = 60000,
+            .fallback = fwBelowCurve
+        }
+    );
+    fwAboveFeedforward = feedforwardInit(
+        (FeedforwardSetup)
+        {
+            .file = "ffabove",
+            .rpmMax = 3000.0f,
+            .learningRate = 0.3f,
+            .saveInterval = 60000,
+            .fallback = fwAboveCurve
+        }
+    );
 
     FlywheelSetup fwBelowSetup =
     {
@@ -66,10 +100,10 @@ void initialize()
         .gearing = 25.0f,
         .smoothing = 0.5f,
 
-        .controlSetup = tbhSetup,
-        .controlUpdater = tbhUpdate,
-        .controlResetter = tbhReset,
-        .control = tbhInit(
+        .controlSetup = TBH(Setup),
+        .controlUpdater = TBH(Update),
+        .controlResetter = TBH(Reset),
+        .control = TBH(Init)(
                 (TbhConfig)
                 {
                     .gain = 0.1,
@@ -80,9 +114,9 @@ void initialize()
             ),
         //.control = tbhInit(0.2, fwBelowEstimator),
 
-        .encoderGetter = encoderGetter,
-        .encoderResetter = encoderResetter,
-        .encoder = encoderGetHandle(fwBelowEncoder),
+        .encoderGetter = edgeEncoderGetter,
+        .encoderResetter = edgeEncoderResetter,
+        .encoder = fwBelowEncoder,
 
         .motorSetters =
         {
@@ -102,12 +136,16 @@ void initialize()
 
         .thresholdError = 10.0f,
         .thresholdDerivative = 100.0f,
-        .checkCycle = 20,
+        .thresholdMean = 5.0f,
+        .thresholdDeviation = 5.0f,
+        .readyWindow = 6,
 
         .onready = fwBelowReadied,
         .onreadyHandle = NULL,
         .onactive = fwBelowActivated,
-        .onactiveHandle = NULL
+        .onactiveHandle = NULL,
+
+        .feedforward = fwBelowFeedforward
     };
     fwBelow = flywheelInit(fwBelowSetup);
 
@@ -119,10 +157,10 @@ void initialize()
         .gearing = 25.0f,
         .smoothing = 0.5f,
 
-        .controlSetup = tbhSetup,
-        .controlUpdater = tbhUpdate,
-        .controlResetter = tbhReset,
-        .control = tbhInit(
+        .controlSetup = TBH(Setup),
+        .controlUpdater = TBH(Update),
+        .controlResetter = TBH(Reset),
+        .control = TBH(Init)(
                 (TbhConfig)
                 {
                     .gain = 0.1,
@@ -133,9 +171,9 @@ void initialize()
             ),
         //.control = tbhInit(0.2, fwAboveEstimator),
 
-        .encoderGetter = encoderGetter,
-        .encoderResetter = encoderResetter,
-        .encoder = encoderGetHandle(fwAboveEncoder),
+        .encoderGetter = edgeEncoderGetter,
+        .encoderResetter = edgeEncoderResetter,
+        .encoder = fwAboveEncoder,
 
         .motorSetters =
         {
@@ -155,15 +193,30 @@ void initialize()
 
         .thresholdError = 10.0f,
         .thresholdDerivative = 100.0f,
-        .checkCycle = 20,
+        .thresholdMean = 5.0f,
+        .thresholdDeviation = 5.0f,
+        .readyWindow = 6,
 
         .onready = fwAboveReadied,
         .onreadyHandle = NULL,
         .onactive = fwAboveActivated,
         .onactiveHandle = NULL,
+
+        .feedforward = fwAboveFeedforward
     };
     fwAbove = flywheelInit(fwAboveSetup);
 
+    FlywheelGroupSetup fwGroupSetup =
+    {
+        .flywheels =
+        {
+            fwBelow,
+            fwAbove
+        },
+        .priority = 2
+    };
+    fwGroup = flywheelGroupInit(fwGroupSetup);
+
     FlapSetup fwFlapSetup =
     {
         .id ="flap",
@@ -205,19 +258,30 @@ void initialize()
         .wheelSeparation = 16.0f,
         .smoothing = 0.5f,
 
+        .priority = 2,
+        .frameDelay = 10,
+
         .encoderLeftGetter = imeGetter,
         .encoderLeft = imeGetHandle(0, MOTOR_TYPE_393_TORQUE),
         .encoderRightGetter = imeGetter,
-        .encoderRight = imeGetHandle(1, MOTOR_TYPE_393_TORQUE)
+        .encoderRight = imeGetHandle(1, MOTOR_TYPE_393_TORQUE),
+
+        // No gyro fitted yet; gyroInit(port, 0) here to fuse one in
+        .gyro = NULL,
+        .gyroReversed = false,
+        .gyroTimeConstant = 0.3f,
+        .gyroBiasRate = 0.5f,
+        .gyroStillDistance = 0.01f
     };
     reckoner = reckonerInit(reckonerSetup);
+    reckonerRun(reckoner);
 
     DiffsteerSetup diffsteerSetup =
     {
         .id = "diffsteer",
         .pigeon = pigeon,
 
-        .state = reckonerGetState(reckoner),
+        .reckoner = reckoner,
 
         .gainDistance = 1.0f,
         .gainHeading = 1.0f,
@@ -252,11 +316,24 @@ void initialize()
 static float
 fwAboveEstimator(float target)
 {
-    return 18.195f + 2.2052e-5f * target * target;
+    return feedforwardEstimate(fwAboveFeedforward, target);
 }
 
 static float
 fwBelowEstimator(float target)
+{
+    return feedforwardEstimate(fwBelowFeedforward, target);
+}
+
+// Hand fitted, where the learned tables start from
+static float
+fwAboveCurve(float target)
+{
+    return 18.195f + 2.2052e-5f * target * target;
+}
+
+static float
+fwBelowCurve(float target)
 {
     return 0.038f * target;
 }
@@ -300,3 +377,9 @@ pigeonPuts(const char * message)
 {
     puts(message);
 }
+
+static void
+pigeonWrite(const char * data, size_t size)
+{
+    fwrite(data, 1, size, stdout);
+}
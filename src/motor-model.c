@@ -1,8 +1,3 @@
-#if 0
-
-// {{{ Disabled for now
-
-
 // 
 // Motor model.
 //
@@ -19,13 +14,26 @@
 #include "motor-model.h"
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <math.h>
+#include "utils.h"
+
+
+
+static void updateCommand(MotorModel *m, int command);
+static void updateDirection(MotorModel *m, float rpm);
+static void updateDutyOn(MotorModel *m);
+static void updateBackEmf(MotorModel *m, float rpm);
+static void updateSteadyStateCurrents(MotorModel *m, float batteryVoltage);
+static void updateConstants(MotorModel *m);
+static void updateDutyOff(MotorModel *m);
+static void updateCurrent(MotorModel *m, float timeChange);
 
 
 
 void motorModelInit(MotorModel *m, MotorModelSetup setup)
 {
-	m->commandNeedsScaling = 2 <= setup.channel <= 9;
+	m->commandNeedsScaling = 2 <= setup.channel && setup.channel <= 9;
 	m->command = 0;
 	m->direction = 0;
 
@@ -75,7 +83,7 @@ float motorModelUpdate(MotorModel *m, int command, float rpm, float batteryVolta
 
 
 
-void updateCommand(MotorModel *m, int command)
+static void updateCommand(MotorModel *m, int command)
 {
 	if (m->commandNeedsScaling)
 	{
@@ -95,7 +103,7 @@ void updateCommand(MotorModel *m, int command)
 }
 
 
-void updateDirection(MotorModel *m, float rpm)
+static void updateDirection(MotorModel *m, float rpm)
 {
 	if (abs(m->command) > 10)
 	{
@@ -109,25 +117,25 @@ void updateDirection(MotorModel *m, float rpm)
 }
 
 
-void updateDutyOn(MotorModel *m)
+static void updateDutyOn(MotorModel *m)
 {
 	m->dutyOn = abs(m->command) / (float)MOTOR_COMMAND_MAX;
 }
 
 
-void updateBackEmf(MotorModel *m, float rpm)
+static void updateBackEmf(MotorModel *m, float rpm)
 {
 	m->backEmf = m->backEmfPerRpm * rpm;
 
 	// Clip
-	if (abs(m->backEmf) > m->backEmfMax)
+	if (fabsf(m->backEmf) > m->backEmfMax)
 	{
 		m->backEmf = copysignf(m->backEmfMax, m->backEmf);
 	}
 }
 
 
-void updateSteadyStateCurrents(MotorModel *m, float batteryVoltage)
+static void updateSteadyStateCurrents(MotorModel *m, float batteryVoltage)
 {
 	// On phase
 	float emf = batteryVoltage * m->direction - m->backEmf;
@@ -141,7 +149,7 @@ void updateSteadyStateCurrents(MotorModel *m, float batteryVoltage)
 }
 
 
-void updateConstants(MotorModel *m)
+static void updateConstants(MotorModel *m)
 {
 	//m->lambda = m->resistance / (MOTOR_PWM_FREQUENCY * m->inductance); //TODO: isn't this constant constant??
 	m->contributionPeak = exp(-m->lambda * m->dutyOn);
@@ -150,7 +158,7 @@ void updateConstants(MotorModel *m)
 
 
 // Calculates initial current, peak current, duty off period.
-void updateDutyOff(MotorModel *m)
+static void updateDutyOff(MotorModel *m)
 {
 	// Calculate initial current as if equal to final current
 	float onCurrentChange = m->currentSteadyStateOn * (1 - m->contributionPeak) * m->contributionInitial;
@@ -175,7 +183,7 @@ void updateDutyOff(MotorModel *m)
 }
 
 
-void updateCurrent(MotorModel *m, float timeChange)
+static void updateCurrent(MotorModel *m, float timeChange)
 {
 	// Average current (the other terms cancel out)
 	float on = m->currentSteadyStateOn * m->dutyOn;
@@ -185,8 +193,3 @@ void updateCurrent(MotorModel *m, float timeChange)
 	// Low-pass filter to remove transients
 	m->currentFiltered += (m->current - m->currentFiltered) * timeChange / m->smoothing;
 }
-
-
-// }}}
-
-#endif
@@ -0,0 +1,174 @@
+#include "odometry.h"
+
+#include <math.h>
+#include "utils.h"
+
+
+// Below this turn, in radians, the chord is worked out from its series
+// instead, as sin(turn / 2) / turn loses its precision in float.
+#define SMALL_TURN 1e-3f
+
+
+static void moveArc(OdometryPose*, float distance, float turn);
+static const OdometrySample * historyGet(const OdometryHistory*, int index);
+
+
+void
+odometryUpdate(
+    OdometryPose * pose,
+    float leftChange,
+    float rightChange,
+    float wheelSeparation)
+{
+    float distance = 0.5f * (leftChange + rightChange);
+    float turn = (rightChange - leftChange) / wheelSeparation;
+    moveArc(pose, distance, turn);
+}
+
+
+void
+odometryFuse(
+    OdometryPose * pose,
+    OdometryGyro * gyro,
+    float leftChange,
+    float rightChange,
+    float wheelSeparation,
+    float gyroAngle,
+    float dt)
+{
+    if (!gyro->started)
+    {
+        gyro->started = true;
+        gyro->origin = pose->heading - gyroAngle;
+        gyro->last = gyroAngle;
+    }
+    float gyroChange = gyroAngle - gyro->last;
+    gyro->last = gyroAngle;
+
+    bool still = fabsf(leftChange) < gyro->stillDistance &&
+        fabsf(rightChange) < gyro->stillDistance;
+    if (still && dt > 0.0f)
+    {
+        // Not turning, so it is all drift
+        gyro->drift += gyroChange;
+        float rate = gyro->biasRate * dt;
+        if (rate > 1.0f) rate = 1.0f;
+        gyro->bias += (gyroChange / dt - gyro->bias) * rate;
+    }
+    else
+    {
+        gyro->drift += gyro->bias * dt;
+    }
+    float gyroHeading = gyroAngle + gyro->origin - gyro->drift;
+
+    float distance = 0.5f * (leftChange + rightChange);
+    float turn = (rightChange - leftChange) / wheelSeparation;
+
+    // Complementary filter: pull the wheels' heading toward the gyro's
+    float pull = dt / (gyro->timeConstant + dt);
+    if (gyro->timeConstant <= 0.0f) pull = 1.0f;
+    turn += pull * odometryWrap(gyroHeading - (pose->heading + turn));
+
+    moveArc(pose, distance, turn);
+}
+
+
+float
+odometryWrap(float heading)
+{
+    return fastWrap(heading);
+}
+
+
+void
+odometryHistoryClear(OdometryHistory * history)
+{
+    history->start = 0;
+    history->count = 0;
+}
+
+
+void
+odometryHistoryPush(OdometryHistory * history, OdometrySample sample)
+{
+    int index = (history->start + history->count) % ODOMETRY_HISTORY;
+    history->samples[index] = sample;
+    if (history->count < ODOMETRY_HISTORY) history->count++;
+    else history->start = (history->start + 1) % ODOMETRY_HISTORY;
+}
+
+
+bool
+odometryHistoryAt(
+    const OdometryHistory * history,
+    unsigned long microTime,
+    OdometrySample * sample)
+{
+    if (history->count == 0) return false;
+
+    // Ages back from the newest sample go the same way even if micros()
+    // has wrapped somewhere in between.
+    const OdometrySample * newest = historyGet(history, history->count - 1);
+    const OdometrySample * oldest = historyGet(history, 0);
+    unsigned long age = newest->microTime - microTime;
+    if ((long)age < 0)
+    {
+        *sample = *newest;
+        return false;
+    }
+    if (age > newest->microTime - oldest->microTime)
+    {
+        *sample = *oldest;
+        return false;
+    }
+
+    // Newest sample at least as old as the time asked for
+    int low = 0;
+    int high = history->count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (newest->microTime - historyGet(history, middle)->microTime >= age) low = middle;
+        else high = middle - 1;
+    }
+    const OdometrySample * before = historyGet(history, low);
+    if (low == history->count - 1)
+    {
+        *sample = *before;
+        return true;
+    }
+    const OdometrySample * after = historyGet(history, low + 1);
+
+    unsigned long span = after->microTime - before->microTime;
+    float fraction = span == 0 ? 0.0f : (float)(microTime - before->microTime) / span;
+    sample->microTime = microTime;
+    sample->x = before->x + (after->x - before->x) * fraction;
+    sample->y = before->y + (after->y - before->y) * fraction;
+    sample->velocity = before->velocity + (after->velocity - before->velocity) * fraction;
+    sample->heading = odometryWrap(
+        before->heading + odometryWrap(after->heading - before->heading) * fraction
+    );
+    return true;
+}
+
+
+static const OdometrySample *
+historyGet(const OdometryHistory * history, int index)
+{
+    return &history->samples[(history->start + index) % ODOMETRY_HISTORY];
+}
+
+
+static void
+moveArc(OdometryPose * pose, float distance, float turn)
+{
+    // Chord of the arc over its length, 2 sin(turn / 2) / turn
+    float chord;
+    if (fabsf(turn) < SMALL_TURN) chord = 1.0f - turn * turn / 24.0f;
+    else chord = 2.0f * fastSin(0.5f * turn) / turn;
+
+    float direction = pose->heading + 0.5f * turn;
+    pose->x += distance * chord * fastCos(direction);
+    pose->y += distance * chord * fastSin(direction);
+    pose->heading = odometryWrap(pose->heading + turn);
+}
@@ -67,15 +67,13 @@ void operatorControl()
     buttonOndown(JOY_SLOT1, JOY_8U, increaseFwRpm, NULL);
     buttonOndown(JOY_SLOT1, JOY_8R, decreaseFwRpm, NULL);
 
-    flywheelRun(fwBelow);
-    flywheelRun(fwAbove);
+    flywheelGroupRun(fwGroup);
     flapRun(fwFlap);
 
     while (true)
     {
         buttonsUpdate();
         driveUpdate(drive);
-        reckonerUpdate(reckoner);
         delay(20);
     }
     // Note: never exit
@@ -0,0 +1,492 @@
+#include "pigeon-frame.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pigeon.h"
+
+
+#define LINESIZE PIGEON_LINESIZE
+#define ALIGNSIZE PIGEON_ALIGNSIZE
+#define SYNC PIGEON_FRAME_SYNC
+#define HEADERSIZE PIGEON_FRAME_HEADERSIZE
+#define CHECKSIZE PIGEON_FRAME_CHECKSIZE
+#define MAXSIZE PIGEON_FRAME_MAXSIZE
+#define MAXVALUES PIGEON_FRAME_MAXVALUES
+
+
+
+// Private functions - forward declarations {{{
+
+static void putUlong(unsigned char * destination, unsigned long value);
+static unsigned long getUlong(const unsigned char * source);
+static unsigned int checksum(const unsigned char * data, int size);
+static int encodeValue(const PigeonValue*, unsigned char * destination, int size);
+static void resync(PigeonDecoder*);
+static bool isSameValue(const PigeonValue*, const PigeonValue*);
+static bool repack(PigeonFrame*);
+
+// }}}
+
+
+
+// Public methods {{{
+
+//
+// Formats a text line, "[millis|id.key] message", with the path padded to
+// a multiple of PIGEON_ALIGNSIZE. Returns the length written.
+//
+int
+pigeonFormatText(
+    char * destination,
+    int size,
+    unsigned long millis,
+    const char * id,
+    const char * key,
+    const char * message
+){
+    char path[LINESIZE];
+    if (key[0] == '\0')
+    {
+        snprintf(path, LINESIZE, "%s", id);
+    }
+    else
+    {
+        snprintf(path, LINESIZE, "%s.%s", id, key);
+    }
+
+    int pathLength = strlen(path);
+    int pathDisplayWidth = pathLength;
+
+    // round up
+    pathDisplayWidth += ALIGNSIZE - 1;
+    pathDisplayWidth = (pathDisplayWidth / ALIGNSIZE) * ALIGNSIZE;
+    if (pathDisplayWidth > LINESIZE - 1) pathDisplayWidth = LINESIZE - 1;
+
+    while (pathLength < pathDisplayWidth)
+    {
+        path[pathLength] = ' ';
+        pathLength++;
+    }
+    path[pathLength] = '\0';
+
+    int length = snprintf(
+        destination,
+        size,
+        "[%08u|%s] %s",
+        (unsigned int)millis,
+        path,
+        message
+    );
+    if (length > size - 1) length = size - 1;
+    return length;
+}
+
+
+//
+// Encodes a frame into the destination buffer.
+// Returns the number of bytes used, or 0 if the frame does not fit.
+//
+int
+pigeonFrameEncode(const PigeonFrame * frame, unsigned char * dest, int size)
+{
+    int limit = size < MAXSIZE ? size : MAXSIZE;
+    if (limit < HEADERSIZE + CHECKSIZE) return 0;
+
+    dest[0] = SYNC;
+    dest[2] = frame->portal;
+    dest[3] = frame->entry;
+    putUlong(dest + 4, frame->timestamp);
+
+    int length = HEADERSIZE;
+    for (int i = 0; i < frame->count; i++)
+    {
+        int used = encodeValue(
+            &frame->values[i],
+            dest + length,
+            limit - CHECKSIZE - length
+        );
+        if (used == 0) return 0;
+        length += used;
+    }
+
+    dest[1] = length - 2;
+
+    unsigned int check = checksum(dest + 1, length - 1);
+    dest[length] = check & 0xFF;
+    dest[length + 1] = (check >> 8) & 0xFF;
+
+    return length + CHECKSIZE;
+}
+
+
+//
+// Decodes a whole frame, sync byte and checksum included.
+// Decoded text values point into frame->strings.
+//
+bool
+pigeonFrameDecode(PigeonFrame * frame, const unsigned char * source, int size)
+{
+    if (size < HEADERSIZE + CHECKSIZE) return false;
+    if (source[0] != SYNC) return false;
+
+    int length = source[1] + 2;
+    if (length < HEADERSIZE) return false;
+    if (length + CHECKSIZE != size) return false;
+
+    unsigned int check = source[length] | (source[length + 1] << 8);
+    if (check != checksum(source + 1, length - 1)) return false;
+
+    frame->portal = source[2];
+    frame->entry = source[3];
+    frame->timestamp = getUlong(source + 4);
+    frame->count = 0;
+
+    int position = HEADERSIZE;
+    int stringsUsed = 0;
+    while (position < length)
+    {
+        if (frame->count >= MAXVALUES) return false;
+        PigeonValue * value = &frame->values[frame->count];
+        value->type = source[position];
+        position++;
+
+        switch (value->type)
+        {
+        case PIGEON_TYPE_FLOAT:
+        {
+            if (position + 4 > length) return false;
+            uint32_t bits = getUlong(source + position);
+            memcpy(&value->as.f, &bits, sizeof(float));
+            position += 4;
+            break;
+        }
+        case PIGEON_TYPE_INT:
+            if (position + 4 > length) return false;
+            value->as.i = (long)(int32_t)getUlong(source + position);
+            position += 4;
+            break;
+        case PIGEON_TYPE_UINT:
+            if (position + 4 > length) return false;
+            value->as.u = getUlong(source + position);
+            position += 4;
+            break;
+        case PIGEON_TYPE_BOOL:
+            if (position + 1 > length) return false;
+            value->as.b = source[position] != 0;
+            position += 1;
+            break;
+        case PIGEON_TYPE_TEXT:
+        case PIGEON_TYPE_NAME:
+        {
+            if (position + 1 > length) return false;
+            int textLength = source[position];
+            position++;
+            if (position + textLength > length) return false;
+            if (stringsUsed + textLength + 1 > MAXSIZE) return false;
+            char * text = frame->strings + stringsUsed;
+            memcpy(text, source + position, textLength);
+            text[textLength] = '\0';
+            value->as.text = text;
+            stringsUsed += textLength + 1;
+            position += textLength;
+            break;
+        }
+        default:
+            return false;
+        }
+        frame->count++;
+    }
+    return true;
+}
+
+
+//
+// Copies a frame, moving its text values into the destination's strings.
+//
+void
+pigeonFrameCopy(PigeonFrame * destination, const PigeonFrame * source)
+{
+    if (destination == source) return;
+    *destination = *source;
+    repack(destination);
+}
+
+
+//
+// Builds a delta frame holding the values of current that differ from last.
+// Text values in the delta point into current. Returns false if the two
+// cannot be compared, in which case current has to go out whole.
+//
+bool
+pigeonFrameDelta(
+    const PigeonFrame * last,
+    const PigeonFrame * current,
+    PigeonFrame * delta
+){
+    if (last->portal != current->portal) return false;
+    if (last->count != current->count) return false;
+    if (current->count > MAXVALUES - 1) return false;
+
+    delta->portal = current->portal;
+    delta->entry = PIGEON_FRAME_DELTA;
+    delta->timestamp = current->timestamp;
+    delta->count = 1;
+
+    unsigned long mask = 0;
+    for (int i = 0; i < current->count; i++)
+    {
+        if (isSameValue(&last->values[i], &current->values[i])) continue;
+        mask |= 1ul << i;
+        delta->values[delta->count] = current->values[i];
+        delta->count++;
+    }
+
+    delta->values[0].type = PIGEON_TYPE_UINT;
+    delta->values[0].as.u = mask;
+    return true;
+}
+
+
+//
+// Brings a stream frame up to date with a delta frame received after it.
+// Returns false if the delta does not fit the state, meaning the host should
+// wait for the next keyframe.
+//
+bool
+pigeonFrameApplyDelta(PigeonFrame * state, const PigeonFrame * delta)
+{
+    if (delta->count < 1) return false;
+    if (delta->values[0].type != PIGEON_TYPE_UINT) return false;
+    if (state->portal != delta->portal) return false;
+
+    unsigned long mask = delta->values[0].as.u;
+    int next = 1;
+    for (int i = 0; i < 32 && mask >> i; i++)
+    {
+        if (!(mask & (1ul << i))) continue;
+        if (i >= state->count || next >= delta->count) return false;
+        if (delta->values[next].type != state->values[i].type) return false;
+        state->values[i] = delta->values[next];
+        next++;
+    }
+    if (next != delta->count) return false;
+
+    state->timestamp = delta->timestamp;
+    return repack(state);
+}
+
+
+void
+pigeonDecoderInit(PigeonDecoder * decoder)
+{
+    decoder->size = 0;
+    decoder->frames = 0;
+    decoder->errors = 0;
+}
+
+
+//
+// Feeds one byte of a binary stream into the decoder. Returns true and fills
+// in the frame whenever a complete, valid frame has been received. Bad frames
+// are counted and the decoder resynchronises on the next sync byte.
+//
+bool
+pigeonDecoderPush(PigeonDecoder * decoder, unsigned char byte, PigeonFrame * frame)
+{
+    if (decoder->size == 0 && byte != SYNC) return false;
+
+    decoder->buffer[decoder->size] = byte;
+    decoder->size++;
+
+    while (decoder->size >= 2)
+    {
+        int length = decoder->buffer[1] + 2;
+        int needed = length + CHECKSIZE;
+        if (length < HEADERSIZE || needed > MAXSIZE)
+        {
+            decoder->errors++;
+            resync(decoder);
+            continue;
+        }
+        if (decoder->size < needed) return false;
+
+        if (pigeonFrameDecode(frame, decoder->buffer, needed))
+        {
+            // Keep anything left over from a resync for the next push
+            decoder->size -= needed;
+            memmove(decoder->buffer, decoder->buffer + needed, decoder->size);
+            decoder->frames++;
+            return true;
+        }
+        decoder->errors++;
+        resync(decoder);
+    }
+    return false;
+}
+
+// }}}
+
+
+
+// Private methods {{{
+
+static void
+putUlong(unsigned char * destination, unsigned long value)
+{
+    destination[0] = value & 0xFF;
+    destination[1] = (value >> 8) & 0xFF;
+    destination[2] = (value >> 16) & 0xFF;
+    destination[3] = (value >> 24) & 0xFF;
+}
+
+static unsigned long
+getUlong(const unsigned char * source)
+{
+    return
+        (unsigned long)source[0] |
+        (unsigned long)source[1] << 8 |
+        (unsigned long)source[2] << 16 |
+        (unsigned long)source[3] << 24;
+}
+
+// Fletcher-16
+static unsigned int
+checksum(const unsigned char * data, int size)
+{
+    unsigned int sum1 = 0;
+    unsigned int sum2 = 0;
+    for (int i = 0; i < size; i++)
+    {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static int
+encodeValue(const PigeonValue * value, unsigned char * dest, int size)
+{
+    if (size < 1) return 0;
+    dest[0] = value->type;
+
+    switch (value->type)
+    {
+    case PIGEON_TYPE_FLOAT:
+    {
+        if (size < 5) return 0;
+        uint32_t bits;
+        memcpy(&bits, &value->as.f, sizeof(float));
+        putUlong(dest + 1, bits);
+        return 5;
+    }
+    case PIGEON_TYPE_INT:
+        if (size < 5) return 0;
+        putUlong(dest + 1, (unsigned long)value->as.i);
+        return 5;
+    case PIGEON_TYPE_UINT:
+        if (size < 5) return 0;
+        putUlong(dest + 1, value->as.u);
+        return 5;
+    case PIGEON_TYPE_BOOL:
+        if (size < 2) return 0;
+        dest[1] = value->as.b ? 1 : 0;
+        return 2;
+    case PIGEON_TYPE_TEXT:
+    case PIGEON_TYPE_NAME:
+    {
+        const char * text = value->as.text ? value->as.text : "";
+        int length = strlen(text);
+        // Long text is truncated rather than dropped
+        if (length > size - 2) length = size - 2;
+        if (length < 0) return 0;
+        dest[1] = length;
+        memcpy(dest + 2, text, length);
+        return length + 2;
+    }
+    }
+    return 0;
+}
+
+static bool
+isSameValue(const PigeonValue * a, const PigeonValue * b)
+{
+    if (a->type != b->type) return false;
+    switch (a->type)
+    {
+    case PIGEON_TYPE_FLOAT:
+        // Bitwise, so a NaN that stays a NaN is not sent every frame
+        return memcmp(&a->as.f, &b->as.f, sizeof(float)) == 0;
+    case PIGEON_TYPE_INT:
+        return a->as.i == b->as.i;
+    case PIGEON_TYPE_UINT:
+        return a->as.u == b->as.u;
+    case PIGEON_TYPE_BOOL:
+        return a->as.b == b->as.b;
+    case PIGEON_TYPE_TEXT:
+    case PIGEON_TYPE_NAME:
+    {
+        const char * textA = a->as.text ? a->as.text : "";
+        const char * textB = b->as.text ? b->as.text : "";
+        return strcmp(textA, textB) == 0;
+    }
+    }
+    return false;
+}
+
+// Gathers every text value into the frame's own strings, wherever they
+// pointed before. Returns false, emptying the text, if they do not fit.
+static bool
+repack(PigeonFrame * frame)
+{
+    char strings[MAXSIZE];
+    int offsets[MAXVALUES];
+    int used = 0;
+    bool fits = true;
+    for (int i = 0; i < frame->count; i++)
+    {
+        PigeonValue * value = &frame->values[i];
+        if (value->type != PIGEON_TYPE_TEXT && value->type != PIGEON_TYPE_NAME)
+        {
+            continue;
+        }
+        const char * text = value->as.text ? value->as.text : "";
+        int length = strlen(text);
+        if (used + length + 1 > MAXSIZE)
+        {
+            fits = false;
+            length = 0;
+            text = "";
+            if (used + 1 > MAXSIZE) used = MAXSIZE - 1;
+        }
+        memcpy(strings + used, text, length + 1);
+        offsets[i] = used;
+        used += length + 1;
+    }
+
+    memcpy(frame->strings, strings, used);
+    for (int i = 0; i < frame->count; i++)
+    {
+        PigeonValue * value = &frame->values[i];
+        if (value->type != PIGEON_TYPE_TEXT && value->type != PIGEON_TYPE_NAME)
+        {
+            continue;
+        }
+        value->as.text = frame->strings + offsets[i];
+    }
+    return fits;
+}
+
+// Drops the leading sync byte and restarts from the next one, if any.
+static void
+resync(PigeonDecoder * decoder)
+{
+    int next = 1;
+    while (next < decoder->size && decoder->buffer[next] != SYNC) next++;
+    memmove(decoder->buffer, decoder->buffer + next, decoder->size - next);
+    decoder->size -= next;
+}
+
+// }}}
@@ -0,0 +1,268 @@
+#include "pigeon-ring.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define SLOTSIZE PIGEON_RING_SLOTSIZE
+
+
+
+// Structs {{{
+
+typedef struct
+PigeonRingSlot
+{
+    // pushPosition when free, pushPosition + 1 when holding a record
+    unsigned long sequence;
+    unsigned char tag;
+    unsigned char size;
+    unsigned char data[SLOTSIZE];
+}
+PigeonRingSlot;
+
+struct PigeonRing
+{
+    PigeonRingSlot * slots;
+    unsigned long mask;
+    unsigned long pushPosition;
+    unsigned long popPosition;
+    unsigned long dropped;
+};
+
+// }}}
+
+
+
+// Private functions - forward declarations {{{
+
+static bool tryPush(PigeonRing*, unsigned char tag, const void * data, int size);
+
+// }}}
+
+
+
+// Public methods {{{
+
+PigeonRing *
+pigeonRingInit(int capacity)
+{
+    int size = 1;
+    while (size < capacity) size *= 2;
+
+    PigeonRing * ring = malloc(sizeof(PigeonRing));
+    ring->slots = malloc(size * sizeof(PigeonRingSlot));
+    ring->mask = size - 1;
+    ring->pushPosition = 0;
+    ring->popPosition = 0;
+    ring->dropped = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        ring->slots[i].sequence = i;
+    }
+
+    return ring;
+}
+
+
+//
+// Copies a record onto the ring. Returns false if it was not queued, either
+// because it was dropped or, for PIGEON_OVERFLOW_BLOCK, because the ring is
+// full and the caller should try again later.
+//
+bool
+pigeonRingPush(
+    PigeonRing * ring,
+    PigeonOverflow overflow,
+    unsigned char tag,
+    const void * data,
+    int size
+){
+    if (ring == NULL) return false;
+    if (size < 0 || size > SLOTSIZE)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    // At most one pass of the ring's worth of drops, so a pusher can never
+    // spin waiting on a slot some lower priority task is holding.
+    int attempts = ring->mask + 1;
+    while (!tryPush(ring, tag, data, size))
+    {
+        switch (overflow)
+        {
+        case PIGEON_OVERFLOW_DROP_OLDEST:
+        {
+            // Make room by throwing away whatever would be written next.
+            // Another task may beat us to the free slot, so loop. If the
+            // slot to push to is still being read, dropping more won't
+            // free it, so give up and drop this record instead, as after
+            // a pass of the ring.
+            PigeonRingRecord discard;
+            if (attempts-- > 0 &&
+                pigeonRingCount(ring) == (int)ring->mask + 1 &&
+                pigeonRingClaim(ring, &discard))
+            {
+                pigeonRingRelease(ring, &discard);
+                __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        case PIGEON_OVERFLOW_DROP_NEWEST:
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        case PIGEON_OVERFLOW_BLOCK:
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int
+pigeonRingPop(PigeonRing * ring, unsigned char * tag, void * destination)
+{
+    PigeonRingRecord record;
+    if (!pigeonRingClaim(ring, &record)) return -1;
+    *tag = record.tag;
+    memcpy(destination, record.data, record.size);
+    pigeonRingRelease(ring, &record);
+    return record.size;
+}
+
+
+bool
+pigeonRingClaim(PigeonRing * ring, PigeonRingRecord * record)
+{
+    if (ring == NULL) return false;
+
+    PigeonRingSlot * slot;
+    unsigned long position = __atomic_load_n(&ring->popPosition, __ATOMIC_RELAXED);
+    while (true)
+    {
+        slot = &ring->slots[position & ring->mask];
+        unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)(sequence - (position + 1));
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(
+                &ring->popPosition,
+                &position,
+                position + 1,
+                true,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED
+            )) break;
+        }
+        else if (difference < 0)
+        {
+            // Empty, or the next record is still being written
+            return false;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->popPosition, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->tag = slot->tag;
+    record->size = slot->size;
+    record->data = slot->data;
+    record->position = position;
+    return true;
+}
+
+
+void
+pigeonRingRelease(PigeonRing * ring, PigeonRingRecord * record)
+{
+    if (ring == NULL || record == NULL) return;
+
+    // Hand the slot back for the push one lap later
+    PigeonRingSlot * slot = &ring->slots[record->position & ring->mask];
+    unsigned long sequence = record->position + ring->mask + 1;
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+}
+
+
+int
+pigeonRingCount(PigeonRing * ring)
+{
+    if (ring == NULL) return 0;
+    unsigned long popped = __atomic_load_n(&ring->popPosition, __ATOMIC_RELAXED);
+    unsigned long pushed = __atomic_load_n(&ring->pushPosition, __ATOMIC_RELAXED);
+    long count = (long)(pushed - popped);
+    if (count < 0) return 0;
+    if (count > (long)ring->mask + 1) return ring->mask + 1;
+    return count;
+}
+
+
+unsigned long
+pigeonRingDropped(PigeonRing * ring)
+{
+    if (ring == NULL) return 0;
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+
+int
+pigeonRingCapacity(PigeonRing * ring)
+{
+    if (ring == NULL) return 0;
+    return ring->mask + 1;
+}
+
+// }}}
+
+
+
+// Private methods {{{
+
+static bool
+tryPush(PigeonRing * ring, unsigned char tag, const void * data, int size)
+{
+    PigeonRingSlot * slot;
+    unsigned long position = __atomic_load_n(&ring->pushPosition, __ATOMIC_RELAXED);
+    while (true)
+    {
+        slot = &ring->slots[position & ring->mask];
+        unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)(sequence - position);
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(
+                &ring->pushPosition,
+                &position,
+                position + 1,
+                true,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED
+            )) break;
+        }
+        else if (difference < 0)
+        {
+            // Full
+            return false;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->pushPosition, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->tag = tag;
+    slot->size = size;
+    memcpy(slot->data, data, size);
+
+    // Publish the record to poppers
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// }}}
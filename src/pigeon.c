@@ -6,6 +6,8 @@
 #include <string.h>
 #include <stddef.h>
 
+#include "pigeon-frame.h"
+#include "pigeon-ring.h"
 #include "utils.h"
 
 
@@ -15,6 +17,25 @@
 #define ALIGNSIZE PIGEON_ALIGNSIZE
 #define UNUSED(x) (void)(x)
 
+// Entry refs are looked up through fixed size chunks of entry pointers,
+// so the table can grow within the arena without moving
+#define ENTRYCHUNK 16
+#define ENTRYCHUNKS ((PIGEON_FRAME_STREAM + ENTRYCHUNK - 1) / ENTRYCHUNK)
+
+// Kinds of record on the output ring
+#define RECORD_TEXT 0
+#define RECORD_BINARY 1
+
+// How long the writer sleeps once the ring is empty, in ms
+#define WRITER_IDLE 2
+
+// Most commands taken from one line of input
+#define MAXCOMMANDS 16
+
+// Room for values in one binary frame
+#define FRAMEPAYLOAD \
+    (PIGEON_FRAME_MAXSIZE - PIGEON_FRAME_HEADERSIZE - PIGEON_FRAME_CHECKSIZE)
+
 
 
 // Private structs/typedefs - foward Declarations
@@ -25,6 +46,15 @@ typedef struct PortalEntry PortalEntry;
 struct PortalEntryList;
 typedef struct PortalEntryList PortalEntryList;
 
+struct Command;
+typedef struct Command Command;
+
+struct Timing;
+typedef struct Timing Timing;
+
+struct PigeonStats;
+typedef struct PigeonStats PigeonStats;
+
 
 
 // Structs {{{
@@ -32,12 +62,24 @@ typedef struct PortalEntryList PortalEntryList;
 struct PortalEntry
 {
     const char * key;
-    char * message;
+    PigeonType type;
     PortalEntryHandler handler;
     void * handle;
+
+    // Only entries without handlers keep a message, set by portalSet.
+    // Everything else is formatted from its handle when written out.
+    char * message;
+
     bool stream;
     bool onchange;
     bool manual;
+    unsigned char index;
+
+    // Numeric onchange entries are only written once they have moved
+    // further than the deadband from the last value written.
+    float deadband;
+    float lastWritten;
+    bool written;
 
     // binary search tree links:
     PortalEntry * entryRight;
@@ -52,13 +94,58 @@ struct PortalEntryList
 };
 
 
+// Time spent in a piece of pigeon, in microseconds
+struct Timing
+{
+    unsigned long count;
+    unsigned long long total;
+    unsigned long worst;
+};
+
+
+// What pigeon costs, read from pigeon.stats
+struct PigeonStats
+{
+    // Output over the last whole second, from the writer's side
+    unsigned long windowStart;
+    unsigned long windowBytes;
+    unsigned long windowRecords;
+    unsigned long bytesPerSecond;
+    unsigned long recordsPerSecond;
+
+    unsigned long inputLines;
+    unsigned long lookupFailures;
+};
+
+
+// One "portal.key value" from a line of input
+struct Command
+{
+    Portal * portal;
+    PortalEntry * entry;
+    char * message;
+    char none[1];
+    bool done;
+
+    // What the handler had to say when given the message, if anything
+    char response[LINESIZE];
+};
+
+
 struct Portal
 {
     Pigeon * pigeon;
     bool ready;
 
+    // The owner's mutex, held while plain values in a line of commands to
+    // this portal are set
+    Mutex mutex;
+
     const char * id;
+    unsigned char index;
     PortalEntry * topEntry;
+    PortalEntry ** entryChunks[ENTRYCHUNKS];
+    int entryCount;
     PortalEntryList * entryList;
     PortalEntryList * streamList;
 
@@ -66,6 +153,23 @@ struct Portal
     bool stream;
     bool onchange;
 
+    // Stream lines go out every Nth flush, and no more often than interval
+    unsigned int streamEvery;
+    unsigned long streamInterval;
+    unsigned int flushCount;
+    unsigned long lastFlush;
+
+    // Delta mode sends a full stream frame every keyframeEvery frames, and
+    // in between only what changed since lastStream
+    PigeonFrame * lastStream;
+    unsigned int keyframeEvery;
+    unsigned int sinceKeyframe;
+
+    // Time in portalFlush, and in formatting and queueing each of this
+    // portal's text lines and binary frames
+    Timing flushTiming;
+    Timing writeTiming;
+
     // binary search tree links:
     Portal * portalRight;
     Portal * portalLeft;
@@ -78,9 +182,31 @@ struct Pigeon
     Portal * pigeonPortal;
     PigeonIn gets;
     PigeonOut puts;
+    PigeonWrite write;
     PigeonMillis millis;
     TaskHandle task;
     bool ready;
+
+    // Output is queued here and written out by the writer task, so
+    // callers never wait on the serial port.
+    PigeonRing * ring;
+    PigeonOverflow overflow;
+    TaskHandle writer;
+
+    PigeonMode mode;
+    unsigned char portalCount;
+    PortalEntryRef errorRef;
+    PigeonStats stats;
+
+    // The line being run, kept here rather than on the input task's stack
+    Command commands[MAXCOMMANDS];
+
+    // Every portal, entry and list node lives in the arena, which is
+    // allocated once. Stream list nodes are recycled through spareLists.
+    unsigned char * arena;
+    size_t arenaUsed;
+    size_t arenaSize;
+    PortalEntryList * spareLists;
 };
 
 // }}}
@@ -89,21 +215,54 @@ struct Pigeon
 
 // Private functions - forward declarations {{{
 
+static int parseCommands(Pigeon*, char * input, Command * commands);
+static bool parseCommand(Pigeon*, char * input, Command*);
+static void runCommands(Command * commands, int count);
+static void waitForWriter(Pigeon*);
 static void checkReady(Pigeon*);
 static bool isPortalBranchReady(Portal*);
-static void writeMessage(
-    Pigeon*,
-    const char * id,
-    const char * key,
-    const char * message
-);
+static void writeMessage(Portal*, const char * key, const char * message);
+static void writeStream(Portal*);
+static void writeFrame(Portal*, PigeonFrame*);
+static void addTiming(Timing*, unsigned long elapsed);
+static void formatTiming(Timing*, char * destination);
+static void countOutput(Pigeon*, int size);
+static void output(Pigeon*, unsigned char tag, const void * data, int size);
+static void emit(Pigeon*, unsigned char tag, const unsigned char * data, int size);
+static void writerTask(void * pigeonData);
+static void writeEntry(Portal*, PortalEntry*, const char * message);
+static void formatEntry(PortalEntry*, char * destination);
+static PigeonValue entryValue(PortalEntry*, char * text);
+static PigeonType handlerType(PortalEntryHandler);
+static bool isValueHandler(PortalEntryHandler);
+static void writeStreamDelta(Portal*, PigeonFrame*);
+static bool isBinary(Pigeon*);
+static void writeManifest(Portal*);
+static void writeStreamManifest(Portal*);
 static PortalEntry ** findEntry(const char * key, PortalEntry **);
+static PortalEntry * entryAt(Portal*, PortalEntryRef);
+static void setEntry(Portal*, PortalEntry*, const char * message);
+static bool streamFits(Portal*, PortalEntryList*, const char * extraKey);
+static void updateEntry(Portal*, PortalEntry*);
+static bool isFlushDue(Portal*);
+static bool isOutsideDeadband(PortalEntry*);
+static void setupPortalEntries(Portal*);
 static Portal ** findPortal(const char * id, Portal **);
-static void deleteEntryList(PortalEntryList*);
+static void * arenaAlloc(Pigeon*, size_t size);
+static PortalEntryList * createEntryList(Pigeon*, PortalEntry*, PortalEntryList * next);
+static void deleteEntryList(Pigeon*, PortalEntryList*);
 static void setupPigeonPortal(Pigeon*);
 static void enablePortalHandler(void * handle, char * message, char * response);
 static void disablePortalHandler(void * handle, char * message, char * response);
 static void getKeysHandler(void * handle, char * message, char * response);
+static void modeHandler(void * handle, char * message, char * response);
+static void overflowHandler(void * handle, char * message, char * response);
+static void droppedHandler(void * handle, char * message, char * response);
+static void deadbandHandler(void * handle, char * message, char * response);
+static void memoryHandler(void * handle, char * message, char * response);
+static void statsHandler(void * handle, char * message, char * response);
+static void timingHandler(void * handle, char * message, char * response);
+static void writeTimings(Portal*, bool reset);
 static void logError(Pigeon*, char * message);
 
 // }}}
@@ -113,12 +272,13 @@ static void logError(Pigeon*, char * message);
 // Public pigeon methods {{{
 
 Pigeon *
-pigeonInit(PigeonIn getter, PigeonOut putter, PigeonMillis clock)
+pigeonInit(PigeonIn getter, PigeonOut putter, PigeonWrite writer, PigeonMillis clock)
 {
     Pigeon * pigeon = malloc(sizeof(Pigeon));
 
     pigeon->gets = getter;
     pigeon->puts = putter;
+    pigeon->write = writer;
     pigeon->millis = clock;
 
     pigeon->task = NULL;
@@ -127,6 +287,25 @@ pigeonInit(PigeonIn getter, PigeonOut putter, PigeonMillis clock)
 
     pigeon->ready = false;
 
+    pigeon->mode = PIGEON_MODE_TEXT;
+    pigeon->portalCount = 0;
+    pigeon->errorRef = PORTAL_ENTRY_NONE;
+    memset(&pigeon->stats, 0, sizeof(PigeonStats));
+
+    pigeon->arena = malloc(PIGEON_ARENASIZE);
+    pigeon->arenaUsed = 0;
+    pigeon->arenaSize = PIGEON_ARENASIZE;
+    pigeon->spareLists = NULL;
+
+    pigeon->ring = pigeonRingInit(PIGEON_RINGSIZE);
+    pigeon->overflow = PIGEON_OVERFLOW_DROP_OLDEST;
+    pigeon->writer = taskCreate(
+        writerTask,
+        TASK_DEFAULT_STACK_SIZE,
+        pigeon,
+        TASK_PRIORITY_LOWEST + 1
+    );
+
     setupPigeonPortal(pigeon);
 
     return pigeon;
@@ -138,16 +317,31 @@ pigeonCreatePortal(Pigeon * pigeon, const char * id)
 {
     if (pigeon == NULL) return NULL;
 
-    Portal * portal = malloc(sizeof(Portal));
+    Portal * portal = arenaAlloc(pigeon, sizeof(Portal));
+    if (portal == NULL) return NULL;
 
     portal->pigeon = pigeon;
     portal->ready = false;
+    portal->mutex = NULL;
     portal->id = id;
+    portal->index = pigeon->portalCount++;
+    portal->entryCount = 0;
 
     portal->enabled = false;
     portal->stream = true;
     portal->onchange = true;
 
+    portal->streamEvery = 1;
+    portal->streamInterval = 0;
+    portal->flushCount = 0;
+    portal->lastFlush = 0;
+
+    portal->lastStream = NULL;
+    portal->keyframeEvery = PIGEON_KEYFRAMEEVERY;
+    portal->sinceKeyframe = PIGEON_KEYFRAMEEVERY;
+    memset(&portal->flushTiming, 0, sizeof(Timing));
+    memset(&portal->writeTiming, 0, sizeof(Timing));
+
     portal->topEntry = NULL;
     portal->entryList = NULL;
     portal->streamList = NULL;
@@ -157,6 +351,8 @@ pigeonCreatePortal(Pigeon * pigeon, const char * id)
     Portal ** location = findPortal(portal->id, &pigeon->topPortal);
     *location = portal;
 
+    setupPortalEntries(portal);
+
     return portal;
 }
 
@@ -168,67 +364,145 @@ pigeonReady(Pigeon * pigeon)
     checkReady(pigeon);
 }
 
+void
+pigeonSetMode(Pigeon * pigeon, PigeonMode mode)
+{
+    if (pigeon == NULL) return;
+    if (mode != PIGEON_MODE_TEXT && pigeon->write == NULL)
+    {
+        logError(pigeon, "mode: no binary writer... staying in text mode");
+        return;
+    }
+    pigeon->mode = mode;
+
+    // Tell the host which names the portal and entry indices stand for
+    if (isBinary(pigeon)) writeManifest(pigeon->topPortal);
+}
+
+void
+pigeonSetOverflow(Pigeon * pigeon, PigeonOverflow overflow)
+{
+    if (pigeon == NULL) return;
+    pigeon->overflow = overflow;
+}
+
+
+void
+pigeonInput(Pigeon * pigeon, char * line)
+{
+    if (pigeon == NULL || line == NULL) return;
+    pigeon->stats.inputLines++;
+
+    if (strlen(line) >= PIGEON_INPUTSIZE)
+    {
+        logError(pigeon, "line too long... ignoring it");
+        return;
+    }
+
+    int count = parseCommands(pigeon, line, pigeon->commands);
+    runCommands(pigeon->commands, count);
+}
+
 // }}}
 
 
 
 // Public portal methods {{{
 
-void
+PortalEntryRef
 portalAdd(Portal * portal, PortalEntrySetup setup)
 {
-    if (portal == NULL) return;
+    if (setup.ref != NULL) *setup.ref = PORTAL_ENTRY_NONE;
+
+    if (portal == NULL) return PORTAL_ENTRY_NONE;
     if (portal->ready)
     {
         logError(portal->pigeon, "add: portal already ready... ignoring add");
-        return;
+        return PORTAL_ENTRY_NONE;
+    }
+    if (portal->entryCount >= PIGEON_FRAME_DELTA)
+    {
+        logError(portal->pigeon, "add: portal is full... ignoring add");
+        return PORTAL_ENTRY_NONE;
     }
 
-    PortalEntry * entry = malloc(sizeof(PortalEntry));
+    Pigeon * pigeon = portal->pigeon;
+    int chunk = portal->entryCount / ENTRYCHUNK;
+    if (portal->entryCount % ENTRYCHUNK == 0)
+    {
+        portal->entryChunks[chunk] = arenaAlloc(pigeon, ENTRYCHUNK * sizeof(PortalEntry*));
+        if (portal->entryChunks[chunk] == NULL) return PORTAL_ENTRY_NONE;
+    }
+
+    // Only entries without handlers need somewhere to keep their message
+    PortalEntry * entry = arenaAlloc(pigeon, sizeof(PortalEntry));
+    char * message = setup.handler ? NULL : arenaAlloc(pigeon, LINESIZE);
+    PortalEntryList * entryList = createEntryList(pigeon, entry, portal->entryList);
+    PortalEntryList * streamList = NULL;
+    if (setup.stream && !streamFits(portal, portal->streamList, setup.key))
+    {
+        char error[80];
+        snprintf(error, 80, "add: stream is full... not streaming '%s'", setup.key);
+        logError(pigeon, error);
+        setup.stream = false;
+    }
+    if (setup.stream)
+    {
+        streamList = createEntryList(pigeon, entry, portal->streamList);
+    }
+    if (entry == NULL || entryList == NULL) return PORTAL_ENTRY_NONE;
+    if (setup.handler == NULL && message == NULL) return PORTAL_ENTRY_NONE;
+    if (setup.stream && streamList == NULL) return PORTAL_ENTRY_NONE;
 
     entry->key = setup.key;
-    entry->message = NULL;
+    entry->message = message;
+    if (message != NULL) message[0] = '\0';
+    entry->index = portal->entryCount;
+    portal->entryChunks[chunk][portal->entryCount % ENTRYCHUNK] = entry;
+    portal->entryCount++;
 
     entry->handler = setup.handler;
     entry->handle = setup.handle;
+    entry->type = setup.handle ? handlerType(setup.handler) : PIGEON_TYPE_TEXT;
 
     entry->stream = setup.stream;
     entry->onchange = setup.onchange;
     entry->manual = setup.manual;
 
+    entry->deadband = setup.deadband;
+    entry->lastWritten = 0.0f;
+    entry->written = false;
+
     entry->entryLeft = NULL;
     entry->entryRight = NULL;
 
     PortalEntry ** entryPos = findEntry(entry->key, &portal->topEntry);
     *entryPos = entry;
 
-    PortalEntryList * entryList = malloc(sizeof(PortalEntryList));
-    entryList->entry = entry;
-    entryList->next = portal->entryList;
     portal->entryList = entryList;
+    if (entry->stream) portal->streamList = streamList;
 
-    if (entry->stream)
-    {
-        PortalEntryList * streamList = malloc(sizeof(PortalEntryList));
-        streamList->entry = entry;
-        streamList->next = portal->streamList;
-        portal->streamList = streamList;
-    }
+    if (setup.ref != NULL) *setup.ref = entry->index;
+    return entry->index;
 }
 
 
-void
+// Returns the ref of the first entry, the rest follow consecutively.
+PortalEntryRef
 portalAddBatch(Portal * portal, PortalEntrySetup * setup)
 {
+    PortalEntryRef first = PORTAL_ENTRY_NONE;
     while (true)
     {
         if (setup->key[0] == '~' && setup->handler == NULL)
         {
             break;
         }
-        portalAdd(portal, *setup);
+        PortalEntryRef ref = portalAdd(portal, *setup);
+        if (first == PORTAL_ENTRY_NONE) first = ref;
         setup++;
     }
+    return first;
 }
 
 
@@ -252,26 +526,51 @@ portalSet(Portal * portal, const char * key, const char * message)
         return;
     }
 
-    PortalEntry * entry = *location;
-    if (entry->message == NULL)
+    setEntry(portal, *location, message);
+}
+
+
+void
+portalSetRef(Portal * portal, PortalEntryRef ref, const char * message)
+{
+    if (portal == NULL) return;
+
+    if (!portal->enabled)
     {
-        char message[80];
-        snprintf(message, 80, "set: message not allocated for key %s\n", key);
-        logError(portal->pigeon, message);
         return;
     }
 
-    stringCopy(entry->message, message, LINESIZE);
+    PortalEntry * entry = entryAt(portal, ref);
+    if (entry == NULL) return;
 
-    if (portal->onchange && entry->onchange)
-    {
-        writeMessage(
-            portal->pigeon,
-            portal->id,
-            entry->key,
-            entry->message
-        );
-    }
+    setEntry(portal, entry, message);
+}
+
+
+void
+portalSetStreamRate(Portal * portal, unsigned int every, unsigned long interval)
+{
+    if (portal == NULL) return;
+    portal->streamEvery = every;
+    portal->streamInterval = interval;
+}
+
+
+void
+portalSetDeadband(Portal * portal, PortalEntryRef ref, float deadband)
+{
+    if (portal == NULL) return;
+    PortalEntry * entry = entryAt(portal, ref);
+    if (entry == NULL) return;
+    entry->deadband = deadband;
+}
+
+
+void
+portalSetMutex(Portal * portal, void * mutex)
+{
+    if (portal == NULL) return;
+    portal->mutex = mutex;
 }
 
 
@@ -295,27 +594,24 @@ portalUpdate(Portal * portal, const char * key)
         return;
     }
 
-    PortalEntry * entry = *location;
+    updateEntry(portal, *location);
+}
+
+
+void
+portalUpdateRef(Portal * portal, PortalEntryRef ref)
+{
+    if (portal == NULL) return;
 
-    if (entry->message == NULL)
+    if (!portal->enabled)
     {
-        char message[80];
-        snprintf(message, 80, "update: message not allocated for key '%s'", key);
-        logError(portal->pigeon, message);
         return;
     }
 
-    entry->handler(entry->handle, NULL, entry->message);
+    PortalEntry * entry = entryAt(portal, ref);
+    if (entry == NULL) return;
 
-    if (portal->onchange && entry->onchange)
-    {
-        writeMessage(
-            portal->pigeon,
-            portal->id,
-            entry->key,
-            entry->message
-        );
-    }
+    updateEntry(portal, entry);
 }
 
 
@@ -330,30 +626,17 @@ portalFlush(Portal * portal)
     }
 
     PortalEntryList * list = portal->streamList;
-    char output[LINESIZE] = {0};
     if (list == NULL)
     {
         // Don't write anything if no stream values
         return;
     }
-    while (true)
-    {
-        if (list->entry == NULL)
-        {
-            logError(portal->pigeon, "flush: null entry encountered... aborting");
-            return;
-        }
-        if (list->entry->message == NULL)
-        {
-            logError(portal->pigeon, "flush: entry message not allocated... aborting");
-            return;
-        }
-        stringAppend(output, list->entry->message, LINESIZE);
-        list = list->next;
-        if (list == NULL) break;
-        stringAppend(output, " ", LINESIZE);
-    }
-    writeMessage(portal->pigeon, portal->id, "", output);
+
+    if (!isFlushDue(portal)) return;
+
+    unsigned long start = micros();
+    writeStream(portal);
+    addTiming(&portal->flushTiming, micros() - start);
 }
 
 
@@ -362,6 +645,13 @@ portalReady(Portal * portal)
 {
     if (portal == NULL) return;
     portal->ready = true;
+
+    // Somewhere to remember the last stream values for delta mode
+    if (portal->streamList != NULL && portal->lastStream == NULL)
+    {
+        portal->lastStream = arenaAlloc(portal->pigeon, sizeof(PigeonFrame));
+    }
+
     checkReady(portal->pigeon);
 }
 
@@ -374,15 +664,12 @@ portalEnable(Portal * portal)
     PortalEntryList * entryList = portal->entryList;
     while (entryList != NULL)
     {
-        if (entryList->entry->message != NULL)
-        {
-            free(entryList->entry->message);
-            entryList->entry->message = NULL;
-        }
-        entryList->entry->message = malloc(LINESIZE * sizeof(char));
-        entryList->entry->message[0] = '\0';
+        PortalEntry * entry = entryList->entry;
         entryList = entryList->next;
+        entry->written = false;
+        if (entry->message != NULL) entry->message[0] = '\0';
     }
+    portal->sinceKeyframe = portal->keyframeEvery;
 }
 
 
@@ -391,13 +678,6 @@ portalDisable(Portal * portal)
 {
     if (portal == NULL) return;
     portal->enabled = false;
-    PortalEntryList * entryList = portal->entryList;
-    while (entryList != NULL)
-    {
-        free(entryList->entry->message);
-        entryList->entry->message = NULL;
-        entryList = entryList->next;
-    }
 }
 
 
@@ -429,38 +709,49 @@ portalSetStreamKeys(Portal * portal, char * sequence)
     if (portal == NULL) return false;
 
     PortalEntryList initial;
+    initial.next = NULL;
     PortalEntryList * list = &initial;
 
     // Try to create the list
 
     char * key = strtok(sequence, " ");
-    while (true)
+    while (key != NULL)
     {
         PortalEntry ** entryPtr = findEntry(key, &portal->topEntry);
 
         if (*entryPtr == NULL)
         {
             // Fail, stop, cleanup.
-            deleteEntryList(initial.next);
+            deleteEntryList(portal->pigeon, initial.next);
             char message[80];
             snprintf(message, 80, "setStreamKeys: cannot find entry with key '%s'", key);
             logError(portal->pigeon, message);
             return false;
         }
-        list->next = malloc(sizeof(PortalEntryList));
+        list->next = createEntryList(portal->pigeon, *entryPtr, NULL);
+        if (list->next == NULL)
+        {
+            deleteEntryList(portal->pigeon, initial.next);
+            return false;
+        }
         list = list->next;
 
-        list->entry = *entryPtr;
-        list->next = NULL;
-
         key = strtok(NULL, " ");
-        if (key == NULL) break;
     }
 
-    deleteEntryList(portal->streamList);
+    if (!streamFits(portal, initial.next, NULL))
+    {
+        deleteEntryList(portal->pigeon, initial.next);
+        logError(portal->pigeon, "setStreamKeys: too many keys for one frame... ignoring");
+        return false;
+    }
+
+    deleteEntryList(portal->pigeon, portal->streamList);
     portal->streamList = NULL;
     portal->streamList = initial.next;
 
+    if (isBinary(portal->pigeon)) writeStreamManifest(portal);
+
     return true;
 }
 
@@ -469,9 +760,10 @@ void
 portalFloatHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     float * var = handle;
-    if (msg == NULL) sprintf(res, "%f", *var);
+    if (msg[0] == '\0') sprintf(res, "%f", *var);
     else
     {
         bool success = stringToFloat(msg, var);
@@ -485,9 +777,10 @@ void
 portalIntHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     int * var = handle;
-    if (msg == NULL) sprintf(res, "%u", *var);
+    if (msg[0] == '\0') sprintf(res, "%u", *var);
     else
     {
         unsigned long cast;
@@ -503,9 +796,10 @@ void
 portalUintHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     unsigned int * var = handle;
-    if (msg == NULL) sprintf(res, "%u", *var);
+    if (msg[0] == '\0') sprintf(res, "%u", *var);
     else
     {
         unsigned long cast;
@@ -521,9 +815,10 @@ void
 portalUlongHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     unsigned long * var = handle;
-    if (msg == NULL) sprintf(res, "%lu", *var);
+    if (msg[0] == '\0') sprintf(res, "%lu", *var);
     else
     {
         bool success = stringToUlong(msg, var);
@@ -537,9 +832,10 @@ void
 portalBoolHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     bool * var = handle;
-    if (msg == NULL) strcpy(res, *var ? "true" : "false");
+    if (msg[0] == '\0') strcpy(res, *var ? "true" : "false");
     else if (strcmp(msg, "true") == 0)
     {
         *var = true;
@@ -555,9 +851,10 @@ void
 portalStreamKeyHandler(void * handle, char * msg, char * res)
 {
     if (handle == NULL) return;
+    if (msg == NULL) return;
     if (res == NULL) return;
     Portal * portal = handle;
-    if (msg == NULL) portalGetStreamKeys(portal, res);
+    if (msg[0] == '\0') portalGetStreamKeys(portal, res);
     else portalSetStreamKeys(portal, msg);
 }
 
@@ -573,59 +870,191 @@ task(void * pigeonData)
     Pigeon * pigeon = pigeonData;
     while (true)
     {
-        char input[LINESIZE];
-        char * result = fgets(input, LINESIZE, stdin);
+        char input[PIGEON_INPUTSIZE];
+        char * result = fgets(input, PIGEON_INPUTSIZE, stdin);
         if (result == NULL) continue;
 
-        char * inputTrimmed = trimSpaces(input);
-
-        if (inputTrimmed[0] == '\0') continue;
-
-        char * path = strtok(inputTrimmed, " ");
-        char * message = strtok(NULL, "");
+        // Throw away the rest of a line too long for the buffer, rather
+        // than running its tail as commands of its own
+        if (strchr(input, '\n') == NULL && strlen(input) == PIGEON_INPUTSIZE - 1)
+        {
+            while (result != NULL && strchr(input, '\n') == NULL)
+            {
+                result = fgets(input, PIGEON_INPUTSIZE, stdin);
+            }
+            pigeon->stats.inputLines++;
+            logError(pigeon, "line too long... ignoring it");
+            continue;
+        }
 
-        char * portalId = strtok(path, ".");
-        char * entryKey = strtok(NULL, ".");
+        pigeonInput(pigeon, input);
 
-        portalId = trimSpaces(portalId);
-        entryKey = trimSpaces(entryKey);
+        // Let the writer catch up before taking on the next line
+        waitForWriter(pigeon);
+    }
+}
 
-        Portal ** portalPos = findPortal(portalId, &pigeon->topPortal);
-        if (*portalPos == NULL)
+// Splits a line into its ';' separated commands, dropping any bad ones.
+// A ';' inside double quotes is part of the value.
+// Note: input will be modified
+static int
+parseCommands(Pigeon * pigeon, char * input, Command * commands)
+{
+    int count = 0;
+    char * segment = input;
+    while (segment != NULL)
+    {
+        char * separator = NULL;
+        bool quoted = false;
+        for (char * c = segment; *c != '\0'; c++)
         {
-            char message[80];
-            snprintf(message, 80, "cannot find portal with id '%s'", portalId);
-            logError(pigeon, message);
-            continue;
+            if (*c == '"') quoted = !quoted;
+            if (*c == ';' && !quoted)
+            {
+                separator = c;
+                break;
+            }
         }
-        Portal * portal = *portalPos;
-
-        PortalEntry ** entryPos = findEntry(entryKey, &portal->topEntry);
-        if (*entryPos == NULL)
+        if (separator != NULL)
         {
-            char message[80];
-            snprintf(message, 80, "cannot find entry with key '%s'", entryKey);
-            logError(pigeon, message);
-            continue;
+            *separator = '\0';
+            separator++;
+        }
+        if (count == MAXCOMMANDS)
+        {
+            logError(pigeon, "too many commands on one line... ignoring the rest");
+            break;
         }
-        PortalEntry * entry = *entryPos;
+        if (parseCommand(pigeon, segment, &commands[count])) count++;
+        segment = separator;
+    }
+    return count;
+}
+
+static bool
+parseCommand(Pigeon * pigeon, char * input, Command * command)
+{
+    char * inputTrimmed = trimSpaces(input);
 
-        if (entry->handler == NULL) continue;
-        char response[LINESIZE] = {0};
-        entry->handler(entry->handle, message, response);
+    if (inputTrimmed[0] == '\0') return false;
 
-        if (!entry->manual) portalUpdate(portal, entry->key);
+    char * path = strtok(inputTrimmed, " ");
+    char * message = strtok(NULL, "");
 
-        if (response[0] == '\0') continue;
+    // No value means the host is asking for the current one
+    command->none[0] = '\0';
+    if (message == NULL) message = command->none;
+    else message = trimSpaces(message);
 
-        writeMessage(
-            pigeon,
-            portal->id,
-            entry->key,
-            response
-        );
+    // Quotes around a value only keep it together
+    size_t length = strlen(message);
+    if (length >= 2 && message[0] == '"' && message[length - 1] == '"')
+    {
+        message[length - 1] = '\0';
+        message++;
+    }
+
+    char * portalId = strtok(path, ".");
+    char * entryKey = strtok(NULL, ".");
+
+    if (portalId == NULL || entryKey == NULL)
+    {
+        logError(pigeon, "expected a command like 'portal.key value'");
+        return false;
+    }
+
+    portalId = trimSpaces(portalId);
+    entryKey = trimSpaces(entryKey);
+
+    Portal ** portalPos = findPortal(portalId, &pigeon->topPortal);
+    if (*portalPos == NULL)
+    {
+        char message[80];
+        snprintf(message, 80, "cannot find portal with id '%s'", portalId);
+        logError(pigeon, message);
+        pigeon->stats.lookupFailures++;
+        return false;
+    }
+    Portal * portal = *portalPos;
+
+    PortalEntry ** entryPos = findEntry(entryKey, &portal->topEntry);
+    if (*entryPos == NULL)
+    {
+        char message[80];
+        snprintf(message, 80, "cannot find entry with key '%s'", entryKey);
+        logError(pigeon, message);
+        pigeon->stats.lookupFailures++;
+        return false;
+    }
+
+    command->portal = portal;
+    command->entry = *entryPos;
+    command->message = message;
+    command->done = false;
+    command->response[0] = '\0';
+    return true;
+}
+
+//
+// Applies every plain value assignment to a portal together, under its
+// owner's mutex, so its task never sees half of a batch. Any other
+// handler may call back into its owner or take a while, so it runs
+// afterwards, outside the mutex, along with the replies and updates.
+//
+static void
+runCommands(Command * commands, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (commands[i].done) continue;
+        Portal * portal = commands[i].portal;
+
+        if (portal->mutex != NULL) mutexTake(portal->mutex, -1);
+        for (int j = i; j < count; j++)
+        {
+            Command * command = &commands[j];
+            if (command->portal != portal) continue;
+            if (command->message[0] == '\0') continue;
+            if (!isValueHandler(command->entry->handler)) continue;
+            command->entry->handler(
+                command->entry->handle,
+                command->message,
+                command->response
+            );
+        }
+        if (portal->mutex != NULL) mutexGive(portal->mutex);
+
+        for (int j = i; j < count; j++)
+        {
+            Command * command = &commands[j];
+            if (command->portal != portal) continue;
+            command->done = true;
+
+            PortalEntry * entry = command->entry;
+            if (entry->handler == NULL) continue;
+
+            bool query = command->message[0] == '\0';
+            if (query || !isValueHandler(entry->handler))
+            {
+                entry->handler(entry->handle, command->message, command->response);
+            }
+            if (!query && !entry->manual) updateEntry(portal, entry);
+
+            if (command->response[0] == '\0') continue;
+            writeEntry(portal, entry, command->response);
+        }
+    }
+}
 
-        delay(40);
+// Holds off while the output ring is more than half full.
+static void
+waitForWriter(Pigeon * pigeon)
+{
+    if (pigeon->writer == NULL) return;
+    int capacity = pigeonRingCapacity(pigeon->ring);
+    while (pigeonRingCount(pigeon->ring) > capacity / 2)
+    {
+        delay(1);
     }
 }
 
@@ -656,59 +1085,362 @@ isPortalBranchReady(Portal * portal)
 }
 
 
+// Writes every stream value out together, as one line or frame.
 static void
-writeMessage(
-    Pigeon * pigeon,
-    const char * id,
-    const char * key,
-    const char * message
-){
+writeStream(Portal * portal)
+{
+    PortalEntryList * list = portal->streamList;
 
-    char path[LINESIZE];
-    if (key[0] == '\0')
-    {
-        snprintf(path, LINESIZE, "%s", id);
-    }
-    else
+    if (isBinary(portal->pigeon))
     {
-        snprintf(path, LINESIZE, "%s.%s", id, key);
+        PigeonFrame frame;
+        frame.portal = portal->index;
+        frame.entry = PIGEON_FRAME_STREAM;
+        frame.count = 0;
+        int stringsUsed = 0;
+        // streamFits keeps the stream within a frame's values
+        while (list != NULL && frame.count < PIGEON_FRAME_MAXVALUES)
+        {
+            char text[LINESIZE] = {0};
+            PigeonValue value = entryValue(list->entry, text);
+            if (value.type == PIGEON_TYPE_TEXT)
+            {
+                // Each text value needs its own storage until encoded.
+                // Once it runs out, text is cut short rather than dropped,
+                // so the values still line up with the manifest.
+                int room = PIGEON_FRAME_MAXSIZE - stringsUsed;
+                char * copy = frame.strings + stringsUsed;
+                if (room > 1) stringCopy(copy, text, room);
+                else copy = "";
+                stringsUsed += strlen(copy) + 1;
+                value.as.text = copy;
+            }
+            frame.values[frame.count] = value;
+            frame.count++;
+            list = list->next;
+        }
+        if (portal->pigeon->mode == PIGEON_MODE_DELTA)
+        {
+            writeStreamDelta(portal, &frame);
+            return;
+        }
+        writeFrame(portal, &frame);
+        return;
     }
 
-    int pathLength = strlen(path);
-    int pathDisplayWidth = pathLength;
-
-    // round up
-    pathDisplayWidth += ALIGNSIZE - 1;
-    pathDisplayWidth = (pathDisplayWidth / ALIGNSIZE) * ALIGNSIZE;
-    if (pathDisplayWidth > LINESIZE - 1) pathDisplayWidth = LINESIZE - 1;
-
-    while (pathLength < pathDisplayWidth)
+    char output[LINESIZE] = {0};
+    while (true)
     {
-        path[pathLength] = ' ';
-        pathLength++;
+        if (list->entry == NULL)
+        {
+            logError(portal->pigeon, "flush: null entry encountered... aborting");
+            return;
+        }
+        char message[LINESIZE] = {0};
+        formatEntry(list->entry, message);
+        stringAppend(output, message, LINESIZE);
+        list = list->next;
+        if (list == NULL) break;
+        stringAppend(output, " ", LINESIZE);
     }
-    path[pathLength] = '\0';
+    writeMessage(portal, "", output);
+}
 
+static void
+writeMessage(Portal * portal, const char * key, const char * message)
+{
+    Pigeon * pigeon = portal->pigeon;
+    unsigned long start = micros();
     char str[LINESIZE];
-    snprintf(
-        str,
-        LINESIZE,
-        "[%08u|%s] %s",
-        (unsigned int)pigeon->millis(),
-        path,
-        message
-    );
-    pigeon->puts(str);
+    unsigned long now = pigeon->millis();
+    int length = pigeonFormatText(str, LINESIZE, now, portal->id, key, message);
+    output(pigeon, RECORD_TEXT, str, length);
+    addTiming(&portal->writeTiming, micros() - start);
 }
 
-static Portal **
-findPortal(const char * id, Portal ** topPortal)
+static void
+writeFrame(Portal * portal, PigeonFrame * frame)
 {
-    Portal ** visiting = topPortal;
-    while (*visiting != NULL)
+    Pigeon * pigeon = portal->pigeon;
+    unsigned long start = micros();
+    unsigned char buffer[PIGEON_FRAME_MAXSIZE];
+    frame->timestamp = pigeon->millis();
+    int size = pigeonFrameEncode(frame, buffer, PIGEON_FRAME_MAXSIZE);
+    if (size == 0)
     {
-        int comparison = strcmp(id, (*visiting)->id);
-        if (comparison == 0)
+        logError(pigeon, "write: frame too big... dropping it");
+        return;
+    }
+    output(pigeon, RECORD_BINARY, buffer, size);
+    addTiming(&portal->writeTiming, micros() - start);
+}
+
+// Queues a record for the writer task, or writes it straight away if there
+// is no writer task to hand it to.
+static void
+output(Pigeon * pigeon, unsigned char tag, const void * data, int size)
+{
+    if (pigeon->writer == NULL)
+    {
+        emit(pigeon, tag, data, size);
+        return;
+    }
+    while (!pigeonRingPush(pigeon->ring, pigeon->overflow, tag, data, size))
+    {
+        if (pigeon->overflow != PIGEON_OVERFLOW_BLOCK) return;
+        delay(1);
+    }
+}
+
+static void
+emit(Pigeon * pigeon, unsigned char tag, const unsigned char * data, int size)
+{
+    countOutput(pigeon, tag == RECORD_BINARY ? size : size + 1);
+    if (tag == RECORD_BINARY)
+    {
+        if (pigeon->write != NULL) pigeon->write((const char *)data, size);
+        return;
+    }
+    char line[PIGEON_RING_SLOTSIZE + 1];
+    memcpy(line, data, size);
+    line[size] = '\0';
+    pigeon->puts(line);
+}
+
+static void
+addTiming(Timing * timing, unsigned long elapsed)
+{
+    timing->count++;
+    timing->total += elapsed;
+    if (elapsed > timing->worst) timing->worst = elapsed;
+}
+
+// "mean/worst" in microseconds
+static void
+formatTiming(Timing * timing, char * destination)
+{
+    unsigned long mean = 0;
+    if (timing->count > 0) mean = timing->total / timing->count;
+    sprintf(destination, "%lu/%luus", mean, timing->worst);
+}
+
+static void
+countOutput(Pigeon * pigeon, int size)
+{
+    PigeonStats * stats = &pigeon->stats;
+    stats->windowBytes += size;
+    stats->windowRecords++;
+
+    unsigned long now = pigeon->millis();
+    unsigned long elapsed = now - stats->windowStart;
+    if (elapsed < 1000) return;
+
+    stats->bytesPerSecond = stats->windowBytes * 1000 / elapsed;
+    stats->recordsPerSecond = stats->windowRecords * 1000 / elapsed;
+    stats->windowStart = now;
+    stats->windowBytes = 0;
+    stats->windowRecords = 0;
+}
+
+// Low priority, so serial output only ever uses otherwise idle time.
+static void
+writerTask(void * pigeonData)
+{
+    Pigeon * pigeon = pigeonData;
+    while (true)
+    {
+        unsigned char data[PIGEON_RING_SLOTSIZE];
+        unsigned char tag;
+        int size = pigeonRingPop(pigeon->ring, &tag, data);
+        if (size < 0)
+        {
+            delay(WRITER_IDLE);
+            continue;
+        }
+        emit(pigeon, tag, data, size);
+    }
+}
+
+// Message may be NULL for typed entries in binary mode.
+static void
+writeEntry(Portal * portal, PortalEntry * entry, const char * message)
+{
+    if (isBinary(portal->pigeon))
+    {
+        PigeonFrame frame;
+        frame.portal = portal->index;
+        frame.entry = entry->index;
+        frame.count = 1;
+        frame.values[0] = entryValue(entry, NULL);
+        if (frame.values[0].type == PIGEON_TYPE_TEXT)
+        {
+            frame.values[0].as.text = message;
+        }
+        writeFrame(portal, &frame);
+    }
+    else
+    {
+        writeMessage(portal, entry->key, message);
+    }
+}
+
+// Formats the entry's current value as text, only done when written out.
+static void
+formatEntry(PortalEntry * entry, char * destination)
+{
+    if (entry->handler != NULL)
+    {
+        entry->handler(entry->handle, "", destination);
+    }
+    else if (entry->message != NULL)
+    {
+        stringCopy(destination, entry->message, LINESIZE);
+    }
+}
+
+// Reads a typed entry straight from its handle. Text entries are formatted
+// into the given LINESIZE buffer, unless it is NULL.
+static PigeonValue
+entryValue(PortalEntry * entry, char * text)
+{
+    PigeonValue value;
+    value.type = entry->type;
+    switch (entry->type)
+    {
+    case PIGEON_TYPE_FLOAT:
+        value.as.f = *(float *)entry->handle;
+        break;
+    case PIGEON_TYPE_INT:
+        value.as.i = *(int *)entry->handle;
+        break;
+    case PIGEON_TYPE_UINT:
+        if (entry->handler == portalUlongHandler)
+        {
+            value.as.u = *(unsigned long *)entry->handle;
+        }
+        else
+        {
+            value.as.u = *(unsigned int *)entry->handle;
+        }
+        break;
+    case PIGEON_TYPE_BOOL:
+        value.as.b = *(bool *)entry->handle;
+        break;
+    default:
+        value.type = PIGEON_TYPE_TEXT;
+        value.as.text = text;
+        if (text != NULL) formatEntry(entry, text);
+        break;
+    }
+    return value;
+}
+
+// Entries using the stock handlers have a known type,
+// everything else goes out as the text its handler produces.
+static PigeonType
+handlerType(PortalEntryHandler handler)
+{
+    if (handler == portalFloatHandler) return PIGEON_TYPE_FLOAT;
+    if (handler == portalIntHandler) return PIGEON_TYPE_INT;
+    if (handler == portalUintHandler) return PIGEON_TYPE_UINT;
+    if (handler == portalUlongHandler) return PIGEON_TYPE_UINT;
+    if (handler == portalBoolHandler) return PIGEON_TYPE_BOOL;
+    return PIGEON_TYPE_TEXT;
+}
+
+// Handlers that only store a value, and so are safe under the owner's mutex
+static bool
+isValueHandler(PortalEntryHandler handler)
+{
+    if (handler == NULL) return false;
+    return handlerType(handler) != PIGEON_TYPE_TEXT;
+}
+
+// Sends what changed since the last stream frame, or the whole frame when a
+// keyframe is due.
+static void
+writeStreamDelta(Portal * portal, PigeonFrame * frame)
+{
+    if (portal->lastStream == NULL)
+    {
+        writeFrame(portal, frame);
+        return;
+    }
+
+    PigeonFrame delta;
+    if (portal->sinceKeyframe + 1 >= portal->keyframeEvery ||
+        !pigeonFrameDelta(portal->lastStream, frame, &delta))
+    {
+        writeFrame(portal, frame);
+        portal->sinceKeyframe = 0;
+    }
+    else
+    {
+        writeFrame(portal, &delta);
+        portal->sinceKeyframe++;
+    }
+    pigeonFrameCopy(portal->lastStream, frame);
+}
+
+static bool
+isBinary(Pigeon * pigeon)
+{
+    return pigeon->mode != PIGEON_MODE_TEXT;
+}
+
+// Walks the portal tree, naming every portal and entry index.
+static void
+writeManifest(Portal * portal)
+{
+    if (portal == NULL) return;
+    writeManifest(portal->portalLeft);
+
+    writeStreamManifest(portal);
+    PigeonFrame frame;
+    frame.portal = portal->index;
+    frame.count = 1;
+    frame.values[0].type = PIGEON_TYPE_NAME;
+    PortalEntryList * list = portal->entryList;
+    while (list != NULL)
+    {
+        frame.entry = list->entry->index;
+        frame.values[0].as.text = list->entry->key;
+        writeFrame(portal, &frame);
+        list = list->next;
+    }
+
+    writeManifest(portal->portalRight);
+}
+
+// Names the portal, along with the keys of its stream values in order.
+static void
+writeStreamManifest(Portal * portal)
+{
+    // The host has to start again from a keyframe
+    portal->sinceKeyframe = portal->keyframeEvery;
+
+    char keys[LINESIZE];
+    portalGetStreamKeys(portal, keys);
+
+    PigeonFrame frame;
+    frame.portal = portal->index;
+    frame.entry = PIGEON_FRAME_STREAM;
+    frame.count = 2;
+    frame.values[0].type = PIGEON_TYPE_NAME;
+    frame.values[0].as.text = portal->id;
+    frame.values[1].type = PIGEON_TYPE_TEXT;
+    frame.values[1].as.text = keys;
+    writeFrame(portal, &frame);
+}
+
+static Portal **
+findPortal(const char * id, Portal ** topPortal)
+{
+    Portal ** visiting = topPortal;
+    while (*visiting != NULL)
+    {
+        int comparison = strcmp(id, (*visiting)->id);
+        if (comparison == 0)
         {
             return visiting;
         }
@@ -747,17 +1479,224 @@ findEntry(const char * key, PortalEntry ** topEntry)
     return visiting;
 }
 
+static PortalEntry *
+entryAt(Portal * portal, PortalEntryRef ref)
+{
+    if (ref < 0 || ref >= portal->entryCount)
+    {
+        char message[80];
+        snprintf(message, 80, "cannot find entry with ref %d in '%s'", ref, portal->id);
+        logError(portal->pigeon, message);
+        return NULL;
+    }
+    return portal->entryChunks[ref / ENTRYCHUNK][ref % ENTRYCHUNK];
+}
+
 static void
-deleteEntryList(PortalEntryList * list)
+setEntry(Portal * portal, PortalEntry * entry, const char * message)
+{
+    if (entry->message != NULL)
+    {
+        stringCopy(entry->message, message, LINESIZE);
+    }
+
+    if (portal->onchange && entry->onchange)
+    {
+        writeEntry(portal, entry, message);
+    }
+}
+
+static void
+updateEntry(Portal * portal, PortalEntry * entry)
+{
+    // Nobody is listening, so there is nothing to format
+    if (!portal->onchange || !entry->onchange) return;
+    if (!isOutsideDeadband(entry)) return;
+
+    if (entry->type != PIGEON_TYPE_TEXT && isBinary(portal->pigeon))
+    {
+        writeEntry(portal, entry, NULL);
+        return;
+    }
+
+    char message[LINESIZE] = {0};
+    formatEntry(entry, message);
+    writeEntry(portal, entry, message);
+}
+
+static bool
+isFlushDue(Portal * portal)
+{
+    portal->flushCount++;
+    if (portal->flushCount < portal->streamEvery) return false;
+
+    if (portal->streamInterval > 0)
+    {
+        unsigned long now = portal->pigeon->millis();
+        if (now - portal->lastFlush < portal->streamInterval) return false;
+        portal->lastFlush = now;
+    }
+
+    portal->flushCount = 0;
+    return true;
+}
+
+// Also remembers the value as written if it is.
+static bool
+isOutsideDeadband(PortalEntry * entry)
+{
+    if (entry->deadband <= 0.0f) return true;
+
+    PigeonValue value = entryValue(entry, NULL);
+    float number;
+    switch (value.type)
+    {
+    case PIGEON_TYPE_FLOAT:
+        number = value.as.f;
+        break;
+    case PIGEON_TYPE_INT:
+        number = value.as.i;
+        break;
+    case PIGEON_TYPE_UINT:
+        number = value.as.u;
+        break;
+    default:
+        return true;
+    }
+
+    float change = number - entry->lastWritten;
+    if (entry->written && change < entry->deadband && change > -entry->deadband)
+    {
+        return false;
+    }
+    entry->lastWritten = number;
+    entry->written = true;
+    return true;
+}
+
+// Returns NULL once the arena is full.
+static void *
+arenaAlloc(Pigeon * pigeon, size_t size)
+{
+    // Keep everything pointer aligned
+    size = (size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    if (pigeon->arena == NULL || pigeon->arenaUsed + size > pigeon->arenaSize)
+    {
+        logError(pigeon, "arena: out of memory... raise PIGEON_ARENASIZE");
+        return NULL;
+    }
+    void * allocation = pigeon->arena + pigeon->arenaUsed;
+    pigeon->arenaUsed += size;
+    return allocation;
+}
+
+// Whether a stream of these entries, and one more key if given, goes out
+// in one frame, and its keys in one manifest frame
+static bool
+streamFits(Portal * portal, PortalEntryList * list, const char * extraKey)
+{
+    int count = 0;
+    int keysSize = 0;
+    if (extraKey != NULL)
+    {
+        count++;
+        keysSize += strlen(extraKey) + 1;
+    }
+    for (; list != NULL; list = list->next)
+    {
+        count++;
+        keysSize += strlen(list->entry->key) + 1;
+    }
+
+    // Portal id and keys, each with a type and a length byte
+    int manifestSize = 2 + strlen(portal->id) + 2 + keysSize;
+    if (count > PIGEON_FRAME_MAXVALUES) return false;
+    if (keysSize > LINESIZE) return false;
+    return manifestSize <= FRAMEPAYLOAD;
+}
+
+static PortalEntryList *
+createEntryList(Pigeon * pigeon, PortalEntry * entry, PortalEntryList * next)
+{
+    PortalEntryList * list = pigeon->spareLists;
+    if (list != NULL)
+    {
+        pigeon->spareLists = list->next;
+    }
+    else
+    {
+        list = arenaAlloc(pigeon, sizeof(PortalEntryList));
+        if (list == NULL) return NULL;
+    }
+    list->entry = entry;
+    list->next = next;
+    return list;
+}
+
+// Hands the nodes back to the pool for the next list.
+static void
+deleteEntryList(Pigeon * pigeon, PortalEntryList * list)
 {
     while (list != NULL)
     {
         PortalEntryList * old = list;
         list = list->next;
-        free(old);
+        old->next = pigeon->spareLists;
+        pigeon->spareLists = old;
     }
 }
 
+// Keys every portal has, for tuning how much it writes
+static void
+setupPortalEntries(Portal * portal)
+{
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "stream-every",
+            .handler = portalUintHandler,
+            .handle = &portal->streamEvery
+        },
+        {
+            .key = "stream-interval",
+            .handler = portalUlongHandler,
+            .handle = &portal->streamInterval
+        },
+        {
+            .key = "stream-keyframe",
+            .handler = portalUintHandler,
+            .handle = &portal->keyframeEvery
+        },
+        {
+            .key = "deadband",
+            .handler = deadbandHandler,
+            .handle = portal,
+            .manual = true
+        },
+        {
+            .key = "flush-time",
+            .handler = timingHandler,
+            .handle = &portal->flushTiming,
+            .manual = true
+        },
+        {
+            .key = "write-time",
+            .handler = timingHandler,
+            .handle = &portal->writeTiming,
+            .manual = true
+        },
+
+        // End terminating struct
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+
+    portalAddBatch(portal, setups);
+}
+
 static void
 setupPigeonPortal(Pigeon * pigeon)
 {
@@ -782,8 +1721,36 @@ setupPigeonPortal(Pigeon * pigeon)
         },
         {
             .key = "error",
+            .onchange = true,
+            .ref = &pigeon->errorRef
+        },
+        {
+            .key = "mode",
+            .handler = modeHandler,
+            .handle = pigeon,
             .onchange = true
         },
+        {
+            .key = "overflow",
+            .handler = overflowHandler,
+            .handle = pigeon
+        },
+        {
+            .key = "dropped",
+            .handler = droppedHandler,
+            .handle = pigeon
+        },
+        {
+            .key = "memory",
+            .handler = memoryHandler,
+            .handle = pigeon
+        },
+        {
+            .key = "stats",
+            .handler = statsHandler,
+            .handle = pigeon,
+            .manual = true
+        },
 
         // End terminating struct
         {
@@ -841,10 +1808,216 @@ getKeysHandler(void * handle, char * message, char * response)
     portalGetStreamKeys(portal, response);
 }
 
+static void
+modeHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Pigeon * pigeon = handle;
+    if (message[0] == '\0')
+    {
+        switch (pigeon->mode)
+        {
+        case PIGEON_MODE_TEXT: strcpy(response, "text"); break;
+        case PIGEON_MODE_BINARY: strcpy(response, "binary"); break;
+        case PIGEON_MODE_DELTA: strcpy(response, "delta"); break;
+        }
+    }
+    else if (strcmp(message, "binary") == 0)
+    {
+        pigeonSetMode(pigeon, PIGEON_MODE_BINARY);
+    }
+    else if (strcmp(message, "delta") == 0)
+    {
+        pigeonSetMode(pigeon, PIGEON_MODE_DELTA);
+    }
+    else if (strcmp(message, "text") == 0)
+    {
+        pigeonSetMode(pigeon, PIGEON_MODE_TEXT);
+    }
+}
+
+static void
+overflowHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Pigeon * pigeon = handle;
+    if (message[0] == '\0')
+    {
+        switch (pigeon->overflow)
+        {
+        case PIGEON_OVERFLOW_DROP_OLDEST: strcpy(response, "oldest"); break;
+        case PIGEON_OVERFLOW_DROP_NEWEST: strcpy(response, "newest"); break;
+        case PIGEON_OVERFLOW_BLOCK: strcpy(response, "block"); break;
+        }
+    }
+    else if (strcmp(message, "oldest") == 0)
+    {
+        pigeonSetOverflow(pigeon, PIGEON_OVERFLOW_DROP_OLDEST);
+    }
+    else if (strcmp(message, "newest") == 0)
+    {
+        pigeonSetOverflow(pigeon, PIGEON_OVERFLOW_DROP_NEWEST);
+    }
+    else if (strcmp(message, "block") == 0)
+    {
+        pigeonSetOverflow(pigeon, PIGEON_OVERFLOW_BLOCK);
+    }
+}
+
+// Read only
+static void
+droppedHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Pigeon * pigeon = handle;
+    if (message[0] != '\0') return;
+    sprintf(response, "%lu", pigeonRingDropped(pigeon->ring));
+}
+
+// Read only, "used/capacity" in bytes
+static void
+memoryHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Pigeon * pigeon = handle;
+    if (message[0] != '\0') return;
+    sprintf(
+        response,
+        "%lu/%lu",
+        (unsigned long)pigeon->arenaUsed,
+        (unsigned long)pigeon->arenaSize
+    );
+}
+
+//
+// Reads "<bytes>B/s <records>L/s drop <dropped> in <lines>/<failed>", after
+// writing every portal's flush-time and write-time. Setting it to anything
+// resets all the timings.
+//
+static void
+statsHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Pigeon * pigeon = handle;
+    PigeonStats * stats = &pigeon->stats;
+    if (message[0] != '\0')
+    {
+        writeTimings(pigeon->topPortal, true);
+        return;
+    }
+    writeTimings(pigeon->topPortal, false);
+
+    // Nothing has gone out for a while, so the last rate is stale
+    unsigned long bytesPerSecond = stats->bytesPerSecond;
+    unsigned long recordsPerSecond = stats->recordsPerSecond;
+    if (pigeon->millis() - stats->windowStart > 2000)
+    {
+        bytesPerSecond = 0;
+        recordsPerSecond = 0;
+    }
+
+    snprintf(
+        response,
+        LINESIZE,
+        "%luB/s %luL/s drop %lu in %lu/%lu",
+        bytesPerSecond,
+        recordsPerSecond,
+        pigeonRingDropped(pigeon->ring),
+        stats->inputLines,
+        stats->lookupFailures
+    );
+}
+
+// Writes, or resets, the timings of every portal in the tree.
+static void
+writeTimings(Portal * portal, bool reset)
+{
+    if (portal == NULL) return;
+    writeTimings(portal->portalLeft, reset);
+
+    const char * keys[] = {"flush-time", "write-time"};
+    Timing * timings[] = {&portal->flushTiming, &portal->writeTiming};
+
+    // Both are read before either is written, as writing adds to them
+    char texts[2][32];
+    for (int i = 0; i < 2; i++)
+    {
+        formatTiming(timings[i], texts[i]);
+        if (reset) memset(timings[i], 0, sizeof(Timing));
+    }
+    for (int i = 0; i < 2 && !reset; i++)
+    {
+        PortalEntry * entry = *findEntry(keys[i], &portal->topEntry);
+        if (entry != NULL) writeEntry(portal, entry, texts[i]);
+    }
+
+    writeTimings(portal->portalRight, reset);
+}
+
+// Reads a Timing as "<mean>/<worst>us", setting it resets it.
+static void
+timingHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Timing * timing = handle;
+    if (message[0] != '\0')
+    {
+        memset(timing, 0, sizeof(Timing));
+        return;
+    }
+    formatTiming(timing, response);
+}
+
+// Takes "key value" to set an entry's deadband, or just "key" to read it.
+static void
+deadbandHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (response == NULL) return;
+    Portal * portal = handle;
+    char * key = strtok(message, " ");
+    char * value = strtok(NULL, " ");
+    if (key == NULL) return;
+
+    PortalEntry ** location = findEntry(key, &portal->topEntry);
+    if (*location == NULL)
+    {
+        char error[80];
+        snprintf(error, 80, "deadband: cannot find entry with key '%s'", key);
+        logError(portal->pigeon, error);
+        return;
+    }
+    PortalEntry * entry = *location;
+
+    if (value == NULL)
+    {
+        snprintf(response, LINESIZE, "%s %f", entry->key, entry->deadband);
+    }
+    else
+    {
+        bool success = stringToFloat(value, &entry->deadband);
+        UNUSED(success);
+    }
+}
+
 static void
 logError(Pigeon * pigeon, char * message)
 {
-    portalSet(pigeon->pigeonPortal, "error", message);
+    if (pigeon->errorRef == PORTAL_ENTRY_NONE) return;
+    portalSetRef(pigeon->pigeonPortal, pigeon->errorRef, message);
 }
 
 // }}}
@@ -1,7 +1,8 @@
 #include "reckoner.h"
 
-#include <math.h>
 #include <stdbool.h>
+#include <string.h>
+#include "odometry.h"
 #include "pigeon.h"
 #include "shims.h"
 #include "utils.h"
@@ -12,11 +13,32 @@ typedef struct Reckoner Reckoner;
 struct Reckoner
 {
     Portal * portal;
+    struct
+    {
+        PortalEntryRef time;
+        PortalEntryRef left;
+        PortalEntryRef right;
+        PortalEntryRef leftChange;
+        PortalEntryRef rightChange;
+        PortalEntryRef velocityLeftRaw;
+        PortalEntryRef velocityRightRaw;
+        PortalEntryRef velocityLeft;
+        PortalEntryRef velocityRight;
+        PortalEntryRef velocity;
+        PortalEntryRef heading;
+        PortalEntryRef x;
+        PortalEntryRef y;
+        PortalEntryRef overruns;
+        PortalEntryRef gyro;
+    }
+    refs;
 
     EncoderGetter encoderLeftGet;
     EncoderHandle encoderLeft;
     EncoderGetter encoderRightGet;
     EncoderHandle encoderRight;
+    Gyro gyro;
+    bool gyroReversed;
 
     float gearingLeft;
     float gearingRight;
@@ -37,17 +59,33 @@ struct Reckoner
     float velocityRightRaw;
     float velocityLeft;
     float velocityRight;
+    float gyroAngle;
+    OdometryGyro gyroFusion;
     ReckonerState state;
 
+    // Copy of state for other tasks, and the states before it. Only the
+    // update writes them, and sequence is odd while it does, so a reader
+    // can tell it was torn.
+    volatile unsigned long sequence;
+    ReckonerState published;
+    OdometryHistory history;
+
+    unsigned int priority;
+    unsigned long frameDelay;
+    unsigned long overruns;
+    TaskHandle task;
+
     Mutex mutex;
 };
 
 static void updateReadings(Reckoner*);
 static void updateWheels(Reckoner*);
 static void updateVelocity(Reckoner*);
-static void updateHeading(Reckoner*);
-static void updatePosition(Reckoner*);
+static void updatePose(Reckoner*);
+static void publish(Reckoner*);
+static bool retry(Reckoner*, unsigned long sequence);
 static void updatePortal(Reckoner*);
+static void task(void * reckonerPointer);
 static void setupPortal(Reckoner*, ReckonerSetup);
 
 Reckoner *
@@ -72,10 +110,11 @@ reckonerInit(ReckonerSetup setup)
     r->velocityLeft = 0;
     r->velocityRight = 0;
 
+    r->state.microTime = r->microTime;
     r->state.velocity = setup.initialVelocity;
     r->state.heading = setup.initialHeading;
-    r->state.x = setup.initialY;
-    r->state.y = setup.initialX;
+    r->state.x = setup.initialX;
+    r->state.y = setup.initialY;
 
     r->gearingLeft = setup.gearingLeft;
     r->gearingRight = setup.gearingRight;
@@ -84,20 +123,85 @@ reckonerInit(ReckonerSetup setup)
     r->wheelSeparation = setup.wheelSeparation;
     r->smoothing = setup.smoothing;
 
+    r->sequence = 0;
+    r->published = r->state;
+    odometryHistoryClear(&r->history);
+    r->priority = setup.priority;
+    r->frameDelay = setup.frameDelay;
+    r->overruns = 0;
+    r->task = NULL;
+
     r->encoderLeftGet = setup.encoderLeftGetter;
     r->encoderLeft = setup.encoderLeft;
     r->encoderRightGet = setup.encoderRightGetter;
     r->encoderRight = setup.encoderRight;
+    r->gyro = setup.gyro;
+    r->gyroReversed = setup.gyroReversed;
+
+    memset(&r->gyroFusion, 0, sizeof(OdometryGyro));
+    r->gyroFusion.timeConstant = setup.gyroTimeConstant;
+    r->gyroFusion.biasRate = setup.gyroBiasRate;
+    r->gyroFusion.stillDistance = setup.gyroStillDistance;
+    r->gyroAngle = 0;
 
     r->mutex = mutexCreate();
+    portalSetMutex(r->portal, r->mutex);
 
     return r;
 }
 
-ReckonerState *
+ReckonerState
 reckonerGetState(Reckoner * r)
 {
-    return &r->state;
+    ReckonerState state;
+    unsigned long sequence;
+    do
+    {
+        sequence = r->sequence;
+        __sync_synchronize();
+        state = r->published;
+        __sync_synchronize();
+    }
+    while (retry(r, sequence));
+    return state;
+}
+
+bool
+reckonerGetStateAt(Reckoner * r, unsigned long microTime, ReckonerState * state)
+{
+    OdometrySample sample;
+    bool found;
+    unsigned long sequence;
+    do
+    {
+        sequence = r->sequence;
+        __sync_synchronize();
+        found = odometryHistoryAt(&r->history, microTime, &sample);
+        __sync_synchronize();
+    }
+    while (retry(r, sequence));
+
+    // Nothing recorded yet, so it can only be where it is now
+    if (r->history.count == 0)
+    {
+        *state = reckonerGetState(r);
+        return false;
+    }
+    state->microTime = sample.microTime;
+    state->velocity = sample.velocity;
+    state->heading = sample.heading;
+    state->x = sample.x;
+    state->y = sample.y;
+    return found;
+}
+
+void
+reckonerRun(Reckoner * r)
+{
+    if (r->task == NULL)
+    {
+        r->task = taskCreate(task, TASK_DEFAULT_STACK_SIZE, r, r->priority);
+    }
 }
 
 void
@@ -107,18 +211,50 @@ reckonerUpdate(Reckoner * r)
     updateReadings(r);
     updateWheels(r);
     updateVelocity(r);
-    updateHeading(r);
-    updatePosition(r);
+    updatePose(r);
+    publish(r);
     updatePortal(r);
     mutexGive(r->mutex);
 }
 
+// Sleeps to one frame delay after the last deadline, skipping any frames
+// an update overran rather than running them late, like flywheel's task.
+static void
+task(void * reckonerPointer)
+{
+    Reckoner * r = reckonerPointer;
+    unsigned long deadline = millis();
+    while (true)
+    {
+        reckonerUpdate(r);
+
+        unsigned long period = r->frameDelay;
+        if (period == 0) period = 1;
+        unsigned long now = millis();
+        if (now - deadline >= period)
+        {
+            unsigned long missed = (now - deadline) / period;
+            deadline += missed * period;
+            r->overruns += missed;
+            portalUpdateRef(r->portal, r->refs.overruns);
+        }
+        taskDelayUntil(&deadline, period);
+    }
+}
+
 static void
 updateReadings(Reckoner * r)
 {
     r->timeChange = timeUpdate(&r->microTime);
     r->readingLeft = r->encoderLeftGet(r->encoderLeft);
     r->readingRight = r->encoderRightGet(r->encoderRight);
+    r->state.microTime = r->microTime;
+
+    if (r->gyro != NULL)
+    {
+        r->gyroAngle = gyroGet(r->gyro) * TAU / 360.0f;
+        if (r->gyroReversed) r->gyroAngle = -r->gyroAngle;
+    }
 }
 static void
 updateWheels(Reckoner * r)
@@ -163,36 +299,90 @@ updateVelocity(Reckoner * r)
     r->state.velocity = 0.5f * (r->velocityLeft + r->velocityRight);
 }
 
+// From the wheel displacements, along the arc they describe, and the gyro
+// if there is one; the filtered velocity is only reported.
 static void
-updateHeading(Reckoner * r)
+updatePose(Reckoner * r)
 {
-    r->state.heading += (r->rightChange - r->leftChange) / r->wheelSeparation;
-    r->state.heading = fmodf(r->state.heading + PI, TAU) - PI;
+    OdometryPose pose =
+    {
+        .x = r->state.x,
+        .y = r->state.y,
+        .heading = r->state.heading
+    };
+    if (r->gyro != NULL)
+    {
+        odometryFuse(
+            &pose,
+            &r->gyroFusion,
+            r->leftChange,
+            r->rightChange,
+            r->wheelSeparation,
+            r->gyroAngle,
+            r->timeChange
+        );
+    }
+    else
+    {
+        odometryUpdate(&pose, r->leftChange, r->rightChange, r->wheelSeparation);
+    }
+    r->state.x = pose.x;
+    r->state.y = pose.y;
+    r->state.heading = pose.heading;
 }
 
 static void
-updatePosition(Reckoner * r)
+publish(Reckoner * r)
+{
+    OdometrySample sample =
+    {
+        .microTime = r->state.microTime,
+        .x = r->state.x,
+        .y = r->state.y,
+        .heading = r->state.heading,
+        .velocity = r->state.velocity
+    };
+
+    r->sequence++;
+    __sync_synchronize();
+    r->published = r->state;
+    odometryHistoryPush(&r->history, sample);
+    __sync_synchronize();
+    r->sequence++;
+}
+
+// Whether a read that started at sequence has to be taken again. An odd
+// sequence means publish() is mid-write, and a reader that preempted it
+// would spin forever at the reckoner's priority or above, so this blocks
+// for a tick to let it finish.
+static bool
+retry(Reckoner * r, unsigned long sequence)
 {
-    r->state.x += r->timeChange * r->state.velocity * cosf(r->state.heading);
-    r->state.y += r->timeChange * r->state.velocity * sinf(r->state.heading);
+    if (sequence & 1)
+    {
+        delay(1);
+        return true;
+    }
+    return sequence != r->sequence;
 }
 
 static void
 updatePortal(Reckoner * r)
 {
-    portalUpdate(r->portal, "time");
-    portalUpdate(r->portal, "left");
-    portalUpdate(r->portal, "right");
-    portalUpdate(r->portal, "left-change");
-    portalUpdate(r->portal, "right-change");
-    portalUpdate(r->portal, "velocity-left-raw");
-    portalUpdate(r->portal, "velocity-right-raw");
-    portalUpdate(r->portal, "velocity-left");
-    portalUpdate(r->portal, "velocity-right");
-    portalUpdate(r->portal, "velocity");
-    portalUpdate(r->portal, "heading");
-    portalUpdate(r->portal, "x");
-    portalUpdate(r->portal, "y");
+    portalUpdateRef(r->portal, r->refs.time);
+    portalUpdateRef(r->portal, r->refs.left);
+    portalUpdateRef(r->portal, r->refs.right);
+    portalUpdateRef(r->portal, r->refs.leftChange);
+    portalUpdateRef(r->portal, r->refs.rightChange);
+    portalUpdateRef(r->portal, r->refs.velocityLeftRaw);
+    portalUpdateRef(r->portal, r->refs.velocityRightRaw);
+    portalUpdateRef(r->portal, r->refs.velocityLeft);
+    portalUpdateRef(r->portal, r->refs.velocityRight);
+    portalUpdateRef(r->portal, r->refs.velocity);
+    portalUpdateRef(r->portal, r->refs.heading);
+    portalUpdateRef(r->portal, r->refs.x);
+    portalUpdateRef(r->portal, r->refs.y);
+    portalUpdateRef(r->portal, r->refs.gyro);
     portalFlush(r->portal);
 }
 
@@ -236,71 +426,122 @@ setupPortal(Reckoner * r, ReckonerSetup setup)
         {
             .key = "time",
             .handler = portalUlongHandler,
-            .handle = &r->microTime
+            .handle = &r->microTime,
+            .ref = &r->refs.time
         },
         {
             .key = "left",
             .handler = portalFloatHandler,
-            .handle = &r->left
+            .handle = &r->left,
+            .ref = &r->refs.left
         },
         {
             .key = "right",
             .handler = portalFloatHandler,
-            .handle = &r->right
+            .handle = &r->right,
+            .ref = &r->refs.right
         },
         {
             .key = "left-change",
             .handler = portalFloatHandler,
-            .handle = &r->leftChange
+            .handle = &r->leftChange,
+            .ref = &r->refs.leftChange
         },
         {
             .key = "right-change",
             .handler = portalFloatHandler,
-            .handle = &r->rightChange
+            .handle = &r->rightChange,
+            .ref = &r->refs.rightChange
         },
         {
             .key = "velocity-left-raw",
             .handler = portalFloatHandler,
-            .handle = &r->velocityLeftRaw
+            .handle = &r->velocityLeftRaw,
+            .ref = &r->refs.velocityLeftRaw
         },
         {
             .key = "velocity-right-raw",
             .handler = portalFloatHandler,
-            .handle = &r->velocityRightRaw
+            .handle = &r->velocityRightRaw,
+            .ref = &r->refs.velocityRightRaw
         },
         {
             .key = "velocity-left",
             .handler = portalFloatHandler,
-            .handle = &r->velocityLeft
+            .handle = &r->velocityLeft,
+            .ref = &r->refs.velocityLeft
         },
         {
             .key = "velocity-right",
             .handler = portalFloatHandler,
-            .handle = &r->velocityRight
+            .handle = &r->velocityRight,
+            .ref = &r->refs.velocityRight
         },
         {
             .key = "velocity",
             .handler = portalFloatHandler,
             .handle = &r->state.velocity,
-            .stream = true
+            .stream = true,
+            .ref = &r->refs.velocity
         },
         {
             .key = "heading",
             .handler = portalFloatHandler,
             .handle = &r->state.heading,
-            .stream = true
+            .stream = true,
+            .ref = &r->refs.heading
         },
         {
             .key = "x",
             .handler = portalFloatHandler,
             .handle = &r->state.x,
-            .stream = true
+            .stream = true,
+            .ref = &r->refs.x
         },
         {
             .key = "y",
             .handler = portalFloatHandler,
-            .handle = &r->state.x,
-            .stream = true
+            .handle = &r->state.y,
+            .stream = true,
+            .ref = &r->refs.y
+        },
+        {
+            .key = "gyro",
+            .handler = portalFloatHandler,
+            .handle = &r->gyroAngle,
+            .ref = &r->refs.gyro
+        },
+        {
+            .key = "gyro-bias",
+            .handler = portalFloatHandler,
+            .handle = &r->gyroFusion.bias
+        },
+        {
+            .key = "gyro-time-constant",
+            .handler = portalFloatHandler,
+            .handle = &r->gyroFusion.timeConstant
+        },
+        {
+            .key = "gyro-bias-rate",
+            .handler = portalFloatHandler,
+            .handle = &r->gyroFusion.biasRate
+        },
+        {
+            .key = "gyro-still-distance",
+            .handler = portalFloatHandler,
+            .handle = &r->gyroFusion.stillDistance
+        },
+        {
+            .key = "delay",
+            .handler = portalUlongHandler,
+            .handle = &r->frameDelay
+        },
+        {
+            .key = "overruns",
+            .handler = portalUlongHandler,
+            .handle = &r->overruns,
+            .onchange = true,
+            .ref = &r->refs.overruns
         },
         {
             .key = "keys",
@@ -2,6 +2,7 @@
 
 #include <API.h>
 #include <stdbool.h>
+#include <math.h>
 #include "utils.h"
 
 
@@ -74,6 +75,182 @@ encoderGetHandle(Encoder encoder)
     return shim;
 }
 
+// Edge times kept, so the period is timed over a whole quadrature cycle of
+// four edges and uneven spacing between the two channels averages out.
+#define EDGE_HISTORY 5
+
+// Encoder rpm over which the count takes over from the edge period. The
+// count is out by up to a tick a read, and the period by the interrupt's
+// latency over EDGE_HISTORY edges; at 20 ms reads they're even at around
+// 750 rpm, well above a flywheel encoder's.
+#define EDGE_BLEND_LOW 500.0f
+#define EDGE_BLEND_HIGH 1000.0f
+
+// Longer than this without an edge and the encoder is taken as stopped.
+#define EDGE_TIMEOUT 100000
+
+typedef struct
+EdgeEncoderShim
+{
+    unsigned char portTop;
+    unsigned char portBottom;
+    bool reversed;
+
+    // Written only from the interrupt handler. sequence is odd while it is
+    // part way through, so a reader can tell it saw a torn update.
+    volatile unsigned long sequence;
+    volatile int ticks;
+    volatile int direction;
+    volatile unsigned long edgeTimes[EDGE_HISTORY];
+    volatile unsigned int edgeCount;
+
+    // Used only by the getter
+    int lastTicks;
+    unsigned long microTime;
+    Mutex mutex;
+}
+EdgeEncoderShim;
+
+// Interrupt handlers only get the pin, so find the shim from it.
+static EdgeEncoderShim * edgeEncoderShims[13] = {NULL};
+
+static void
+edgeEncoderInterrupt(unsigned char pin)
+{
+    EdgeEncoderShim * shim = edgeEncoderShims[pin];
+    if (shim == NULL) return;
+
+    unsigned long now = micros();
+    bool top = digitalRead(shim->portTop);
+    bool bottom = digitalRead(shim->portBottom);
+
+    // Leading channel gives the direction
+    int direction = (top != bottom) == (pin == shim->portTop) ? 1 : -1;
+    if (shim->reversed) direction = -direction;
+
+    shim->sequence++;
+    if (direction != shim->direction)
+    {
+        // Old periods were the other way, so start timing again
+        shim->direction = direction;
+        shim->edgeCount = 0;
+    }
+    shim->ticks += direction;
+    shim->edgeTimes[shim->edgeCount % EDGE_HISTORY] = now;
+    shim->edgeCount++;
+    shim->sequence++;
+}
+
+EncoderReading
+edgeEncoderGetter(EncoderHandle handle)
+{
+    EdgeEncoderShim * shim = handle;
+
+    mutexTake(shim->mutex, -1);
+
+    // Copy out everything the interrupt handler writes, all from one edge
+    unsigned long sequence;
+    int ticks;
+    int direction;
+    unsigned int edgeCount;
+    unsigned long newest;
+    unsigned long oldest;
+    do
+    {
+        sequence = shim->sequence;
+        ticks = shim->ticks;
+        direction = shim->direction;
+        edgeCount = shim->edgeCount;
+        newest = shim->edgeTimes[(edgeCount + EDGE_HISTORY - 1) % EDGE_HISTORY];
+        oldest = shim->edgeTimes[edgeCount % EDGE_HISTORY];
+    }
+    while ((sequence & 1) || sequence != shim->sequence);
+
+    unsigned long now = micros();
+    float minutes = timeUpdate(&shim->microTime) / 60.0f;
+    int ticksChange = ticks - shim->lastTicks;
+    shim->lastTicks = ticks;
+
+    float countRpm = ticksChange / TICKS_PER_REV_ENCODER / minutes;
+
+    // Without enough edges to time, there's only the count
+    float periodRpm = 0.0f;
+    float blend = 1.0f;
+    unsigned long sinceEdge = now - newest;
+    if (edgeCount > EDGE_HISTORY && sinceEdge < EDGE_TIMEOUT)
+    {
+        float period = (newest - oldest) / (float)(EDGE_HISTORY - 1);
+
+        // No edge for longer than a period means it's slowing down, and is
+        // now at most one edge per however long it has been.
+        if (sinceEdge > period) period = sinceEdge;
+
+        periodRpm = direction * 60e6f / (period * TICKS_PER_REV_ENCODER);
+
+        float speed = fabsf(periodRpm);
+        blend = (speed - EDGE_BLEND_LOW) / (EDGE_BLEND_HIGH - EDGE_BLEND_LOW);
+        if (blend < 0.0f) blend = 0.0f;
+        if (blend > 1.0f) blend = 1.0f;
+    }
+
+    EncoderReading reading =
+    {
+        .revolutions = ((float)ticks) / TICKS_PER_REV_ENCODER,
+        .rpm = blend * countRpm + (1.0f - blend) * periodRpm
+    };
+
+    mutexGive(shim->mutex);
+
+    return reading;
+}
+
+void
+edgeEncoderResetter(EncoderHandle handle)
+{
+    EdgeEncoderShim * shim = handle;
+    mutexTake(shim->mutex, -1);
+    ioClearInterrupt(shim->portTop);
+    ioClearInterrupt(shim->portBottom);
+
+    // Same as the interrupt handler, so a read in between sees it's torn
+    shim->sequence++;
+    shim->ticks = 0;
+    shim->edgeCount = 0;
+    shim->sequence++;
+
+    // Rpm from the count is then over the time since the reset
+    shim->lastTicks = 0;
+    shim->microTime = micros();
+    ioSetInterrupt(shim->portTop, INTERRUPT_EDGE_BOTH, edgeEncoderInterrupt);
+    ioSetInterrupt(shim->portBottom, INTERRUPT_EDGE_BOTH, edgeEncoderInterrupt);
+    mutexGive(shim->mutex);
+}
+
+EncoderHandle
+edgeEncoderGetHandle(unsigned char portTop, unsigned char portBottom, bool reversed)
+{
+    EdgeEncoderShim * shim = malloc(sizeof(EdgeEncoderShim));
+    shim->portTop = portTop;
+    shim->portBottom = portBottom;
+    shim->reversed = reversed;
+    shim->sequence = 0;
+    shim->ticks = 0;
+    shim->direction = 1;
+    shim->edgeCount = 0;
+    shim->lastTicks = 0;
+    shim->microTime = micros();
+    shim->mutex = mutexCreate();
+
+    edgeEncoderShims[portTop] = shim;
+    edgeEncoderShims[portBottom] = shim;
+    pinMode(portTop, INPUT);
+    pinMode(portBottom, INPUT);
+    ioSetInterrupt(portTop, INTERRUPT_EDGE_BOTH, edgeEncoderInterrupt);
+    ioSetInterrupt(portBottom, INTERRUPT_EDGE_BOTH, edgeEncoderInterrupt);
+
+    return shim;
+}
+
 typedef struct
 ImeShim
 {
@@ -168,7 +345,6 @@ motorSetter(MotorHandle handle, int command)
 {
     MotorShim * shim = handle;
     mutexTake(shim->mutex, -1);
-    printf(" - reversed: %s\n", shim->reversed? "yes" : "no");
     if (shim->reversed) command *= -1;
     motorSet(shim->channel, command);
     mutexGive(shim->mutex);
@@ -117,3 +117,135 @@ stringAppend(char * dest, const char * src, size_t size)
     size_t sizeLeft = size - start;
     return stringCopy(dest + start, src, sizeLeft);
 }
+
+
+// Fast maths {{{
+
+// pi / 2 split in two, so that taking off multiples of it loses nothing
+#define HALF_PI_HIGH 1.5703125f
+#define HALF_PI_LOW 4.83826794897e-4f
+#define TWO_OVER_PI 0.636619772368f
+#define INVERSE_TAU 0.159154943092f
+
+// Takes off the nearest multiple of pi / 2, and returns which it was
+static int
+quadrant(float angle, float * remainder)
+{
+    float scaled = angle * TWO_OVER_PI;
+    int whole = (int)(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+    *remainder = (angle - whole * HALF_PI_HIGH) - whole * HALF_PI_LOW;
+    return whole & 3;
+}
+
+// Both within pi / 4 of zero, from the Cephes sinf and cosf polynomials
+static float
+sinPolynomial(float x)
+{
+    float z = x * x;
+    float y = -1.9515295891e-4f;
+    y = y * z + 8.3321608736e-3f;
+    y = y * z - 1.6666654611e-1f;
+    return y * z * x + x;
+}
+
+static float
+cosPolynomial(float x)
+{
+    float z = x * x;
+    float y = 2.443315711809948e-5f;
+    y = y * z - 1.388731625493765e-3f;
+    y = y * z + 4.166664568298827e-2f;
+    return y * z * z - 0.5f * z + 1.0f;
+}
+
+float
+fastWrap(float angle)
+{
+    float turns = (angle + PI) * INVERSE_TAU;
+    int whole = (int)turns;
+    if (turns < whole) whole--;
+    float wrapped = angle - whole * TAU;
+
+    // Rounding can leave it just outside
+    if (wrapped > PI) wrapped -= TAU;
+    else if (wrapped < -PI) wrapped += TAU;
+    return wrapped;
+}
+
+float
+fastSin(float angle)
+{
+    float x;
+    switch (quadrant(angle, &x))
+    {
+    case 0: return sinPolynomial(x);
+    case 1: return cosPolynomial(x);
+    case 2: return -sinPolynomial(x);
+    default: return -cosPolynomial(x);
+    }
+}
+
+float
+fastCos(float angle)
+{
+    float x;
+    switch (quadrant(angle, &x))
+    {
+    case 0: return cosPolynomial(x);
+    case 1: return -sinPolynomial(x);
+    case 2: return -cosPolynomial(x);
+    default: return sinPolynomial(x);
+    }
+}
+
+// Arctangent of the smaller over the larger, which is within 0 to 1, from
+// Abramowitz and Stegun 4.4.49, then moved into the right octant.
+float
+fastAtan2(float y, float x)
+{
+    float absX = x < 0.0f ? -x : x;
+    float absY = y < 0.0f ? -y : y;
+    if (absX == 0.0f && absY == 0.0f) return 0.0f;
+
+    bool steep = absY > absX;
+    float a = steep ? absX / absY : absY / absX;
+    float s = a * a;
+    float angle = 0.0208351f;
+    angle = angle * s - 0.0851330f;
+    angle = angle * s + 0.1801410f;
+    angle = angle * s - 0.3302995f;
+    angle = angle * s + 0.9998660f;
+    angle *= a;
+
+    if (steep) angle = 0.5f * PI - angle;
+    if (x < 0.0f) angle = PI - angle;
+    if (y < 0.0f) angle = -angle;
+    return angle;
+}
+
+// The bit trick guess, then two Newton steps
+float
+fastInvSqrt(float x)
+{
+    if (!(x > 0.0f)) return 0.0f;
+    union
+    {
+        float f;
+        unsigned int i;
+    }
+    bits = {x};
+    bits.i = 0x5f375a86 - (bits.i >> 1);
+    float y = bits.f;
+    float half = 0.5f * x;
+    y = y * (1.5f - half * y * y);
+    y = y * (1.5f - half * y * y);
+    return y;
+}
+
+float
+fastSqrt(float x)
+{
+    return x * fastInvSqrt(x);
+}
+
+// }}}
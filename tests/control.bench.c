@@ -0,0 +1,218 @@
+#include "control.h"
+#include <stdio.h>
+#include <stdbool.h>
+
+//
+// Runs the flywheel controllers against a simulated flywheel, timing the
+// spin up from rest to ready and the recovery to ready after a shot.
+//
+// The flywheel speeds up in proportion to how far the command is above the
+// command it would settle at, which is fwAboveEstimator's model plus 8% so
+// the controllers never get a perfect feedforward. The control loop runs
+// every 60 ms through the same low-pass filter as flywheel.c, and counts as
+// ready once error and derivative stay within flywheel's thresholds.
+//
+// Run with `make bench`.
+//
+
+#define TARGET 2000.0f
+#define FRAME 0.06f
+#define STEP 0.001f
+#define SMOOTHING 0.5f
+#define ACCELERATION 15.0f
+#define MISMATCH 1.08f
+#define SHOT 0.15f
+#define THRESHOLD_ERROR 10.0f
+#define THRESHOLD_DERIVATIVE 100.0f
+#define READY_HOLD 0.5f
+#define TIMEOUT 20.0f
+
+typedef struct
+Flywheel
+{
+    float rpm;
+    float time;
+    ControlSystem system;
+}
+Flywheel;
+
+typedef struct
+Result
+{
+    float readyTime;
+    float peak;
+}
+Result;
+
+static float
+estimator(float target)
+{
+    return 18.195f + 2.2052e-5f * target * target;
+}
+
+static float
+settledCommand(float rpm)
+{
+    return MISMATCH * estimator(rpm);
+}
+
+static void
+step(Flywheel * flywheel, ControlUpdater update, ControlHandle control)
+{
+    // Plant, between control frames
+    float sum = 0.0f;
+    int steps = (int)(FRAME / STEP + 0.5f);
+    for (int i = 0; i < steps; i++)
+    {
+        float command = flywheel->system.action;
+        flywheel->rpm += (command - settledCommand(flywheel->rpm)) * ACCELERATION * STEP;
+        if (flywheel->rpm < 0.0f) flywheel->rpm = 0.0f;
+        sum += flywheel->rpm;
+    }
+    flywheel->time += FRAME;
+
+    // Same filter as flywheel.c:updateSystem
+    ControlSystem * system = &flywheel->system;
+    float dt = FRAME;
+    float rpm = sum / steps;
+    float measureChange = (rpm - system->measured) * dt / SMOOTHING;
+    float derivative = measureChange / dt;
+    float derivativeChange = (derivative - system->derivative) * dt / SMOOTHING;
+    system->dt = dt;
+    system->measured += measureChange;
+    system->derivative += derivativeChange;
+    system->error = system->measured - system->target;
+
+    update(control, system);
+    if (system->action > 127) system->action = 127;
+    if (system->action < -127) system->action = -127;
+}
+
+static bool
+isReady(ControlSystem * system)
+{
+    return -THRESHOLD_ERROR < system->error && system->error < THRESHOLD_ERROR &&
+        -THRESHOLD_DERIVATIVE < system->derivative &&
+        system->derivative < THRESHOLD_DERIVATIVE;
+}
+
+// Runs until ready has held for READY_HOLD, and returns how long it took
+// to first become ready for good, and the highest speed on the way.
+static Result
+runUntilReady(Flywheel * flywheel, ControlUpdater update, ControlHandle control)
+{
+    Result result = {.readyTime = -1.0f, .peak = 0.0f};
+    float start = flywheel->time;
+    float readySince = -1.0f;
+    while (flywheel->time - start < TIMEOUT)
+    {
+        step(flywheel, update, control);
+        if (flywheel->rpm > result.peak) result.peak = flywheel->rpm;
+        if (!isReady(&flywheel->system))
+        {
+            readySince = -1.0f;
+            continue;
+        }
+        if (readySince < 0.0f) readySince = flywheel->time;
+        if (flywheel->time - readySince >= READY_HOLD)
+        {
+            result.readyTime = readySince - start;
+            break;
+        }
+    }
+    return result;
+}
+
+static void
+run(const char * name, ControlUpdater update, ControlResetter reset, ControlHandle control)
+{
+    Flywheel flywheel = {0};
+    reset(control);
+    flywheel.system.target = TARGET;
+    flywheel.system.error = -TARGET;
+
+    Result spinUp = runUntilReady(&flywheel, update, control);
+
+    flywheel.rpm *= 1.0f - SHOT;
+    Result recovery = runUntilReady(&flywheel, update, control);
+
+    printf(
+        "%-8s spin up %6.2f s  overshoot %6.1f rpm  shot recovery %6.2f s\n",
+        name,
+        spinUp.readyTime,
+        spinUp.peak - TARGET,
+        recovery.readyTime
+    );
+}
+
+int main()
+{
+    printf(
+        "# control: %.0f rpm, %.0f ms frames, plant %.0f%% off the estimator, %.0f%% shots\n",
+        TARGET,
+        FRAME * 1000.0f,
+        (MISMATCH - 1.0f) * 100.0f,
+        SHOT * 100.0f
+    );
+
+    ControlHandle tbh = tbhInit(
+        (TbhConfig)
+        {
+            .gain = 0.1,
+            .slewPositive = 100.0f,
+            .slewNegative = 10.0f,
+            .estimator = estimator
+        }
+    );
+    run("tbh", tbhUpdate, tbhReset, tbh);
+
+    ControlHandle twoDof = twoDofInit(
+        (TwoDofConfig)
+        {
+            .gainP = 0.1f,
+            .gainI = 0.05f,
+            .gainD = 0.05f,
+            .integralMax = 200.0f,
+            .actionMax = 127.0f,
+            .tracking = 5.0f,
+            .estimator = estimator
+        }
+    );
+    run("two-dof", twoDofUpdate, twoDofReset, twoDof);
+
+    return 0;
+}
+
+// Mock functions
+
+void
+portalUpdateRef(Portal * portal, PortalEntryRef ref)
+{
+}
+
+PortalEntryRef
+portalAddBatch(Portal * portal, PortalEntrySetup * setups)
+{
+    return PORTAL_ENTRY_NONE;
+}
+
+void
+portalFloatHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+portalBoolHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+fixedHandler(void * handle, char * message, char * response)
+{
+}
+
+int
+signOf(int x)
+{
+    return (x > 0) - (x < 0);
+}
@@ -0,0 +1,167 @@
+#include "fixed.h"
+#include "control.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+//
+// Times the flywheel's low-pass filter, PID and TBH in float and in Q16.16
+// fixed point, per control step.
+//
+// The host has a hardware FPU, so this only shows that the fixed paths cost
+// no more than a few integer operations; the gap that matters, against the
+// Cortex-M3's software floats, has to be measured on the robot.
+//
+// Run with `make bench`.
+//
+
+#define ITERATIONS 2000000
+#define SMOOTHING 0.5f
+
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static volatile float sink;
+static volatile Fixed fixedSink;
+
+static float
+estimator(float target)
+{
+    return 18.195f + 2.2052e-5f * target * target;
+}
+
+static void
+report(const char * name, double seconds)
+{
+    printf("%-16s %8.2f ns/step\n", name, seconds / ITERATIONS * 1e9);
+}
+
+static void
+timeFixedController(const char * name, FixedUpdater update, ControlHandle control)
+{
+    FixedSystem system;
+    memset(&system, 0, sizeof(FixedSystem));
+    system.dt = fixedFromMicros(60000);
+    system.target = FIXED_FROM_INT(2000);
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        system.measured = FIXED_FROM_INT(1990 + (i & 15));
+        system.error = system.measured - system.target;
+        update(control, &system);
+        fixedSink += system.action;
+    }
+    report(name, now() - start);
+}
+
+static void
+timeController(const char * name, ControlUpdater update, ControlHandle control)
+{
+    ControlSystem system;
+    memset(&system, 0, sizeof(ControlSystem));
+    system.dt = 0.06f;
+    system.target = 2000.0f;
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        system.measured = 1990.0f + (i & 15);
+        system.error = system.measured - system.target;
+        update(control, &system);
+        sink += system.action;
+    }
+    report(name, now() - start);
+}
+
+int main()
+{
+    printf("# fixed: float vs Q16.16 per step, %d iterations\n", ITERATIONS);
+
+    ControlSystem system;
+    memset(&system, 0, sizeof(ControlSystem));
+    system.dt = 0.06f;
+    double start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        float rpm = 1990.0f + (i & 15);
+        float measureChange = (rpm - system.measured) * system.dt / SMOOTHING;
+        float derivative = measureChange / system.dt;
+        float derivativeChange = (derivative - system.derivative) * system.dt / SMOOTHING;
+        system.measured += measureChange;
+        system.derivative += derivativeChange;
+        sink += system.measured;
+    }
+    report("filter float", now() - start);
+
+    FixedSystem fixed;
+    memset(&fixed, 0, sizeof(FixedSystem));
+    fixed.dt = fixedFromMicros(60000);
+    Fixed smoothingReciprocal = fixedFromFloat(1.0f / SMOOTHING);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        fixedLowPass(&fixed, FIXED_FROM_INT(1990 + (i & 15)), smoothingReciprocal);
+        fixedSink += fixed.measured;
+    }
+    report("filter fixed", now() - start);
+
+    timeController("pid float", pidUpdate, pidInit(-0.2f, -0.01f, -0.01f));
+    timeFixedController("pid fixed", pidFixedUpdate, pidFixedInit(-0.2f, -0.01f, -0.01f));
+
+    TbhConfig config =
+    {
+        .gain = 0.1f,
+        .slewPositive = 100.0f,
+        .slewNegative = 10.0f,
+        .estimator = estimator
+    };
+    timeController("tbh float", tbhUpdate, tbhInit(config));
+    timeFixedController("tbh fixed", tbhFixedUpdate, tbhFixedInit(config));
+
+    return 0;
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return 0;
+}
+
+bool
+stringToFloat(const char * string, float * dest)
+{
+    return false;
+}
+
+int
+signOf(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+void
+portalUpdateRef(Portal * portal, PortalEntryRef ref)
+{
+}
+
+PortalEntryRef
+portalAddBatch(Portal * portal, PortalEntrySetup * setups)
+{
+    return PORTAL_ENTRY_NONE;
+}
+
+void
+portalFloatHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+portalBoolHandler(void * handle, char * message, char * response)
+{
+}
@@ -0,0 +1,291 @@
+#include "tap.h"
+#include "fixed.h"
+#include "control.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// forward
+
+void test_fixedFromMicros();
+void test_fixedFormat();
+void test_fixedHandler();
+void test_fixedLowPass();
+void test_pidFixedUpdate();
+void test_pidFixedIntegral();
+void test_tbhFixedUpdate();
+
+//
+
+int main()
+{
+    plan(11);
+
+    test_fixedFromMicros();
+    test_fixedFormat();
+    test_fixedHandler();
+    test_fixedLowPass();
+    test_pidFixedUpdate();
+    test_pidFixedIntegral();
+    test_tbhFixedUpdate();
+
+    done_testing();
+}
+
+// Helpers
+
+#define FRAME 0.06f
+#define FRAMES 400
+
+// The flywheel's float filter, as in flywheel.c
+static void
+floatLowPass(ControlSystem * system, float rpm, float smoothing)
+{
+    float measureChange = (rpm - system->measured) * system->dt / smoothing;
+    float derivative = measureChange / system->dt;
+    float derivativeChange = (derivative - system->derivative) * system->dt / smoothing;
+    system->measured += measureChange;
+    system->derivative += derivativeChange;
+}
+
+static float
+estimator(float target)
+{
+    return 18.195f + 2.2052e-5f * target * target;
+}
+
+// Runs a controller on a simple flywheel, and records the actions
+static void
+runLoop(ControlUpdater update, ControlHandle control, float * actions)
+{
+    ControlSystem system;
+    memset(&system, 0, sizeof(ControlSystem));
+    system.dt = FRAME;
+    system.target = 2000.0f;
+    float rpm = 0.0f;
+    for (int i = 0; i < FRAMES; i++)
+    {
+        rpm += (system.action - estimator(rpm)) * 15.0f * FRAME;
+        floatLowPass(&system, rpm, 0.5f);
+        system.error = system.measured - system.target;
+        update(control, &system);
+        if (system.action > 127) system.action = 127;
+        if (system.action < -127) system.action = -127;
+        actions[i] = system.action;
+    }
+}
+
+// The same, with the controller in Fixed from the reading to the action,
+// as the flywheel runs it in CONTROL_FIXED builds
+static void
+runFixedLoop(FixedUpdater update, ControlHandle control, float * actions)
+{
+    FixedSystem system;
+    memset(&system, 0, sizeof(FixedSystem));
+    system.dt = fixedFromMicros(60000);
+    system.target = FIXED_FROM_INT(2000);
+    Fixed smoothingReciprocal = fixedFromFloat(1.0f / 0.5f);
+    float rpm = 0.0f;
+    for (int i = 0; i < FRAMES; i++)
+    {
+        float action = fixedToFloat(system.action);
+        rpm += (action - estimator(rpm)) * 15.0f * FRAME;
+        fixedLowPass(&system, fixedFromFloat(rpm), smoothingReciprocal);
+        system.error = system.measured - system.target;
+        update(control, &system);
+        if (system.action > FIXED_FROM_INT(127)) system.action = FIXED_FROM_INT(127);
+        if (system.action < FIXED_FROM_INT(-127)) system.action = FIXED_FROM_INT(-127);
+        actions[i] = fixedToFloat(system.action);
+    }
+}
+
+static float
+largestDifference(const float * a, const float * b, int count)
+{
+    float largest = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        float difference = fabsf(a[i] - b[i]);
+        if (difference > largest) largest = difference;
+    }
+    return largest;
+}
+
+// Subtests
+
+void
+test_fixedFromMicros()
+{
+    // 1 test
+
+    ok(
+        fabsf(fixedToFloat(fixedFromMicros(60000)) - 0.06f) < 1e-4f,
+        "fixedFromMicros should give seconds"
+    );
+}
+
+void
+test_fixedFormat()
+{
+    // 2 tests
+
+    char text[32];
+    fixedFormat(fixedFromFloat(2400.25f), text);
+    is(text, "2400.2500", "fixedFormat should give four decimal places");
+    fixedFormat(fixedFromFloat(-1.99999f), text);
+    is(text, "-2.0000", "fixedFormat should round negatives to the nearest place");
+}
+
+void
+test_fixedHandler()
+{
+    // 3 tests
+
+    Fixed value = 0;
+    char message[] = "12.5";
+    char response[32] = {0};
+    fixedHandler(&value, message, response);
+    char read[] = "";
+    fixedHandler(&value, read, response);
+    is(response, "12.5000", "fixedHandler should set and read engineering units");
+
+    // A gain far too large for Q16.16, either way
+    char large[] = "40000";
+    fixedHandler(&value, large, response);
+    ok(value == INT32_MAX, "fixedHandler, given too large a value, should saturate");
+    char small[] = "-40000";
+    fixedHandler(&value, small, response);
+    ok(value == INT32_MIN, "fixedHandler, given too small a value, should saturate");
+}
+
+void
+test_fixedLowPass()
+{
+    // 2 tests
+
+    ControlSystem reference;
+    memset(&reference, 0, sizeof(ControlSystem));
+    reference.dt = FRAME;
+    FixedSystem fixed;
+    memset(&fixed, 0, sizeof(FixedSystem));
+    fixed.dt = fixedFromMicros(60000);
+    Fixed smoothingReciprocal = fixedFromFloat(1.0f / 0.5f);
+
+    float measuredError = 0.0f;
+    float derivativeError = 0.0f;
+    for (int i = 0; i < FRAMES; i++)
+    {
+        // Spin up, then a shot, with a bit of encoder noise
+        float rpm = i < 200 ? 2000.0f : 1760.0f;
+        rpm += (rand() % 21) - 10;
+        floatLowPass(&reference, rpm, 0.5f);
+        fixedLowPass(&fixed, fixedFromFloat(rpm), smoothingReciprocal);
+
+        float measured = fabsf(fixedToFloat(fixed.measured) - reference.measured);
+        float derivative = fabsf(fixedToFloat(fixed.derivative) - reference.derivative);
+        if (measured > measuredError) measuredError = measured;
+        if (derivative > derivativeError) derivativeError = derivative;
+    }
+    ok(measuredError < 0.5f, "fixedLowPass speed should be within 0.5 rpm of float");
+    ok(derivativeError < 2.0f, "fixedLowPass derivative should be within 2 rpm/s of float");
+}
+
+void
+test_pidFixedUpdate()
+{
+    // 1 test
+
+    float reference[FRAMES];
+    float fixed[FRAMES];
+    runLoop(pidUpdate, pidInit(-0.2f, 0.0f, 0.0f), reference);
+    runFixedLoop(pidFixedUpdate, pidFixedInit(-0.2f, 0.0f, 0.0f), fixed);
+    ok(
+        largestDifference(reference, fixed, FRAMES) < 0.05f,
+        "pidFixedUpdate should stay within 0.05 of pidUpdate's action"
+    );
+}
+
+void
+test_pidFixedIntegral()
+{
+    // 1 test
+
+    // A stalled flywheel, 3000 rpm short for a minute, integrates past
+    // what Q16.16 holds
+    ControlHandle pid = pidFixedInit(0.0f, 0.001f, 0.0f);
+    FixedSystem system;
+    memset(&system, 0, sizeof(FixedSystem));
+    system.dt = fixedFromMicros(60000);
+    system.error = FIXED_FROM_INT(3000);
+    for (int i = 0; i < 1000; i++) pidFixedUpdate(pid, &system);
+    ok(
+        system.action > 0,
+        "pidFixedUpdate, given a long held error, should saturate the integral"
+    );
+    if (system.action <= 0) diag("(got) %f", fixedToFloat(system.action));
+}
+
+void
+test_tbhFixedUpdate()
+{
+    // 1 test
+
+    TbhConfig config =
+    {
+        .gain = 0.1f,
+        .slewPositive = 100.0f,
+        .slewNegative = 10.0f,
+        .estimator = estimator
+    };
+    float reference[FRAMES];
+    float fixed[FRAMES];
+    runLoop(tbhUpdate, tbhInit(config), reference);
+    runFixedLoop(tbhFixedUpdate, tbhFixedInit(config), fixed);
+    ok(
+        largestDifference(reference, fixed, FRAMES) < 0.5f,
+        "tbhFixedUpdate should stay within 0.5 of tbhUpdate's action"
+    );
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return 0;
+}
+
+bool
+stringToFloat(const char * string, float * dest)
+{
+    char * end;
+    *dest = strtof(string, &end);
+    return end != string;
+}
+
+int
+signOf(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+void
+portalUpdateRef(Portal * portal, PortalEntryRef ref)
+{
+}
+
+PortalEntryRef
+portalAddBatch(Portal * portal, PortalEntrySetup * setups)
+{
+    return PORTAL_ENTRY_NONE;
+}
+
+void
+portalFloatHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+portalBoolHandler(void * handle, char * message, char * response)
+{
+}
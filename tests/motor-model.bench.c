@@ -0,0 +1,370 @@
+#include "motor-model.h"
+#include "control.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+//
+// Flywheel plant simulator, driving the real ControlUpdaters.
+//
+// Two 393 motors on speed gearing, through the motor model, spin a
+// flywheel geared up 15:1 against drag that grows with the square of its
+// speed. The control loop runs every 60 ms, measuring through the same
+// low-pass filter as flywheel.c. A ball takes a fixed fraction of the
+// flywheel's speed as it goes through.
+//
+// For each scenario and controller it reports the 10-90% rise time, the
+// overshoot, the time to settle within 2% of the target, the mean time to
+// get back within 2% after each ball, and the energy the motors drew.
+// A dash means it never got there.
+//
+// Run with `make bench`.
+//
+
+#define FRAME 0.06f
+#define STEP 0.0005f
+#define SMOOTHING 0.5f
+
+#define MOTORS 2
+#define RATIO 15.0f
+#define INERTIA 0.001f
+#define TORQUE_PER_AMP (1.04f / 4.8f)
+#define BATTERY_NOMINAL 7.6f
+
+// Drag is set so that this command holds this speed on a full battery
+#define DRAG_COMMAND 80
+#define DRAG_RPM 2000.0f
+
+#define BAND 0.02f
+#define BALL 0.12f
+#define FIRST_BALL 10.0f
+#define ESTIMATOR_POINTS 31
+#define ESTIMATOR_SPACING 100.0f
+
+typedef struct
+Scenario
+{
+    const char * name;
+    float target;
+    float battery;
+    int balls;
+    float ballInterval;
+}
+Scenario;
+
+typedef struct
+Controller
+{
+    const char * name;
+    ControlUpdater update;
+    ControlResetter reset;
+    ControlHandle handle;
+}
+Controller;
+
+typedef struct
+Result
+{
+    float rise;
+    float overshoot;
+    float settle;
+    float recovery;
+    float energy;
+}
+Result;
+
+static const MotorModelSetup motorSetup =
+{
+    .backEmfPerRpm = 7.2f * (1.0f - 0.37f / 4.8f) / 160.0f,
+    .resistance = 7.2f / 4.8f,
+    .inductance = 0.0005f,
+    .smoothing = 0.1f,
+    .rpmFree = 160.0f,
+    .channel = 1
+};
+
+static float drag = 0.0f;
+static float estimatorTable[ESTIMATOR_POINTS];
+
+// Torque the motors put on the flywheel, in N m
+static float
+motorTorque(MotorModel * motor, int command, float rpm, float battery)
+{
+    float current = motorModelUpdate(motor, command, rpm / RATIO, battery, STEP);
+    return MOTORS * TORQUE_PER_AMP * current / RATIO;
+}
+
+// Net torque on the flywheel for a command held at a steady speed
+static float
+steadyTorque(int command, float rpm, float battery)
+{
+    MotorModel motor;
+    motorModelInit(&motor, motorSetup);
+    return motorTorque(&motor, command, rpm, battery) - drag * rpm * rpm;
+}
+
+// Command at which the flywheel would hold this speed, on a full battery
+static float
+steadyCommand(float rpm)
+{
+    int low = 0;
+    int high = 127;
+    while (high - low > 1)
+    {
+        int middle = (low + high) / 2;
+        if (steadyTorque(middle, rpm, BATTERY_NOMINAL) > 0.0f) high = middle;
+        else low = middle;
+    }
+    // Between the two, where the torque crosses zero
+    float below = steadyTorque(low, rpm, BATTERY_NOMINAL);
+    float above = steadyTorque(high, rpm, BATTERY_NOMINAL);
+    if (above == below) return high;
+    return low - below / (above - below);
+}
+
+static void
+calibrate()
+{
+    drag = 0.0f;
+    drag = steadyTorque(DRAG_COMMAND, DRAG_RPM, BATTERY_NOMINAL) / (DRAG_RPM * DRAG_RPM);
+    for (int i = 0; i < ESTIMATOR_POINTS; i++)
+    {
+        estimatorTable[i] = steadyCommand(i * ESTIMATOR_SPACING);
+    }
+}
+
+// A perfectly fitted curve, as if learned on a full battery
+static float
+estimator(float target)
+{
+    float position = target / ESTIMATOR_SPACING;
+    if (position < 0.0f) position = 0.0f;
+    if (position > ESTIMATOR_POINTS - 1) position = ESTIMATOR_POINTS - 1;
+    int point = (int)position;
+    if (point > ESTIMATOR_POINTS - 2) point = ESTIMATOR_POINTS - 2;
+    float fraction = position - point;
+    return estimatorTable[point] * (1.0f - fraction) + estimatorTable[point + 1] * fraction;
+}
+
+static Result
+simulate(Scenario * scenario, Controller * controller)
+{
+    Result result = {-1.0f, 0.0f, -1.0f, -1.0f, 0.0f};
+    float duration = FIRST_BALL + scenario->balls * scenario->ballInterval + 4.0f;
+    float target = scenario->target;
+
+    MotorModel motor;
+    motorModelInit(&motor, motorSetup);
+    ControlSystem system;
+    memset(&system, 0, sizeof(ControlSystem));
+    system.target = target;
+    system.error = -target;
+    controller->reset(controller->handle);
+
+    float rpm = 0.0f;
+    float time = 0.0f;
+    float nextFrame = 0.0f;
+    float tenPercent = -1.0f;
+    float lastOutside = 0.0f;
+
+    int ball = 0;
+    float nextBall = FIRST_BALL;
+    float shotTime = 0.0f;
+    bool recovered = true;
+    int recoveries = 0;
+    float recoveryTotal = 0.0f;
+
+    while (time < duration)
+    {
+        if (time >= nextFrame)
+        {
+            float measureChange = (rpm - system.measured) * FRAME / SMOOTHING;
+            float derivative = measureChange / FRAME;
+            system.dt = FRAME;
+            system.measured += measureChange;
+            system.derivative += (derivative - system.derivative) * FRAME / SMOOTHING;
+            system.error = system.measured - target;
+            controller->update(controller->handle, &system);
+            if (system.action > 127) system.action = 127;
+            if (system.action < -127) system.action = -127;
+            nextFrame += FRAME;
+        }
+
+        if (ball < scenario->balls && time >= nextBall)
+        {
+            // Whatever it did before the first ball was its spin up
+            if (ball == 0 && fabsf(rpm - target) < BAND * target)
+            {
+                result.settle = lastOutside;
+            }
+            rpm *= 1.0f - BALL;
+            shotTime = time;
+            recovered = false;
+            ball++;
+            nextBall += scenario->ballInterval;
+        }
+
+        int command = (int)system.action;
+        float torque = motorTorque(&motor, command, rpm, scenario->battery);
+        torque -= drag * rpm * fabsf(rpm);
+        rpm += torque / INERTIA * STEP * 60.0f / TAU;
+        if (rpm < 0.0f) rpm = 0.0f;
+
+        // Only draws from the battery while the pulse is on
+        float drawn = motor.currentSteadyStateOn * motor.dutyOn;
+        result.energy += MOTORS * scenario->battery * fabsf(drawn) * STEP;
+        time += STEP;
+
+        bool inBand = fabsf(rpm - target) < BAND * target;
+        if (tenPercent < 0.0f && rpm >= 0.1f * target) tenPercent = time;
+        if (result.rise < 0.0f && rpm >= 0.9f * target) result.rise = time - tenPercent;
+        if (ball == 0 && rpm - target > result.overshoot) result.overshoot = rpm - target;
+        if (!inBand) lastOutside = time;
+        if (inBand && !recovered)
+        {
+            recovered = true;
+            recoveries++;
+            recoveryTotal += time - shotTime;
+        }
+    }
+
+    if (scenario->balls == 0 && fabsf(rpm - target) < BAND * target)
+    {
+        result.settle = lastOutside;
+    }
+    if (scenario->balls > 0 && recoveries == scenario->balls)
+    {
+        result.recovery = recoveryTotal / recoveries;
+    }
+    return result;
+}
+
+static void
+printTime(float seconds)
+{
+    if (seconds < 0.0f) printf("  %8s", "-");
+    else printf("  %7.2fs", seconds);
+}
+
+int main()
+{
+    calibrate();
+
+    Scenario scenarios[] =
+    {
+        {"spin up 2000", 2000.0f, BATTERY_NOMINAL, 0, 0.0f},
+        {"spin up 2400", 2400.0f, BATTERY_NOMINAL, 0, 0.0f},
+        {"rapid fire", 2000.0f, BATTERY_NOMINAL, 4, 1.0f},
+        {"slow fire", 2000.0f, BATTERY_NOMINAL, 3, 3.0f},
+        {"low battery", 2000.0f, 7.0f, 3, 3.0f}
+    };
+
+    Controller controllers[] =
+    {
+        {
+            "bang-bang",
+            bangBangUpdate,
+            bangBangReset,
+            bangBangInit(127.0f, 0.0f, 0.0f, 0.0f)
+        },
+        {
+            // pidUpdate takes error as measured - target, so negative gains.
+            // P alone stops short of the target; the integral makes up the
+            // rest without winding up past it.
+            "pid",
+            pidUpdate,
+            pidReset,
+            pidInit(-0.2f, -0.02f, 0.0f)
+        },
+        {
+            "tbh",
+            tbhUpdate,
+            tbhReset,
+            tbhInit(
+                (TbhConfig)
+                {
+                    .gain = 0.1,
+                    .slewPositive = 100.0f,
+                    .slewNegative = 10.0f,
+                    .estimator = estimator
+                }
+            )
+        },
+        {
+            "two-dof",
+            twoDofUpdate,
+            twoDofReset,
+            twoDofInit(
+                (TwoDofConfig)
+                {
+                    .gainP = 0.1f,
+                    .gainI = 0.05f,
+                    .gainD = 0.05f,
+                    .integralMax = 200.0f,
+                    .actionMax = 127.0f,
+                    .tracking = 5.0f,
+                    .estimator = estimator
+                }
+            )
+        }
+    };
+
+    int scenarioCount = sizeof(scenarios) / sizeof(Scenario);
+    int controllerCount = sizeof(controllers) / sizeof(Controller);
+
+    printf("# motor-model: flywheel simulator, %.0f ms frames, %.0f%% balls\n", FRAME * 1000.0f, BALL * 100.0f);
+    printf(
+        "%-14s %-10s %9s %10s %9s %9s %9s\n",
+        "scenario", "control", "rise", "overshoot", "settle", "recovery", "energy"
+    );
+    for (int i = 0; i < scenarioCount; i++)
+    {
+        for (int j = 0; j < controllerCount; j++)
+        {
+            Result result = simulate(&scenarios[i], &controllers[j]);
+            printf("%-14s %-10s", scenarios[i].name, controllers[j].name);
+            printTime(result.rise);
+            printf(" %7.0frpm", result.overshoot);
+            printTime(result.settle);
+            if (scenarios[i].balls == 0) printf("  %8s", "");
+            else printTime(result.recovery);
+            printf(" %7.0fJ\n", result.energy);
+        }
+    }
+    return 0;
+}
+
+// Mock functions
+
+void
+portalUpdateRef(Portal * portal, PortalEntryRef ref)
+{
+}
+
+PortalEntryRef
+portalAddBatch(Portal * portal, PortalEntrySetup * setups)
+{
+    return PORTAL_ENTRY_NONE;
+}
+
+void
+portalFloatHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+portalBoolHandler(void * handle, char * message, char * response)
+{
+}
+
+void
+fixedHandler(void * handle, char * message, char * response)
+{
+}
+
+int
+signOf(int x)
+{
+    return (x > 0) - (x < 0);
+}
@@ -0,0 +1,359 @@
+#include "tap.h"
+#include "odometry.h"
+#include "utils.h"
+#include <math.h>
+
+// forward
+
+void test_odometryStraight();
+void test_odometryCircle();
+void test_odometryRate();
+void test_odometryWrap();
+void test_odometryFuse();
+void test_odometryHistoryAt();
+void test_odometryHistoryEnds();
+
+//
+
+int main()
+{
+    plan(17);
+
+    test_odometryStraight();
+    test_odometryCircle();
+    test_odometryRate();
+    test_odometryWrap();
+    test_odometryFuse();
+    test_odometryHistoryAt();
+    test_odometryHistoryEnds();
+
+    done_testing();
+}
+
+// Helpers
+
+#define SEPARATION 14.0f
+#define DURATION 8.0f
+#define TRUTH_STEP 0.0001f
+
+// A drive around the field, in inches per second: accelerating into a
+// left turn, swerving back to the right, then slowing down.
+static void
+wheelSpeeds(float time, float * left, float * right)
+{
+    float speed = time < 2.0f ? 20.0f * time : 40.0f - 2.0f * (time - 2.0f);
+    float turn = 0.6f * sinf(0.9f * time);
+    *left = speed * (1.0f - turn);
+    *right = speed * (1.0f + turn);
+}
+
+// How far each side rolls from time to time + period
+static void
+wheelChanges(float time, float period, float * leftChange, float * rightChange)
+{
+    *leftChange = 0.0f;
+    *rightChange = 0.0f;
+    int steps = (int)(period / TRUTH_STEP + 0.5f);
+    for (int i = 0; i < steps; i++)
+    {
+        float left, right;
+        wheelSpeeds(time + (i + 0.5f) * TRUTH_STEP, &left, &right);
+        *leftChange += left * TRUTH_STEP;
+        *rightChange += right * TRUTH_STEP;
+    }
+}
+
+static OdometryPose
+truePose()
+{
+    OdometryPose pose = {0.0f, 0.0f, 0.0f};
+    int steps = (int)(DURATION / TRUTH_STEP + 0.5f);
+    for (int i = 0; i < steps; i++)
+    {
+        float left, right;
+        wheelSpeeds((i + 0.5f) * TRUTH_STEP, &left, &right);
+        odometryUpdate(&pose, left * TRUTH_STEP, right * TRUTH_STEP, SEPARATION);
+    }
+    return pose;
+}
+
+// Integrates at the given period, either along the arcs or the way the
+// reckoner used to: speed times time along the heading after turning.
+static OdometryPose
+integratedPose(float period, bool arcs)
+{
+    OdometryPose pose = {0.0f, 0.0f, 0.0f};
+    int frames = (int)(DURATION / period + 0.5f);
+    for (int i = 0; i < frames; i++)
+    {
+        float leftChange, rightChange;
+        wheelChanges(i * period, period, &leftChange, &rightChange);
+        if (arcs)
+        {
+            odometryUpdate(&pose, leftChange, rightChange, SEPARATION);
+            continue;
+        }
+        float left, right;
+        wheelSpeeds((i + 1) * period, &left, &right);
+        float velocity = 0.5f * (left + right);
+        pose.heading += (rightChange - leftChange) / SEPARATION;
+        pose.x += period * velocity * cosf(pose.heading);
+        pose.y += period * velocity * sinf(pose.heading);
+    }
+    return pose;
+}
+
+static float
+poseError(OdometryPose a, OdometryPose b)
+{
+    return hypotf(a.x - b.x, a.y - b.y);
+}
+
+#define STILL 3.0f
+#define SCRUB 0.1f
+#define GYRO_BIAS 0.01f
+#define FUSE_PERIOD 0.02f
+#define FUSE_DURATION (STILL + DURATION)
+
+typedef struct
+FuseResult
+{
+    OdometryPose truth;
+    OdometryPose wheels;
+    OdometryPose fused;
+    float bias;
+}
+FuseResult;
+
+// Sits still, then drives the same path as wheelSpeeds. The wheels scrub
+// through turns, reading a tenth more turn than there was, and the left
+// one spins out for half a second. The gyro drifts and reads in whole
+// degrees, like gyroGet.
+static FuseResult
+fuseDrive()
+{
+    FuseResult result;
+    OdometryPose start = {0.0f, 0.0f, 0.0f};
+    result.truth = start;
+    result.wheels = start;
+    result.fused = start;
+    OdometryGyro gyro =
+    {
+        .timeConstant = 0.3f,
+        .biasRate = 0.5f,
+        .stillDistance = 0.01f
+    };
+
+    float turned = 0.0f;
+    int frames = (int)(FUSE_DURATION / FUSE_PERIOD + 0.5f);
+    int steps = (int)(FUSE_PERIOD / TRUTH_STEP + 0.5f);
+    for (int i = 0; i < frames; i++)
+    {
+        float leftChange = 0.0f;
+        float rightChange = 0.0f;
+        for (int j = 0; j < steps; j++)
+        {
+            float time = (i * steps + j + 0.5f) * TRUTH_STEP;
+            float left = 0.0f;
+            float right = 0.0f;
+            if (time >= STILL) wheelSpeeds(time - STILL, &left, &right);
+            left *= TRUTH_STEP;
+            right *= TRUTH_STEP;
+            odometryUpdate(&result.truth, left, right, SEPARATION);
+            turned += (right - left) / SEPARATION;
+
+            float scrub = 0.5f * SCRUB * (right - left);
+            leftChange += left - scrub;
+            rightChange += right + scrub;
+        }
+        float time = (i + 1) * FUSE_PERIOD;
+        if (time > STILL + 4.0f && time <= STILL + 4.5f) leftChange += 0.2f;
+
+        float degrees = roundf((turned + GYRO_BIAS * time) * 360.0f / TAU);
+        float gyroAngle = degrees * TAU / 360.0f;
+
+        odometryUpdate(&result.wheels, leftChange, rightChange, SEPARATION);
+        odometryFuse(
+            &result.fused,
+            &gyro,
+            leftChange,
+            rightChange,
+            SEPARATION,
+            gyroAngle,
+            FUSE_PERIOD
+        );
+        if (time <= STILL) result.bias = gyro.bias;
+    }
+    return result;
+}
+
+// Subtests
+
+void
+test_odometryStraight()
+{
+    // 1 test
+
+    OdometryPose pose = {1.0f, 2.0f, PI / 4.0f};
+    odometryUpdate(&pose, 10.0f, 10.0f, SEPARATION);
+    ok(
+        fabsf(pose.x - (1.0f + 10.0f * cosf(PI / 4.0f))) < 1e-4f &&
+        fabsf(pose.y - (2.0f + 10.0f * sinf(PI / 4.0f))) < 1e-4f &&
+        fabsf(pose.heading - PI / 4.0f) < 1e-6f,
+        "odometryUpdate, given equal changes, should drive straight"
+    );
+}
+
+void
+test_odometryCircle()
+{
+    // 2 tests
+
+    // A quarter circle of radius 20 about (0, 20), in one update
+    float radius = 20.0f;
+    float quarter = PI / 2.0f;
+    OdometryPose pose = {0.0f, 0.0f, 0.0f};
+    odometryUpdate(
+        &pose,
+        (radius - 0.5f * SEPARATION) * quarter,
+        (radius + 0.5f * SEPARATION) * quarter,
+        SEPARATION
+    );
+    ok(
+        fabsf(pose.x - radius) < 1e-3f && fabsf(pose.y - radius) < 1e-3f,
+        "odometryUpdate should land on the arc however far it turns"
+    );
+    ok(
+        fabsf(pose.heading - quarter) < 1e-5f,
+        "odometryUpdate should turn by the difference over the separation"
+    );
+}
+
+void
+test_odometryRate()
+{
+    // 3 tests
+
+    OdometryPose truth = truePose();
+    float before = poseError(integratedPose(0.02f, false), truth);
+    float arcs20 = poseError(integratedPose(0.02f, true), truth);
+    float arcs80 = poseError(integratedPose(0.08f, true), truth);
+    diag("after %.0f s: old 20 ms %.4f in, arcs 20 ms %.4f in, arcs 80 ms %.4f in",
+        DURATION, before, arcs20, arcs80);
+
+    ok(arcs20 < before, "odometryUpdate should beat the old integration at 20 ms");
+    ok(arcs80 < before, "odometryUpdate at 80 ms should beat the old integration at 20 ms");
+    ok(arcs80 < 0.2f, "odometryUpdate at 80 ms should stay within 0.2 in");
+}
+
+void
+test_odometryFuse()
+{
+    // 4 tests
+
+    FuseResult result = fuseDrive();
+    float wheels = poseError(result.wheels, result.truth);
+    float fused = poseError(result.fused, result.truth);
+    float headingWheels = fabsf(odometryWrap(result.wheels.heading - result.truth.heading));
+    float headingFused = fabsf(odometryWrap(result.fused.heading - result.truth.heading));
+    diag("with slip: wheels %.2f in %.2f deg, fused %.2f in %.2f deg, bias %.4f rad/s",
+        wheels, headingWheels * 360.0f / TAU, fused, headingFused * 360.0f / TAU, result.bias);
+
+    ok(
+        fabsf(result.bias - GYRO_BIAS) < 0.3f * GYRO_BIAS,
+        "odometryFuse, while still, should learn the gyro's bias"
+    );
+    ok(headingFused < 3.0f * TAU / 360.0f, "odometryFuse should keep heading within 3 degrees");
+    ok(headingFused < 0.2f * headingWheels, "odometryFuse should correct the wheels' heading");
+    ok(fused < 0.25f * wheels, "odometryFuse should correct the slip in position");
+}
+
+void
+test_odometryWrap()
+{
+    // 1 test
+
+    ok(
+        fabsf(odometryWrap(-3.5f) - (-3.5f + TAU)) < 1e-5f &&
+        fabsf(odometryWrap(3.5f) - (3.5f - TAU)) < 1e-5f &&
+        fabsf(odometryWrap(1.0f) - 1.0f) < 1e-5f,
+        "odometryWrap should wrap either way into -pi to pi"
+    );
+}
+
+void
+test_odometryHistoryAt()
+{
+    // 3 tests
+
+    // Every 10 ms, going 100 in/s along x and turning 1 rad/s, from just
+    // before micros() wraps around
+    OdometryHistory history;
+    odometryHistoryClear(&history);
+    unsigned long start = (unsigned long)-25000;
+    for (int i = 0; i < 10; i++)
+    {
+        OdometrySample sample =
+        {
+            .microTime = start + i * 10000,
+            .x = i * 1.0f,
+            .y = 0.0f,
+            .heading = odometryWrap(3.1f + i * 0.01f),
+            .velocity = 100.0f
+        };
+        odometryHistoryPush(&history, sample);
+    }
+
+    OdometrySample sample;
+    bool found = odometryHistoryAt(&history, start + 45000, &sample);
+    ok(
+        found && fabsf(sample.x - 4.5f) < 1e-4f && sample.microTime == start + 45000,
+        "odometryHistoryAt should interpolate across micros() wrapping"
+    );
+    ok(
+        fabsf(odometryWrap(sample.heading - (3.1f + 0.045f))) < 1e-5f,
+        "odometryHistoryAt should interpolate heading the short way past pi"
+    );
+    odometryHistoryAt(&history, start + 30000, &sample);
+    ok(fabsf(sample.x - 3.0f) < 1e-6f, "odometryHistoryAt, on a sample, should give it");
+}
+
+void
+test_odometryHistoryEnds()
+{
+    // 3 tests
+
+    OdometryHistory history;
+    odometryHistoryClear(&history);
+    OdometrySample sample = {0};
+    ok(
+        !odometryHistoryAt(&history, 0, &sample),
+        "odometryHistoryAt, given an empty history, should fail"
+    );
+
+    // Fill it past its size, so the first few are dropped
+    int pushed = ODOMETRY_HISTORY + 5;
+    for (int i = 0; i < pushed; i++)
+    {
+        OdometrySample next = {.microTime = 1000 + i * 10000, .x = i};
+        odometryHistoryPush(&history, next);
+    }
+    bool found = odometryHistoryAt(&history, 1000, &sample);
+    ok(
+        !found && sample.x == 5.0f,
+        "odometryHistoryAt, before the oldest kept, should give the oldest"
+    );
+    found = odometryHistoryAt(&history, 1000 + pushed * 10000, &sample);
+    ok(
+        !found && sample.x == pushed - 1,
+        "odometryHistoryAt, after the newest, should give the newest"
+    );
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return 0;
+}
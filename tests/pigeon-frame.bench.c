@@ -0,0 +1,185 @@
+#include "pigeon-frame.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+//
+// Compares the text and binary wire formats for a typical stream line
+// (reckoner: x y heading velocity) and a typical onchange line, and the
+// delta stream frames for a flywheel stream where only the measured speed
+// and action move between frames.
+//
+// Run with `make bench`.
+//
+
+#define ITERATIONS 200000
+#define BAUD_BYTES_PER_SECOND (115200.0 / 10.0)
+
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static volatile int sink;
+
+static int
+encodeStreamText(char * line, const float * values, int count, unsigned long millis)
+{
+    char message[80] = {0};
+    for (int i = 0; i < count; i++)
+    {
+        char value[80];
+        snprintf(value, 80, "%f", values[i]);
+        if (i > 0) strncat(message, " ", 79 - strlen(message));
+        strncat(message, value, 79 - strlen(message));
+    }
+    return pigeonFormatText(line, 80, millis, "reckoner", "", message) + 1;
+}
+
+static int
+encodeStreamBinary(unsigned char * frameBytes, const float * values, int count, unsigned long millis)
+{
+    PigeonFrame frame;
+    frame.portal = 4;
+    frame.entry = PIGEON_FRAME_STREAM;
+    frame.timestamp = millis;
+    frame.count = count;
+    for (int i = 0; i < count; i++)
+    {
+        frame.values[i].type = PIGEON_TYPE_FLOAT;
+        frame.values[i].as.f = values[i];
+    }
+    return pigeonFrameEncode(&frame, frameBytes, PIGEON_FRAME_MAXSIZE);
+}
+
+static int
+encodeStreamDelta(
+    unsigned char * frameBytes,
+    PigeonFrame * last,
+    const float * values,
+    int count,
+    unsigned long millis
+){
+    PigeonFrame frame;
+    frame.portal = 2;
+    frame.entry = PIGEON_FRAME_STREAM;
+    frame.timestamp = millis;
+    frame.count = count;
+    for (int i = 0; i < count; i++)
+    {
+        frame.values[i].type = PIGEON_TYPE_FLOAT;
+        frame.values[i].as.f = values[i];
+    }
+    PigeonFrame delta;
+    pigeonFrameDelta(last, &frame, &delta);
+    *last = frame;
+    return pigeonFrameEncode(&delta, frameBytes, PIGEON_FRAME_MAXSIZE);
+}
+
+static int
+encodeEntryText(char * line, float value, unsigned long millis)
+{
+    char message[80];
+    snprintf(message, 80, "%f", value);
+    return pigeonFormatText(line, 80, millis, "fwabove", "target", message) + 1;
+}
+
+static int
+encodeEntryBinary(unsigned char * frameBytes, float value, unsigned long millis)
+{
+    PigeonFrame frame;
+    frame.portal = 2;
+    frame.entry = 2;
+    frame.timestamp = millis;
+    frame.count = 1;
+    frame.values[0].type = PIGEON_TYPE_FLOAT;
+    frame.values[0].as.f = value;
+    return pigeonFrameEncode(&frame, frameBytes, PIGEON_FRAME_MAXSIZE);
+}
+
+static void
+report(const char * name, int bytes, double seconds)
+{
+    double nanoseconds = seconds / ITERATIONS * 1e9;
+    printf(
+        "%-16s %4d bytes/frame %8.1f ns/frame %8.1f frames/s at 115200 baud\n",
+        name,
+        bytes,
+        nanoseconds,
+        BAUD_BYTES_PER_SECOND / bytes
+    );
+}
+
+int main()
+{
+    char line[80];
+    unsigned char frameBytes[PIGEON_FRAME_MAXSIZE];
+    float values[4] = {123.456f, -78.9f, 1.5708f, 42.0f};
+    int bytes = 0;
+    double start;
+
+    printf("# pigeon-frame: text vs binary, %d iterations\n", ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        values[0] = i * 0.01f;
+        bytes = encodeStreamText(line, values, 4, i);
+        sink += line[bytes / 2];
+    }
+    report("stream text", bytes, now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        values[0] = i * 0.01f;
+        bytes = encodeStreamBinary(frameBytes, values, 4, i);
+        sink += frameBytes[bytes / 2];
+    }
+    report("stream binary", bytes, now() - start);
+
+    // target measured error action derivative integral dt raw
+    float flywheel[8] = {2400.0f, 2390.0f, 10.0f, 0.8f, 0.0f, 0.0f, 20.0f, 96.0f};
+    PigeonFrame last;
+    pigeonFrameDecode(&last, frameBytes, encodeStreamBinary(frameBytes, flywheel, 8, 0));
+    last.portal = 2;
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        bytes = encodeStreamBinary(frameBytes, flywheel, 8, i);
+        sink += frameBytes[bytes / 2];
+    }
+    report("flywheel binary", bytes, now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        flywheel[1] = 2390.0f + (i & 7);
+        flywheel[3] = 0.8f + (i & 3) * 0.01f;
+        bytes = encodeStreamDelta(frameBytes, &last, flywheel, 8, i);
+        sink += frameBytes[bytes / 2];
+    }
+    report("flywheel delta", bytes, now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        bytes = encodeEntryText(line, i * 0.5f, i);
+        sink += line[bytes / 2];
+    }
+    report("entry text", bytes, now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        bytes = encodeEntryBinary(frameBytes, i * 0.5f, i);
+        sink += frameBytes[bytes / 2];
+    }
+    report("entry binary", bytes, now() - start);
+
+    return 0;
+}
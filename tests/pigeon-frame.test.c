@@ -0,0 +1,251 @@
+#include "tap.h"
+#include "pigeon-frame.h"
+#include <stddef.h>
+#include <string.h>
+
+// forward
+
+void test_pigeonFormatText();
+void test_pigeonFrameEncode();
+void test_pigeonFrameDecode();
+void test_pigeonDecoderPush();
+void test_pigeonFrameDelta();
+
+//
+
+int main()
+{
+    plan(21);
+
+    test_pigeonFormatText();
+    test_pigeonFrameEncode();
+    test_pigeonFrameDecode();
+    test_pigeonDecoderPush();
+    test_pigeonFrameDelta();
+
+    done_testing();
+}
+
+// Helpers
+
+static PigeonFrame
+sampleFrame()
+{
+    PigeonFrame frame =
+    {
+        .portal = 3,
+        .entry = PIGEON_FRAME_STREAM,
+        .timestamp = 123456,
+        .count = 5
+    };
+    frame.values[0].type = PIGEON_TYPE_FLOAT;
+    frame.values[0].as.f = -67.8f;
+    frame.values[1].type = PIGEON_TYPE_INT;
+    frame.values[1].as.i = -45;
+    frame.values[2].type = PIGEON_TYPE_UINT;
+    frame.values[2].as.u = 4000000000ul;
+    frame.values[3].type = PIGEON_TYPE_BOOL;
+    frame.values[3].as.b = true;
+    frame.values[4].type = PIGEON_TYPE_TEXT;
+    frame.values[4].as.text = "closing";
+    return frame;
+}
+
+// Subtests
+
+void
+test_pigeonFormatText()
+{
+    // 3 tests
+
+    char line[80];
+    int length = pigeonFormatText(line, 80, 1234, "fwabove", "target", "5.0");
+    is(
+        line,
+        "[00001234|fwabove.target  ] 5.0",
+        "pigeonFormatText, given a key, should pad the path to the alignment"
+    );
+    ok(
+        length == (int)strlen(line),
+        "pigeonFormatText should return the length of the line"
+    );
+
+    pigeonFormatText(line, 80, 99, "flap", "", "1 2 3");
+    is(
+        line,
+        "[00000099|flap] 1 2 3",
+        "pigeonFormatText, given an empty key, should only show the portal id"
+    );
+}
+
+void
+test_pigeonFrameEncode()
+{
+    // 4 tests
+
+    PigeonFrame frame = sampleFrame();
+    unsigned char buffer[PIGEON_FRAME_MAXSIZE];
+    int size = pigeonFrameEncode(&frame, buffer, PIGEON_FRAME_MAXSIZE);
+
+    // header + float + int + uint + bool + text + checksum
+    int expected = PIGEON_FRAME_HEADERSIZE + 5 + 5 + 5 + 2 + 9 + 2;
+    cmp_ok(size, "==", expected, "pigeonFrameEncode should return the frame size");
+    ok(
+        buffer[0] == PIGEON_FRAME_SYNC && buffer[1] == expected - 4,
+        "pigeonFrameEncode should start with sync and length bytes"
+    );
+    ok(
+        buffer[2] == 3 && buffer[3] == PIGEON_FRAME_STREAM,
+        "pigeonFrameEncode should write the portal and entry indices"
+    );
+
+    size = pigeonFrameEncode(&frame, buffer, 20);
+    cmp_ok(size, "==", 0, "pigeonFrameEncode, given a small buffer, should fail");
+}
+
+void
+test_pigeonFrameDecode()
+{
+    // 6 tests
+
+    PigeonFrame frame = sampleFrame();
+    unsigned char buffer[PIGEON_FRAME_MAXSIZE];
+    int size = pigeonFrameEncode(&frame, buffer, PIGEON_FRAME_MAXSIZE);
+
+    PigeonFrame decoded;
+    ok(
+        pigeonFrameDecode(&decoded, buffer, size),
+        "pigeonFrameDecode, given an encoded frame, should succeed"
+    );
+    ok(
+        decoded.portal == 3 &&
+        decoded.entry == PIGEON_FRAME_STREAM &&
+        decoded.timestamp == 123456 &&
+        decoded.count == 5,
+        "pigeonFrameDecode should restore the header"
+    );
+    ok(
+        decoded.values[0].as.f == -67.8f &&
+        decoded.values[1].as.i == -45 &&
+        decoded.values[2].as.u == 4000000000ul &&
+        decoded.values[3].as.b == true,
+        "pigeonFrameDecode should restore numeric values exactly"
+    );
+    is(
+        decoded.values[4].as.text,
+        "closing",
+        "pigeonFrameDecode should restore text values"
+    );
+
+    buffer[10] ^= 0x40;
+    ok(
+        !pigeonFrameDecode(&decoded, buffer, size),
+        "pigeonFrameDecode, given a corrupted frame, should fail the checksum"
+    );
+    buffer[10] ^= 0x40;
+    ok(
+        !pigeonFrameDecode(&decoded, buffer, size - 1),
+        "pigeonFrameDecode, given a truncated frame, should fail"
+    );
+}
+
+void
+test_pigeonDecoderPush()
+{
+    // 4 tests
+
+    PigeonFrame frame = sampleFrame();
+    unsigned char good[PIGEON_FRAME_MAXSIZE];
+    int size = pigeonFrameEncode(&frame, good, PIGEON_FRAME_MAXSIZE);
+    unsigned char bad[PIGEON_FRAME_MAXSIZE];
+    memcpy(bad, good, size);
+    bad[size - 1] ^= 0xFF;
+
+    unsigned char stream[4 * PIGEON_FRAME_MAXSIZE];
+    int length = 0;
+    const char * garbage = "[0001|noise] ";
+    memcpy(stream + length, garbage, strlen(garbage));
+    length += strlen(garbage);
+    memcpy(stream + length, good, size);
+    length += size;
+    memcpy(stream + length, bad, size);
+    length += size;
+    memcpy(stream + length, good, size);
+    length += size;
+
+    PigeonDecoder decoder;
+    pigeonDecoderInit(&decoder);
+    PigeonFrame decoded;
+    int frames = 0;
+    int firstAt = -1;
+    for (int i = 0; i < length; i++)
+    {
+        if (pigeonDecoderPush(&decoder, stream[i], &decoded))
+        {
+            if (firstAt < 0) firstAt = i;
+            frames++;
+        }
+    }
+
+    cmp_ok(frames, "==", 2, "pigeonDecoder should only yield the valid frames");
+    cmp_ok(
+        firstAt,
+        "==",
+        (int)strlen(garbage) + size - 1,
+        "pigeonDecoder should yield a frame on its last byte"
+    );
+    ok(decoder.errors > 0, "pigeonDecoder should count the corrupted frame");
+    is(
+        decoded.values[4].as.text,
+        "closing",
+        "pigeonDecoder should resynchronise after a corrupted frame"
+    );
+}
+
+void
+test_pigeonFrameDelta()
+{
+    // 4 tests
+
+    PigeonFrame last = sampleFrame();
+    PigeonFrame current = sampleFrame();
+    current.values[0].as.f = 12.5f;
+    current.values[4].as.text = "closed";
+
+    PigeonFrame delta;
+    bool built = pigeonFrameDelta(&last, &current, &delta);
+    ok(
+        built &&
+        delta.entry == PIGEON_FRAME_DELTA &&
+        delta.count == 3 &&
+        delta.values[0].as.u == ((1ul << 0) | (1ul << 4)),
+        "pigeonFrameDelta should carry a mask and only the changed values"
+    );
+
+    // Send it over the wire and apply it to what the host had before
+    unsigned char buffer[PIGEON_FRAME_MAXSIZE];
+    int size = pigeonFrameEncode(&delta, buffer, PIGEON_FRAME_MAXSIZE);
+    PigeonFrame decoded;
+    pigeonFrameDecode(&decoded, buffer, size);
+    PigeonFrame state;
+    pigeonFrameCopy(&state, &last);
+    bool applied = pigeonFrameApplyDelta(&state, &decoded);
+    ok(
+        applied &&
+        state.values[0].as.f == 12.5f &&
+        state.values[1].as.i == -45 &&
+        state.values[3].as.b == true,
+        "pigeonFrameApplyDelta should update only the changed values"
+    );
+    is(
+        state.values[4].as.text,
+        "closed",
+        "pigeonFrameApplyDelta should keep its own copy of changed text"
+    );
+
+    current.count = 4;
+    ok(
+        !pigeonFrameDelta(&last, &current, &delta),
+        "pigeonFrameDelta, given frames of different lengths, should fail"
+    );
+}
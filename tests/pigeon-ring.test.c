@@ -0,0 +1,199 @@
+#include "tap.h"
+#include "pigeon-ring.h"
+#include <stddef.h>
+#include <string.h>
+
+// forward
+
+void test_pigeonRingInit();
+void test_pigeonRingOrder();
+void test_pigeonRingDropNewest();
+void test_pigeonRingDropOldest();
+void test_pigeonRingBlock();
+void test_pigeonRingHeldSlot();
+
+//
+
+int main()
+{
+    plan(15);
+
+    test_pigeonRingInit();
+    test_pigeonRingOrder();
+    test_pigeonRingDropNewest();
+    test_pigeonRingDropOldest();
+    test_pigeonRingBlock();
+    test_pigeonRingHeldSlot();
+
+    done_testing();
+}
+
+// Helpers
+
+static bool
+pushNumber(PigeonRing * ring, PigeonOverflow overflow, int number)
+{
+    char text[16];
+    sprintf(text, "record %d", number);
+    return pigeonRingPush(ring, overflow, number & 0xFF, text, strlen(text));
+}
+
+// Returns the number of the next record, or -1 if empty.
+static int
+popNumber(PigeonRing * ring)
+{
+    char text[PIGEON_RING_SLOTSIZE + 1];
+    unsigned char tag;
+    int size = pigeonRingPop(ring, &tag, text);
+    if (size < 0) return -1;
+    text[size] = '\0';
+    int number = -2;
+    sscanf(text, "record %d", &number);
+    if ((number & 0xFF) != tag) return -3;
+    return number;
+}
+
+// Subtests
+
+void
+test_pigeonRingInit()
+{
+    // 2 tests
+
+    PigeonRing * ring = pigeonRingInit(5);
+    cmp_ok(
+        pigeonRingCapacity(ring), "==", 8,
+        "pigeonRingInit should round the capacity up to a power of two"
+    );
+    cmp_ok(
+        popNumber(ring), "==", -1,
+        "pigeonRingPop, on a new ring, should report it empty"
+    );
+}
+
+void
+test_pigeonRingOrder()
+{
+    // 3 tests
+
+    PigeonRing * ring = pigeonRingInit(4);
+    bool inOrder = true;
+
+    // Go round a few times to check the sequence numbers wrap properly
+    for (int lap = 0; lap < 5; lap++)
+    {
+        for (int i = 0; i < 3; i++) pushNumber(ring, PIGEON_OVERFLOW_DROP_NEWEST, lap * 3 + i);
+        for (int i = 0; i < 3; i++)
+        {
+            if (popNumber(ring) != lap * 3 + i) inOrder = false;
+        }
+    }
+    ok(inOrder, "pigeonRingPop should return records first in, first out");
+    cmp_ok(
+        popNumber(ring), "==", -1,
+        "pigeonRingPop, after popping everything, should report it empty"
+    );
+
+    char big[PIGEON_RING_SLOTSIZE + 1] = {0};
+    ok(
+        !pigeonRingPush(ring, PIGEON_OVERFLOW_DROP_OLDEST, 0, big, sizeof(big)),
+        "pigeonRingPush, given a record too big for a slot, should drop it"
+    );
+}
+
+void
+test_pigeonRingDropNewest()
+{
+    // 3 tests
+
+    PigeonRing * ring = pigeonRingInit(4);
+    for (int i = 0; i < 6; i++) pushNumber(ring, PIGEON_OVERFLOW_DROP_NEWEST, i);
+
+    cmp_ok(
+        pigeonRingCount(ring), "==", 4,
+        "pigeonRingCount, on a full ring, should equal its capacity"
+    );
+
+    cmp_ok(
+        pigeonRingDropped(ring), "==", 2,
+        "pigeonRingPush, dropping newest, should count each refused record"
+    );
+    bool kept = true;
+    for (int i = 0; i < 4; i++)
+    {
+        if (popNumber(ring) != i) kept = false;
+    }
+    ok(kept, "pigeonRingPush, dropping newest, should keep the first records");
+}
+
+void
+test_pigeonRingDropOldest()
+{
+    // 2 tests
+
+    PigeonRing * ring = pigeonRingInit(4);
+    bool accepted = true;
+    for (int i = 0; i < 6; i++)
+    {
+        if (!pushNumber(ring, PIGEON_OVERFLOW_DROP_OLDEST, i)) accepted = false;
+    }
+
+    cmp_ok(
+        pigeonRingDropped(ring), "==", 2,
+        "pigeonRingPush, dropping oldest, should count each discarded record"
+    );
+    bool kept = accepted;
+    for (int i = 2; i < 6; i++)
+    {
+        if (popNumber(ring) != i) kept = false;
+    }
+    ok(kept, "pigeonRingPush, dropping oldest, should keep the latest records");
+}
+
+void
+test_pigeonRingBlock()
+{
+    // 2 tests
+
+    PigeonRing * ring = pigeonRingInit(2);
+    pushNumber(ring, PIGEON_OVERFLOW_BLOCK, 0);
+    pushNumber(ring, PIGEON_OVERFLOW_BLOCK, 1);
+    bool refused = !pushNumber(ring, PIGEON_OVERFLOW_BLOCK, 2);
+
+    ok(
+        refused && pigeonRingDropped(ring) == 0,
+        "pigeonRingPush, blocking on a full ring, should refuse without dropping"
+    );
+
+    popNumber(ring);
+    pushNumber(ring, PIGEON_OVERFLOW_BLOCK, 2);
+    ok(
+        popNumber(ring) == 1 && popNumber(ring) == 2,
+        "pigeonRingPush, blocking, should succeed once there is room again"
+    );
+}
+
+void
+test_pigeonRingHeldSlot()
+{
+    // 3 tests
+
+    // A reader claims the oldest record and is preempted before releasing
+    // it, with the ring full again behind it: its slot is the next to push.
+    PigeonRing * ring = pigeonRingInit(4);
+    for (int i = 0; i < 4; i++) pushNumber(ring, PIGEON_OVERFLOW_DROP_OLDEST, i);
+    PigeonRingRecord held;
+    pigeonRingClaim(ring, &held);
+
+    bool pushed = pushNumber(ring, PIGEON_OVERFLOW_DROP_OLDEST, 4);
+    ok(
+        !pushed && pigeonRingDropped(ring) == 1,
+        "pigeonRingPush, dropping oldest onto a slot being read, should drop the newest"
+    );
+    bool kept = popNumber(ring) == 1 && popNumber(ring) == 2 && popNumber(ring) == 3;
+    ok(kept, "pigeonRingPush, dropping oldest onto a slot being read, should keep the rest");
+
+    pigeonRingRelease(ring, &held);
+    pushNumber(ring, PIGEON_OVERFLOW_DROP_OLDEST, 5);
+    ok(popNumber(ring) == 5, "pigeonRingPush should use the slot once it is released");
+}
@@ -1,6 +1,9 @@
 #include "tap.h"
 #include "pigeon.h"
+#include <ctype.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 
 // forward
 
@@ -8,17 +11,41 @@ void test_portalFloatHandler();
 void test_portalUintHandler();
 void test_portalUlongHandler();
 void test_portalBoolHandler();
+void test_portalUpdateLazy();
+void test_portalStreamRate();
+void test_portalDeadband();
+void test_portalStreamKeys();
+void test_portalFlushDelta();
+void test_portalFlushTime();
+void test_pigeonInputSplit();
+void test_pigeonInputLong();
+void test_pigeonInputReplies();
+void test_pigeonInputMutex();
+void test_portalStreamFits();
+void test_pigeonStatsTimings();
 
 //
 
 int main()
 {
-    plan(20);
+    plan(48);
 
     test_portalFloatHandler();
     test_portalUintHandler();
     test_portalUlongHandler();
     test_portalBoolHandler();
+    test_portalUpdateLazy();
+    test_portalStreamRate();
+    test_portalDeadband();
+    test_portalStreamKeys();
+    test_portalFlushDelta();
+    test_portalFlushTime();
+    test_pigeonInputSplit();
+    test_pigeonInputLong();
+    test_pigeonInputReplies();
+    test_pigeonInputMutex();
+    test_portalStreamFits();
+    test_pigeonStatsTimings();
 
     done_testing();
 }
@@ -198,12 +225,604 @@ test_portalBoolHandler()
     );
 }
 
+// Fake pigeon IO
+
+static char lastLine[128];
+static char allLines[512];
+static int lineCount = 0;
+static int handlerCalls = 0;
+static bool mutexHeld = false;
+static bool heldInHandler = false;
+static unsigned long now = 42;
+
+static void
+capturePuts(const char * message)
+{
+    strncpy(lastLine, message, 127);
+    lineCount++;
+    strncat(allLines, message, sizeof(allLines) - strlen(allLines) - 2);
+    strcat(allLines, "\n");
+}
+
+static void
+clearLines()
+{
+    lastLine[0] = '\0';
+    allLines[0] = '\0';
+    lineCount = 0;
+}
+
+static unsigned char lastFrame[PIGEON_FRAME_MAXSIZE];
+static int lastFrameSize = 0;
+
+static void
+captureWrite(const char * data, size_t size)
+{
+    memcpy(lastFrame, data, size);
+    lastFrameSize = size;
+}
+
+static unsigned long
+fakeMillis()
+{
+    return now;
+}
+
+// Holds a string, read back as is
+static void
+textHandler(void * handle, char * message, char * response)
+{
+    if (handle == NULL) return;
+    if (message == NULL) return;
+    if (message[0] == '\0') strcpy(response, handle);
+    else strcpy(handle, message);
+}
+
+// Notes whether the owner's mutex was held when it ran
+static void
+mutexHandler(void * handle, char * message, char * response)
+{
+    if (message == NULL) return;
+    heldInHandler = mutexHeld;
+}
+
+static void
+countingHandler(void * handle, char * message, char * response)
+{
+    if (message == NULL) return;
+    if (message[0] != '\0') return;
+    handlerCalls++;
+    strcpy(response, "counted");
+}
+
+void
+test_portalUpdateLazy()
+{
+    // 4 tests
+
+    float value = 1.5f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "test");
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "quiet",
+            .handler = countingHandler,
+            .handle = &value
+        },
+        {
+            .key = "loud",
+            .handler = countingHandler,
+            .handle = &value,
+            .onchange = true
+        },
+        {
+            .key = "value",
+            .handler = portalFloatHandler,
+            .handle = &value,
+            .stream = true
+        },
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+    portalReady(portal);
+    portalEnable(portal);
+
+    lineCount = 0;
+    for (int i = 0; i < 10; i++) portalUpdate(portal, "quiet");
+    ok(
+        handlerCalls == 0 && lineCount == 0,
+        "portalUpdate, on an entry nobody listens to, should not format it"
+    );
+
+    portalUpdate(portal, "loud");
+    ok(
+        handlerCalls == 1 && lineCount == 1,
+        "portalUpdate, on an onchange entry, should format and write it once"
+    );
+    is(
+        lastLine,
+        "[00000042|test.loud   ] counted",
+        "portalUpdate should write the text its handler formats"
+    );
+
+    value = 2.25f;
+    portalFlush(portal);
+    is(
+        lastLine,
+        "[00000042|test] 2.250000",
+        "portalFlush should format the stream values as they are now"
+    );
+}
+
+void
+test_portalStreamRate()
+{
+    // 2 tests
+
+    float value = 1.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "rate");
+    portalAdd(portal, (PortalEntrySetup)
+    {
+        .key = "value",
+        .handler = portalFloatHandler,
+        .handle = &value,
+        .stream = true
+    });
+    portalReady(portal);
+    portalEnable(portal);
+
+    portalSetStreamRate(portal, 3, 0);
+    lineCount = 0;
+    for (int i = 0; i < 9; i++) portalFlush(portal);
+    cmp_ok(
+        lineCount, "==", 3,
+        "portalFlush, streaming every 3rd flush, should write every 3rd line"
+    );
+
+    portalSetStreamRate(portal, 1, 200);
+    lineCount = 0;
+    for (now = 1000; now < 2000; now += 20) portalFlush(portal);
+    now = 42;
+    cmp_ok(
+        lineCount, "==", 5,
+        "portalFlush, streaming every 200ms, should skip flushes in between"
+    );
+}
+
+void
+test_portalDeadband()
+{
+    // 2 tests
+
+    float value = 10.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "band");
+    PortalEntryRef ref = portalAdd(portal, (PortalEntrySetup)
+    {
+        .key = "value",
+        .handler = portalFloatHandler,
+        .handle = &value,
+        .onchange = true,
+        .deadband = 0.5f
+    });
+    portalReady(portal);
+    portalEnable(portal);
+
+    lineCount = 0;
+    portalUpdateRef(portal, ref);
+    value = 10.3f;
+    portalUpdateRef(portal, ref);
+    value = 9.8f;
+    portalUpdateRef(portal, ref);
+    cmp_ok(
+        lineCount, "==", 1,
+        "portalUpdateRef, within the deadband, should not write the entry"
+    );
+
+    value = 10.6f;
+    portalUpdateRef(portal, ref);
+    is(
+        lastLine,
+        "[00000042|band.value  ] 10.600000",
+        "portalUpdateRef, outside the deadband, should write the new value"
+    );
+}
+
+void
+test_portalStreamKeys()
+{
+    // 3 tests
+
+    float a = 1.0f;
+    float b = 2.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "keys");
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "a",
+            .handler = portalFloatHandler,
+            .handle = &a,
+            .stream = true
+        },
+        {
+            .key = "b",
+            .handler = portalFloatHandler,
+            .handle = &b,
+            .stream = true
+        },
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+    portalReady(portal);
+
+    // Swapping the keys back and forth reuses the same list nodes
+    bool swapped = true;
+    for (int i = 0; i < 1000; i++)
+    {
+        char sequence[] = "a b";
+        if (!portalSetStreamKeys(portal, sequence)) swapped = false;
+    }
+    char keys[80];
+    portalGetStreamKeys(portal, keys);
+    ok(
+        swapped,
+        "portalSetStreamKeys, called repeatedly, should not run out of memory"
+    );
+    is(keys, "a b", "portalSetStreamKeys should set the keys in order");
+
+    char bad[] = "b nope";
+    portalSetStreamKeys(portal, bad);
+    portalGetStreamKeys(portal, keys);
+    is(
+        keys,
+        "a b",
+        "portalSetStreamKeys, given an unknown key, should keep the old keys"
+    );
+}
+
+void
+test_portalFlushDelta()
+{
+    // 2 tests
+
+    float a = 1.0f;
+    float b = 2.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, captureWrite, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "delta");
+    PortalEntrySetup setups[] =
+    {
+        {
+            .key = "a",
+            .handler = portalFloatHandler,
+            .handle = &a,
+            .stream = true
+        },
+        {
+            .key = "b",
+            .handler = portalFloatHandler,
+            .handle = &b,
+            .stream = true
+        },
+        {
+            .key = "~",
+            .handler = NULL,
+            .handle = NULL
+        }
+    };
+    portalAddBatch(portal, setups);
+    portalReady(portal);
+    portalEnable(portal);
+    pigeonSetMode(pigeon, PIGEON_MODE_DELTA);
+
+    PigeonFrame first;
+    portalFlush(portal);
+    pigeonFrameDecode(&first, lastFrame, lastFrameSize);
+
+    PigeonFrame second;
+    b = 3.0f;
+    portalFlush(portal);
+    pigeonFrameDecode(&second, lastFrame, lastFrameSize);
+
+    ok(
+        first.entry == PIGEON_FRAME_STREAM && first.count == 2,
+        "portalFlush, in delta mode, should start with a keyframe"
+    );
+    ok(
+        second.entry == PIGEON_FRAME_DELTA &&
+        second.count == 2 &&
+        second.values[1].as.f == 3.0f,
+        "portalFlush, in delta mode, should then only send what changed"
+    );
+}
+
+void
+test_portalFlushTime()
+{
+    // 1 test
+
+    float a = 1.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "time");
+    portalAdd(portal, (PortalEntrySetup)
+    {
+        .key = "a",
+        .handler = portalFloatHandler,
+        .handle = &a,
+        .stream = true
+    });
+    portalReady(portal);
+    portalEnable(portal);
+
+    // The fake clock ticks 10us per read, so each flush takes 30us
+    portalFlush(portal);
+    portalFlush(portal);
+    char keys[] = "flush-time";
+    portalSetStreamKeys(portal, keys);
+    portalFlush(portal);
+    ok(
+        strstr(lastLine, "] 30/30us") != NULL,
+        "portalFlush should time itself, read from flush-time"
+    );
+}
+
+// A portal "in" with text entries a, b and c, for feeding lines to
+static Pigeon *
+inputPigeon(char * a, char * b, char * c)
+{
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "in");
+    PortalEntrySetup setups[] =
+    {
+        {.key = "a", .handler = textHandler, .handle = a, .stream = true},
+        {.key = "b", .handler = textHandler, .handle = b},
+        {.key = "c", .handler = textHandler, .handle = c},
+        {.key = "~", .handler = NULL, .handle = NULL}
+    };
+    portalAddBatch(portal, setups);
+    portalReady(portal);
+    portalEnable(portal);
+    return pigeon;
+}
+
+void
+test_pigeonInputSplit()
+{
+    // 3 tests
+
+    char a[80] = "";
+    char b[80] = "";
+    char c[80] = "";
+    Pigeon * pigeon = inputPigeon(a, b, c);
+
+    clearLines();
+    char line[] = "in.a 1;in.b   2 ; in.c 3\n";
+    pigeonInput(pigeon, line);
+    ok(
+        !strcmp(a, "1") && !strcmp(b, "2") && !strcmp(c, "3"),
+        "pigeonInput should run each ';' separated command"
+    );
+
+    char empty[] = ";; in.a 4 ;  ; ";
+    pigeonInput(pigeon, empty);
+    ok(
+        !strcmp(a, "4") && lineCount == 0,
+        "pigeonInput should skip empty commands without complaint"
+    );
+    if (lineCount != 0) diag("%s", allLines);
+
+    char quoted[] = "in.a \"x; y\"; in.b \" z \";in.c \"";
+    pigeonInput(pigeon, quoted);
+    ok(
+        !strcmp(a, "x; y") && !strcmp(b, " z ") && !strcmp(c, "\""),
+        "pigeonInput should keep a quoted value whole, without its quotes"
+    );
+    if (strcmp(a, "x; y") || strcmp(b, " z ")) diag("'%s' '%s' '%s'", a, b, c);
+}
+
+void
+test_pigeonInputLong()
+{
+    // 2 tests
+
+    char a[80] = "";
+    char b[80] = "";
+    char c[80] = "";
+    Pigeon * pigeon = inputPigeon(a, b, c);
+
+    // Over the input size, though every command in it is fine
+    char line[PIGEON_INPUTSIZE + 16] = "";
+    while (strlen(line) < PIGEON_INPUTSIZE) strcat(line, "in.a 5;");
+    clearLines();
+    pigeonInput(pigeon, line);
+    ok(
+        a[0] == '\0' && lineCount == 1 && strstr(lastLine, "too long") != NULL,
+        "pigeonInput, given a line over the input size, should ignore it"
+    );
+
+    // Within the size, but with more commands than are taken at once
+    char many[PIGEON_INPUTSIZE] = "";
+    for (int i = 0; i < 20; i++) strcat(many, i == 16 ? "in.b 6;" : "in.c 7;");
+    clearLines();
+    pigeonInput(pigeon, many);
+    ok(
+        !strcmp(c, "7") && b[0] == '\0' && strstr(lastLine, "too many") != NULL,
+        "pigeonInput, given too many commands, should run the first and drop the rest"
+    );
+}
+
+void
+test_pigeonInputReplies()
+{
+    // 2 tests
+
+    char a[80] = "x";
+    char b[80] = "y";
+    char c[80] = "";
+    Pigeon * pigeon = inputPigeon(a, b, c);
+
+    clearLines();
+    char line[] = "in.a; pigeon.keys in; in.b; in.deadband a; in.c z";
+    pigeonInput(pigeon, line);
+    ok(
+        strstr(allLines, "|in.a] x\n") != NULL &&
+        strstr(allLines, "|in.b] y\n") != NULL &&
+        strstr(allLines, "|in.deadband ] a 0.000000\n") != NULL &&
+        strstr(allLines, "|pigeon.keys ] a\n") != NULL,
+        "pigeonInput should write every command's reply, with or without a value"
+    );
+    ok(lineCount == 4 && !strcmp(c, "z"), "pigeonInput should write nothing for a plain set");
+    if (lineCount != 4) diag("%s", allLines);
+}
+
+void
+test_pigeonInputMutex()
+{
+    // 2 tests
+
+    float value = 0.0f;
+    int mutex = 0;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "lock");
+    PortalEntrySetup setups[] =
+    {
+        {.key = "value", .handler = portalFloatHandler, .handle = &value},
+        {.key = "action", .handler = mutexHandler, .handle = &value},
+        {.key = "~", .handler = NULL, .handle = NULL}
+    };
+    portalAddBatch(portal, setups);
+    portalSetMutex(portal, &mutex);
+    portalReady(portal);
+    portalEnable(portal);
+
+    heldInHandler = true;
+    char line[] = "lock.value 1; lock.action go";
+    pigeonInput(pigeon, line);
+    ok(value == -67.8f, "pigeonInput should set plain values");
+    ok(
+        !heldInHandler && !mutexHeld,
+        "pigeonInput should run other handlers without the owner's mutex"
+    );
+}
+
+void
+test_portalStreamFits()
+{
+    // 3 tests
+
+    static char keys[20][8];
+    float values[20] = {0};
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, captureWrite, fakeMillis);
+    Portal * portal = pigeonCreatePortal(pigeon, "wide");
+    for (int i = 0; i < 20; i++)
+    {
+        sprintf(keys[i], "k%d", i);
+        portalAdd(portal, (PortalEntrySetup)
+        {
+            .key = keys[i],
+            .handler = portalFloatHandler,
+            .handle = &values[i],
+            .stream = true
+        });
+    }
+    portalReady(portal);
+    portalEnable(portal);
+
+    char streamed[80];
+    portalGetStreamKeys(portal, streamed);
+    int count = 0;
+    for (char * c = streamed; *c != '\0'; c++) if (*c == ' ') count++;
+    ok(
+        count + 1 == PIGEON_FRAME_MAXVALUES,
+        "portalAdd should stop streaming once a frame is full"
+    );
+
+    char tooMany[] = "k0 k1 k2 k3 k4 k5 k6 k7 k8 k9 k10 k11 k12 k13 k14 k15 k16";
+    ok(
+        !portalSetStreamKeys(portal, tooMany),
+        "portalSetStreamKeys should refuse more keys than a frame holds"
+    );
+
+    // Every value, in binary mode, goes out in the one frame
+    pigeonSetMode(pigeon, PIGEON_MODE_BINARY);
+    char all[] = "k0 k1 k2 k3 k4 k5 k6 k7 k8 k9 k10 k11 k12 k13 k14 k15";
+    portalSetStreamKeys(portal, all);
+    portalFlush(portal);
+    PigeonFrame frame;
+    bool decoded = pigeonFrameDecode(&frame, lastFrame, lastFrameSize);
+    ok(
+        decoded && frame.entry == PIGEON_FRAME_STREAM && frame.count == 16,
+        "portalFlush, in binary mode, should send a full stream in one frame"
+    );
+}
+
+void
+test_pigeonStatsTimings()
+{
+    // 2 tests
+
+    float value = 1.0f;
+    Pigeon * pigeon = pigeonInit(NULL, capturePuts, NULL, fakeMillis);
+    Portal * busy = pigeonCreatePortal(pigeon, "busy");
+    Portal * quiet = pigeonCreatePortal(pigeon, "quiet");
+    portalAdd(busy, (PortalEntrySetup)
+    {
+        .key = "a",
+        .handler = portalFloatHandler,
+        .handle = &value,
+        .onchange = true
+    });
+    portalReady(busy);
+    portalEnable(busy);
+    portalReady(quiet);
+    portalEnable(quiet);
+
+    // The fake clock ticks 10us per read, so each write takes 10us
+    portalUpdate(busy, "a");
+    portalUpdate(busy, "a");
+    clearLines();
+    char line[] = "pigeon.stats";
+    pigeonInput(pigeon, line);
+    ok(
+        strstr(allLines, "|busy.write-time ] 10/10us\n") != NULL &&
+        strstr(allLines, "|quiet.write-time] 0/0us\n") != NULL,
+        "pigeon.stats should write each portal's own write time"
+    );
+    if (strstr(allLines, "|busy.write-time ] 10/10us\n") == NULL) diag("%s", allLines);
+
+    char reset[] = "pigeon.stats reset";
+    pigeonInput(pigeon, reset);
+    clearLines();
+    char again[] = "busy.write-time";
+    pigeonInput(pigeon, again);
+    ok(strstr(lastLine, "] 0/0us") != NULL, "pigeon.stats, set, should reset the timings");
+}
+
 // Mock functions
 
 char *
 stringCopy(char * dest, const char * src, size_t size)
 {
-    return "";
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+    return dest;
+}
+
+char *
+stringAppend(char * dest, const char * src, size_t size)
+{
+    size_t start = strlen(dest);
+    return stringCopy(dest + start, src, size - start);
 }
 
 bool
@@ -223,7 +842,12 @@ stringToUlong(const char * string, unsigned long * dest)
 char *
 trimSpaces(char * str)
 {
-    return "";
+    while (isspace((unsigned char)*str)) str++;
+    if (*str == '\0') return str;
+    char * end = str + strlen(str) - 1;
+    while (end > str && isspace((unsigned char)*end)) end--;
+    *(end + 1) = '\0';
+    return str;
 }
 
 
@@ -232,6 +856,30 @@ delay(const unsigned long time)
 {
 }
 
+unsigned long
+micros()
+{
+    static unsigned long time = 0;
+    time += 10;
+    return time;
+}
+
+typedef void * Mutex;
+
+bool
+mutexTake(Mutex mutex, const unsigned long blockTime)
+{
+    mutexHeld = true;
+    return true;
+}
+
+bool
+mutexGive(Mutex mutex)
+{
+    mutexHeld = false;
+    return true;
+}
+
 typedef void * TaskHandle;
 typedef void (*TaskCode)(void *);
 
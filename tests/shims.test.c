@@ -0,0 +1,215 @@
+#include "tap.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// The edge encoder's interface, as in shims.h, which can't be included
+// alongside stdio as it brings in API.h
+
+typedef void * EncoderHandle;
+
+typedef struct
+EncoderReading
+{
+    float revolutions;
+    float rpm;
+}
+EncoderReading;
+
+EncoderReading edgeEncoderGetter(EncoderHandle);
+void edgeEncoderResetter(EncoderHandle);
+EncoderHandle edgeEncoderGetHandle(unsigned char portTop, unsigned char portBottom, bool reversed);
+
+// forward
+
+void test_edgeEncoderOperatingSpeed();
+void test_edgeEncoderReset();
+
+//
+
+int main()
+{
+    plan(3);
+
+    test_edgeEncoderOperatingSpeed();
+    test_edgeEncoderReset();
+
+    done_testing();
+}
+
+// Fake encoder
+
+#define TOP 1
+#define BOTTOM 2
+
+typedef void (*InterruptHandler)(unsigned char pin);
+
+static unsigned long now = 0;
+static bool pins[13] = {false};
+static InterruptHandler handlers[13] = {NULL};
+static int phase = 0;
+
+// Steps the channels forward one edge at the given time, as the encoder
+// would: top rises, bottom rises, top falls, bottom falls.
+static void
+edgeAt(unsigned long time)
+{
+    now = time;
+    unsigned char pin = phase % 2 == 0 ? TOP : BOTTOM;
+    pins[pin] = !pins[pin];
+    phase++;
+    if (handlers[pin] != NULL) handlers[pin](pin);
+}
+
+// Spins at rpm from start, edge times rounded to the microsecond like
+// micros(), reading every frame. Returns the largest error of the readings
+// after the first few, which only settle the shim.
+static float
+spin(EncoderHandle encoder, float rpm, unsigned long start, unsigned long frame, int frames)
+{
+    float period = 60e6f / (rpm * 360.0f);
+    float largest = 0.0f;
+    int edge = 1;
+    for (int i = 1; i <= frames; i++)
+    {
+        unsigned long readTime = start + i * frame;
+        while (start + (unsigned long)(edge * period + 0.5f) <= readTime)
+        {
+            edgeAt(start + (unsigned long)(edge * period + 0.5f));
+            edge++;
+        }
+        now = readTime;
+        EncoderReading reading = edgeEncoderGetter(encoder);
+        float error = fabsf(reading.rpm - rpm);
+        if (i > 2 && error > largest) largest = error;
+    }
+    return largest;
+}
+
+// Subtests
+
+void
+test_edgeEncoderOperatingSpeed()
+{
+    // 2 tests
+
+    // A flywheel at 2425 rpm through 25:1, read every 20 and 60 ms. The
+    // count alone moves by a tick a read, about 8 rpm and 3 rpm here.
+    now = 0;
+    EncoderHandle encoder = edgeEncoderGetHandle(TOP, BOTTOM, false);
+    float error20 = spin(encoder, 97.0f, 0, 20000, 50);
+    float error60 = spin(encoder, 97.0f, 1000000, 60000, 50);
+    diag("at 97 rpm: largest error %.3f rpm at 20 ms, %.3f rpm at 60 ms", error20, error60);
+
+    ok(error20 < 0.2f, "edgeEncoderGetter, at operating speed, should time edges at 20 ms");
+    ok(error60 < 0.2f, "edgeEncoderGetter, at operating speed, should time edges at 60 ms");
+}
+
+void
+test_edgeEncoderReset()
+{
+    // 1 test
+
+    now = 0;
+    EncoderHandle encoder = edgeEncoderGetHandle(TOP, BOTTOM, false);
+    edgeEncoderGetter(encoder);
+
+    // A second later, reset and count three edges in 10 ms, too few to time
+    now = 1000000;
+    edgeEncoderResetter(encoder);
+    edgeAt(1002500);
+    edgeAt(1005000);
+    edgeAt(1007500);
+    now = 1010000;
+    EncoderReading reading = edgeEncoderGetter(encoder);
+    ok(
+        fabsf(reading.rpm - 50.0f) < 1.0f,
+        "edgeEncoderGetter, just after a reset, should count over the time since"
+    );
+    if (fabsf(reading.rpm - 50.0f) >= 1.0f) diag("(got) %f rpm", reading.rpm);
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return now;
+}
+
+bool
+digitalRead(unsigned char pin)
+{
+    return pins[pin];
+}
+
+void
+pinMode(unsigned char pin, unsigned char mode)
+{
+}
+
+void
+ioSetInterrupt(unsigned char pin, unsigned char edges, InterruptHandler handler)
+{
+    handlers[pin] = handler;
+}
+
+void
+ioClearInterrupt(unsigned char pin)
+{
+    handlers[pin] = NULL;
+}
+
+typedef void * Mutex;
+
+Mutex
+mutexCreate()
+{
+    return NULL;
+}
+
+bool
+mutexTake(Mutex mutex, const unsigned long blockTime)
+{
+    return true;
+}
+
+bool
+mutexGive(Mutex mutex)
+{
+    return true;
+}
+
+int
+encoderGet(void * encoder)
+{
+    return 0;
+}
+
+void
+encoderReset(void * encoder)
+{
+}
+
+bool
+imeGet(unsigned char address, int * value)
+{
+    return false;
+}
+
+bool
+imeGetVelocity(unsigned char address, int * value)
+{
+    return false;
+}
+
+bool
+imeReset(unsigned char address)
+{
+    return false;
+}
+
+void
+motorSet(unsigned char channel, int speed)
+{
+}
@@ -0,0 +1,91 @@
+#include "utils.h"
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+//
+// Times utils' fast maths against libm, per call.
+//
+// The host has a hardware FPU and a well tuned libm, so this only shows
+// the fast versions cost no more than a handful of multiplies. On the
+// Cortex-M3 each of those is a soft-float call, and libm's are many more,
+// so the gap has to be measured on the robot.
+//
+// Run with `make bench`.
+//
+
+#define ITERATIONS 2000000
+
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static volatile float sink;
+
+static void
+report(const char * name, double seconds)
+{
+    printf("%-16s %8.2f ns/call\n", name, seconds / ITERATIONS * 1e9);
+}
+
+// Spread over a few turns either way, like headings and their sums
+static float
+angle(int i)
+{
+    return (i % 4096) * (4.0f * TAU / 4096.0f) - 2.0f * TAU;
+}
+
+int main()
+{
+    double start;
+    printf("# utils: fast maths vs libm, %d iterations\n", ITERATIONS);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fmodf(angle(i) + PI, TAU) - PI;
+    report("fmodf", now() - start);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fastWrap(angle(i));
+    report("fastWrap", now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += sinf(angle(i));
+    report("sinf", now() - start);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fastSin(angle(i));
+    report("fastSin", now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += cosf(angle(i));
+    report("cosf", now() - start);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fastCos(angle(i));
+    report("fastCos", now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += atan2f(angle(i), angle(i + 1000));
+    report("atan2f", now() - start);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fastAtan2(angle(i), angle(i + 1000));
+    report("fastAtan2", now() - start);
+
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += sqrtf(1.0f + (i % 4096));
+    report("sqrtf", now() - start);
+    start = now();
+    for (int i = 0; i < ITERATIONS; i++) sink += fastSqrt(1.0f + (i % 4096));
+    report("fastSqrt", now() - start);
+
+    return 0;
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "tap.h"
+#include "utils.h"
+#include <math.h>
+
+// forward
+
+void test_fastWrap();
+void test_fastSinCos();
+void test_fastAtan2();
+void test_fastInvSqrt();
+
+//
+
+int main()
+{
+    plan(7);
+
+    test_fastWrap();
+    test_fastSinCos();
+    test_fastAtan2();
+    test_fastInvSqrt();
+
+    done_testing();
+}
+
+// Helpers
+
+#define SAMPLES 200000
+
+// Evenly over -range to range
+static float
+sample(int i, float range)
+{
+    return -range + 2.0f * range * i / (SAMPLES - 1);
+}
+
+// Subtests
+
+void
+test_fastWrap()
+{
+    // 2 tests
+
+    float worst = 0.0f;
+    bool inRange = true;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        float angle = sample(i, 1000.0f);
+        float wrapped = fastWrap(angle);
+        if (wrapped < -PI || wrapped > PI) inRange = false;
+        float error = fabsf(sinf(wrapped) - sinf(angle)) + fabsf(cosf(wrapped) - cosf(angle));
+        if (error > worst) worst = error;
+    }
+    diag("fastWrap: worst %g", worst);
+    ok(inRange, "fastWrap should wrap into -pi to pi");
+    ok(worst < 1e-4f, "fastWrap should keep the same angle");
+}
+
+void
+test_fastSinCos()
+{
+    // 2 tests
+
+    float worstSin = 0.0f;
+    float worstCos = 0.0f;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        float angle = sample(i, 100.0f);
+        float errorSin = fabsf(fastSin(angle) - (float)sin(angle));
+        float errorCos = fabsf(fastCos(angle) - (float)cos(angle));
+        if (errorSin > worstSin) worstSin = errorSin;
+        if (errorCos > worstCos) worstCos = errorCos;
+    }
+    diag("fastSin: worst %g, fastCos: worst %g", worstSin, worstCos);
+    ok(worstSin < 1e-7f, "fastSin should be within 1e-7 of sin");
+    ok(worstCos < 1e-7f, "fastCos should be within 1e-7 of cos");
+}
+
+void
+test_fastAtan2()
+{
+    // 2 tests
+
+    float worst = 0.0f;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        float angle = sample(i, PI);
+        float radius = 0.01f + (i % 97);
+        float y = radius * sinf(angle);
+        float x = radius * cosf(angle);
+        float error = fabsf(fastAtan2(y, x) - (float)atan2(y, x));
+        if (error > PI) error = fabsf(error - TAU);
+        if (error > worst) worst = error;
+    }
+    diag("fastAtan2: worst %g", worst);
+    ok(worst < 2e-5f, "fastAtan2 should be within 2e-5 of atan2");
+    ok(fastAtan2(0.0f, 0.0f) == 0.0f, "fastAtan2, given the origin, should give 0");
+}
+
+void
+test_fastInvSqrt()
+{
+    // 1 test
+
+    float worst = 0.0f;
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        float x = 1e-4f * powf(1e12f, (float)i / SAMPLES);
+        float error = fabsf(fastInvSqrt(x) * (float)sqrt(x) - 1.0f);
+        if (error > worst) worst = error;
+    }
+    diag("fastInvSqrt: worst relative %g", worst);
+    ok(worst < 5e-6f, "fastInvSqrt should be within 5e-6 of 1 / sqrt");
+}
+
+// Mock functions
+
+unsigned long
+micros()
+{
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "ingest.h"
+#include "pigeon-frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+// Measures how fast the ingester gets through a capture, parsing and
+// formatting everything but writing nothing out. The capture is a mix of
+// flywheel stream lines and onchange lines, as text and as delta frames.
+//
+// Run with `make bench`.
+//
+
+#define LINES 1000000
+
+static double
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static size_t
+buildTextCapture(unsigned char * capture, int lines)
+{
+    size_t size = 0;
+    for (int i = 0; i < lines; i++)
+    {
+        char line[80];
+        int length;
+        if (i % 4 == 3)
+        {
+            length = pigeonFormatText(line, 80, i, "fwabove", "target", "2400.000000");
+        }
+        else
+        {
+            char message[80];
+            snprintf(
+                message,
+                80,
+                "%f %f %f %f",
+                2400.0f,
+                2390.0f + (i & 7),
+                10.0f - (i & 7),
+                0.8f + (i & 3) * 0.01f
+            );
+            length = pigeonFormatText(line, 80, i, "fwabove", "", message);
+        }
+        memcpy(capture + size, line, length);
+        size += length;
+        capture[size] = '\n';
+        size++;
+    }
+    return size;
+}
+
+static size_t
+buildBinaryCapture(unsigned char * capture, int frames)
+{
+    PigeonFrame last;
+    PigeonFrame frame;
+    frame.portal = 2;
+    frame.entry = PIGEON_FRAME_STREAM;
+    frame.count = 4;
+    for (int i = 0; i < 4; i++) frame.values[i].type = PIGEON_TYPE_FLOAT;
+
+    size_t size = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        frame.timestamp = i;
+        frame.values[0].as.f = 2400.0f;
+        frame.values[1].as.f = 2390.0f + (i & 7);
+        frame.values[2].as.f = 10.0f - (i & 7);
+        frame.values[3].as.f = 0.8f + (i & 3) * 0.01f;
+
+        PigeonFrame delta;
+        PigeonFrame * out = &frame;
+        if (i % 25 != 0 && pigeonFrameDelta(&last, &frame, &delta)) out = &delta;
+        last = frame;
+
+        size += pigeonFrameEncode(out, capture + size, PIGEON_FRAME_MAXSIZE);
+    }
+    return size;
+}
+
+static void
+run(const char * name, const unsigned char * capture, size_t size)
+{
+    Ingest * ingest = ingestInit(NULL);
+    double start = now();
+    ingestPush(ingest, capture, size);
+    double seconds = now() - start;
+    IngestStats stats = ingestStats(ingest);
+    ingestFinish(ingest);
+
+    unsigned long records = stats.lines + stats.frames;
+    printf(
+        "%-16s %10.0f records/s %8.1f MB/s %8lu errors\n",
+        name,
+        records / seconds,
+        size / seconds / 1e6,
+        stats.errors
+    );
+}
+
+int main()
+{
+    unsigned char * capture = malloc((size_t)LINES * 80);
+
+    printf("# ingest: %d records, parsed and formatted without writing\n", LINES);
+
+    size_t size = buildTextCapture(capture, LINES);
+    run("text", capture, size);
+
+    size = buildBinaryCapture(capture, LINES);
+    run("delta frames", capture, size);
+
+    free(capture);
+    return 0;
+}
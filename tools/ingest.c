@@ -0,0 +1,594 @@
+#include "ingest.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pigeon.h"
+#include "pigeon-frame.h"
+
+
+#define NAMESIZE 32
+#define MAXPORTALS 256
+#define LINEMAX 1024
+#define ROWSIZE 2048
+#define FILEBUFFER 65536
+
+
+
+// Structs {{{
+
+typedef struct
+IngestPortal
+{
+    char name[NAMESIZE];
+    bool streamOpened;
+    bool eventsOpened;
+    FILE * stream;
+    FILE * events;
+
+    // Stream column names, space separated, from the binary manifest
+    char keys[PIGEON_LINESIZE];
+    int keyCount;
+    unsigned long keysVersion;
+
+    // What the last header row written to the stream file looked like
+    bool headerWritten;
+    int headerCount;
+    unsigned long headerVersion;
+
+    // Binary only: the stream as of the last keyframe and deltas since,
+    // and the names of the entry indices, allocated once named
+    PigeonFrame state;
+    bool hasState;
+    char (*entryNames)[NAMESIZE];
+}
+IngestPortal;
+
+struct Ingest
+{
+    const char * directory;
+
+    IngestPortal * portals[MAXPORTALS];
+    int portalCount;
+    IngestPortal * byIndex[256];
+    IngestPortal * lastPortal;
+
+    PigeonDecoder decoder;
+
+    char line[LINEMAX];
+    size_t lineLength;
+    bool lineOverflow;
+
+    IngestStats stats;
+};
+
+// }}}
+
+
+
+// Private functions - forward declarations {{{
+
+static void ingestLine(Ingest*, char * line);
+static void ingestFrame(Ingest*, PigeonFrame*);
+static IngestPortal * findPortal(Ingest*, const char * name);
+static IngestPortal * portalAt(Ingest*, int index);
+static void nameEntry(IngestPortal*, int index, const char * name);
+static void setStreamKeys(IngestPortal*, const char * keys);
+static FILE * openFile(Ingest*, IngestPortal*, const char * suffix);
+static void writeStreamHeader(IngestPortal*, int count);
+static void writeStreamRow(Ingest*, IngestPortal*, const char * row, int length, int count);
+static void writeEvent(Ingest*, IngestPortal*, unsigned long millis, const char * key, const char * value);
+static void writeRow(FILE*, const char * row, int length);
+static int appendUlong(char * row, int length, unsigned long value);
+static int appendText(char * row, int length, const char * text, int size);
+static int appendValue(char * row, int length, const PigeonValue*);
+
+// }}}
+
+
+
+// Public methods {{{
+
+Ingest *
+ingestInit(const char * directory)
+{
+    Ingest * ingest = calloc(1, sizeof(Ingest));
+    ingest->directory = directory;
+    pigeonDecoderInit(&ingest->decoder);
+    return ingest;
+}
+
+
+//
+// Binary frames are recognised by their sync byte at the start of a line;
+// everything else is taken as text, a line at a time.
+//
+void
+ingestPush(Ingest * ingest, const unsigned char * data, size_t size)
+{
+    PigeonFrame frame;
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char byte = data[i];
+
+        if (ingest->decoder.size > 0 ||
+            (ingest->lineLength == 0 && byte == PIGEON_FRAME_SYNC))
+        {
+            if (pigeonDecoderPush(&ingest->decoder, byte, &frame))
+            {
+                ingestFrame(ingest, &frame);
+            }
+            continue;
+        }
+
+        if (byte == '\n')
+        {
+            size_t length = ingest->lineLength;
+            if (length > 0 && ingest->line[length - 1] == '\r') length--;
+            ingest->line[length] = '\0';
+            if (ingest->lineOverflow) ingest->stats.errors++;
+            else if (length > 0) ingestLine(ingest, ingest->line);
+            ingest->lineLength = 0;
+            ingest->lineOverflow = false;
+            continue;
+        }
+
+        if (ingest->lineLength < LINEMAX - 1)
+        {
+            ingest->line[ingest->lineLength] = byte;
+            ingest->lineLength++;
+        }
+        else
+        {
+            ingest->lineOverflow = true;
+        }
+    }
+}
+
+
+IngestStats
+ingestStats(Ingest * ingest)
+{
+    IngestStats stats = ingest->stats;
+    stats.errors += ingest->decoder.errors;
+    return stats;
+}
+
+
+void
+ingestFinish(Ingest * ingest)
+{
+    if (ingest->lineLength > 0 && !ingest->lineOverflow)
+    {
+        ingest->line[ingest->lineLength] = '\0';
+        ingestLine(ingest, ingest->line);
+    }
+    for (int i = 0; i < ingest->portalCount; i++)
+    {
+        IngestPortal * portal = ingest->portals[i];
+        if (portal->stream != NULL) fclose(portal->stream);
+        if (portal->events != NULL) fclose(portal->events);
+        free(portal->entryNames);
+        free(portal);
+    }
+    free(ingest);
+}
+
+// }}}
+
+
+
+// Private methods {{{
+
+// "[00001234|portal.key  ] message", or "[00001234|portal] a b c" for streams
+static void
+ingestLine(Ingest * ingest, char * line)
+{
+    if (line[0] != '[')
+    {
+        ingest->stats.errors++;
+        return;
+    }
+
+    char * cursor = line + 1;
+    unsigned long millis = 0;
+    while (*cursor >= '0' && *cursor <= '9')
+    {
+        millis = millis * 10 + (*cursor - '0');
+        cursor++;
+    }
+    if (*cursor != '|')
+    {
+        ingest->stats.errors++;
+        return;
+    }
+
+    char * path = cursor + 1;
+    char * close = strchr(path, ']');
+    if (close == NULL)
+    {
+        ingest->stats.errors++;
+        return;
+    }
+    char * message = close + 1;
+    if (*message == ' ') message++;
+
+    // Drop the alignment padding
+    char * pathEnd = close;
+    while (pathEnd > path && pathEnd[-1] == ' ') pathEnd--;
+    *pathEnd = '\0';
+
+    char * key = strchr(path, '.');
+    if (key != NULL)
+    {
+        *key = '\0';
+        key++;
+    }
+
+    IngestPortal * portal = findPortal(ingest, path);
+    if (portal == NULL)
+    {
+        ingest->stats.errors++;
+        return;
+    }
+    ingest->stats.lines++;
+
+    if (key != NULL)
+    {
+        writeEvent(ingest, portal, millis, key, message);
+        return;
+    }
+
+    char row[ROWSIZE];
+    int length = appendUlong(row, 0, millis);
+    int count = 0;
+    char * value = message;
+    while (*value != '\0')
+    {
+        char * end = value;
+        while (*end != ' ' && *end != '\0') end++;
+        if (end > value)
+        {
+            row[length++] = ',';
+            length = appendText(row, length, value, end - value);
+            count++;
+        }
+        value = *end == '\0' ? end : end + 1;
+    }
+    writeStreamRow(ingest, portal, row, length, count);
+}
+
+static void
+ingestFrame(Ingest * ingest, PigeonFrame * frame)
+{
+    ingest->stats.frames++;
+    IngestPortal * portal = portalAt(ingest, frame->portal);
+    if (portal == NULL)
+    {
+        ingest->stats.errors++;
+        return;
+    }
+
+    bool isNamed = frame->count >= 1 && frame->values[0].type == PIGEON_TYPE_NAME;
+
+    if (frame->entry == PIGEON_FRAME_STREAM && isNamed)
+    {
+        // Stream manifest, the portal's id and its stream keys
+        IngestPortal * named = findPortal(ingest, frame->values[0].as.text);
+        if (named == NULL)
+        {
+            ingest->stats.errors++;
+            return;
+        }
+        ingest->byIndex[frame->portal] = named;
+        if (frame->count >= 2) setStreamKeys(named, frame->values[1].as.text);
+        return;
+    }
+
+    if (frame->entry < PIGEON_FRAME_DELTA && frame->count == 1 && isNamed)
+    {
+        nameEntry(portal, frame->entry, frame->values[0].as.text);
+        return;
+    }
+
+    if (frame->entry == PIGEON_FRAME_STREAM)
+    {
+        pigeonFrameCopy(&portal->state, frame);
+        portal->hasState = true;
+    }
+    else if (frame->entry == PIGEON_FRAME_DELTA)
+    {
+        // Without the keyframe before it a delta is meaningless
+        if (!portal->hasState || !pigeonFrameApplyDelta(&portal->state, frame))
+        {
+            portal->hasState = false;
+            ingest->stats.errors++;
+            return;
+        }
+    }
+    else
+    {
+        char value[ROWSIZE];
+        int length = frame->count > 0 ? appendValue(value, 0, &frame->values[0]) : 0;
+        value[length] = '\0';
+
+        const char * key = "";
+        char fallback[NAMESIZE];
+        if (portal->entryNames != NULL) key = portal->entryNames[frame->entry];
+        if (key[0] == '\0')
+        {
+            snprintf(fallback, NAMESIZE, "entry%d", frame->entry);
+            key = fallback;
+        }
+        writeEvent(ingest, portal, frame->timestamp, key, value);
+        return;
+    }
+
+    PigeonFrame * state = &portal->state;
+    char row[ROWSIZE];
+    int length = appendUlong(row, 0, state->timestamp);
+    for (int i = 0; i < state->count; i++)
+    {
+        row[length++] = ',';
+        length = appendValue(row, length, &state->values[i]);
+    }
+    writeStreamRow(ingest, portal, row, length, state->count);
+}
+
+static IngestPortal *
+findPortal(Ingest * ingest, const char * name)
+{
+    IngestPortal * last = ingest->lastPortal;
+    if (last != NULL && strcmp(last->name, name) == 0) return last;
+
+    for (int i = 0; i < ingest->portalCount; i++)
+    {
+        if (strcmp(ingest->portals[i]->name, name) == 0)
+        {
+            ingest->lastPortal = ingest->portals[i];
+            return ingest->portals[i];
+        }
+    }
+
+    if (ingest->portalCount == MAXPORTALS) return NULL;
+    if (name[0] == '\0' || strchr(name, '/') != NULL) return NULL;
+
+    IngestPortal * portal = calloc(1, sizeof(IngestPortal));
+    snprintf(portal->name, NAMESIZE, "%s", name);
+    ingest->portals[ingest->portalCount] = portal;
+    ingest->portalCount++;
+    ingest->lastPortal = portal;
+    return portal;
+}
+
+// Portals are named by the manifest, until then they go by their index.
+static IngestPortal *
+portalAt(Ingest * ingest, int index)
+{
+    if (ingest->byIndex[index] == NULL)
+    {
+        char name[NAMESIZE];
+        snprintf(name, NAMESIZE, "portal%d", index);
+        ingest->byIndex[index] = findPortal(ingest, name);
+    }
+    return ingest->byIndex[index];
+}
+
+static void
+nameEntry(IngestPortal * portal, int index, const char * name)
+{
+    if (portal->entryNames == NULL)
+    {
+        portal->entryNames = calloc(256, NAMESIZE);
+    }
+    snprintf(portal->entryNames[index], NAMESIZE, "%s", name);
+}
+
+static void
+setStreamKeys(IngestPortal * portal, const char * keys)
+{
+    if (strcmp(portal->keys, keys) == 0) return;
+
+    snprintf(portal->keys, PIGEON_LINESIZE, "%s", keys);
+    portal->keyCount = 0;
+    const char * key = portal->keys;
+    while (*key != '\0')
+    {
+        if (*key != ' ' && (key == portal->keys || key[-1] == ' '))
+        {
+            portal->keyCount++;
+        }
+        key++;
+    }
+    portal->keysVersion++;
+    portal->hasState = false;
+}
+
+// Returns NULL, so nothing is written, without a directory.
+static FILE *
+openFile(Ingest * ingest, IngestPortal * portal, const char * suffix)
+{
+    if (ingest->directory == NULL) return NULL;
+
+    char path[1024];
+    snprintf(path, 1024, "%s/%s%s", ingest->directory, portal->name, suffix);
+    FILE * file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "pigeon-ingest: cannot write to %s\n", path);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, FILEBUFFER);
+    return file;
+}
+
+static void
+writeStreamHeader(IngestPortal * portal, int count)
+{
+    char row[ROWSIZE];
+    int length = appendText(row, 0, "millis", 6);
+
+    bool isNamed = portal->keyCount == count;
+    const char * key = portal->keys;
+    for (int i = 0; i < count && length < ROWSIZE - NAMESIZE - 2; i++)
+    {
+        row[length++] = ',';
+        if (isNamed)
+        {
+            while (*key == ' ') key++;
+            const char * end = key;
+            while (*end != ' ' && *end != '\0') end++;
+            length = appendText(row, length, key, end - key);
+            key = end;
+        }
+        else
+        {
+            row[length++] = 'v';
+            length = appendUlong(row, length, i);
+        }
+    }
+    writeRow(portal->stream, row, length);
+
+    portal->headerWritten = true;
+    portal->headerCount = count;
+    portal->headerVersion = portal->keysVersion;
+}
+
+static void
+writeStreamRow(Ingest * ingest, IngestPortal * portal, const char * row, int length, int count)
+{
+    if (!portal->streamOpened)
+    {
+        portal->stream = openFile(ingest, portal, ".csv");
+        portal->streamOpened = true;
+    }
+    if (!portal->headerWritten ||
+        portal->headerCount != count ||
+        portal->headerVersion != portal->keysVersion)
+    {
+        writeStreamHeader(portal, count);
+    }
+    writeRow(portal->stream, row, length);
+    ingest->stats.rows++;
+}
+
+static void
+writeEvent(
+    Ingest * ingest,
+    IngestPortal * portal,
+    unsigned long millis,
+    const char * key,
+    const char * value
+){
+    if (!portal->eventsOpened)
+    {
+        portal->events = openFile(ingest, portal, ".events.csv");
+        portal->eventsOpened = true;
+        if (portal->events != NULL) fputs("millis,key,value\n", portal->events);
+    }
+
+    char row[ROWSIZE];
+    int length = appendUlong(row, 0, millis);
+    row[length++] = ',';
+    length = appendText(row, length, key, strlen(key));
+    row[length++] = ',';
+    length = appendText(row, length, value, strlen(value));
+    writeRow(portal->events, row, length);
+    ingest->stats.rows++;
+}
+
+static void
+writeRow(FILE * file, const char * row, int length)
+{
+    if (file == NULL) return;
+    fwrite(row, 1, length, file);
+    fputc('\n', file);
+}
+
+static int
+appendUlong(char * row, int length, unsigned long value)
+{
+    char digits[24];
+    int count = 0;
+    do
+    {
+        digits[count] = '0' + value % 10;
+        value /= 10;
+        count++;
+    }
+    while (value > 0);
+
+    while (count > 0)
+    {
+        count--;
+        row[length] = digits[count];
+        length++;
+    }
+    return length;
+}
+
+// Quotes the text if it would otherwise break the CSV. Leaves room for the
+// end of the row, truncating the text if need be.
+static int
+appendText(char * row, int length, const char * text, int size)
+{
+    bool needsQuotes = false;
+    for (int i = 0; i < size; i++)
+    {
+        if (text[i] == ',' || text[i] == '"')
+        {
+            needsQuotes = true;
+            break;
+        }
+    }
+
+    int limit = ROWSIZE - 8;
+    if (length >= limit) return length;
+    if (!needsQuotes)
+    {
+        if (length + size > limit) size = limit - length;
+        memcpy(row + length, text, size);
+        return length + size;
+    }
+
+    row[length++] = '"';
+    for (int i = 0; i < size && length < limit; i++)
+    {
+        if (text[i] == '"') row[length++] = '"';
+        row[length++] = text[i];
+    }
+    row[length++] = '"';
+    return length;
+}
+
+static int
+appendValue(char * row, int length, const PigeonValue * value)
+{
+    switch (value->type)
+    {
+    case PIGEON_TYPE_FLOAT:
+        return length + snprintf(row + length, 32, "%.9g", value->as.f);
+    case PIGEON_TYPE_INT:
+        if (value->as.i < 0)
+        {
+            row[length++] = '-';
+            return appendUlong(row, length, -(unsigned long)value->as.i);
+        }
+        return appendUlong(row, length, value->as.i);
+    case PIGEON_TYPE_UINT:
+        return appendUlong(row, length, value->as.u);
+    case PIGEON_TYPE_BOOL:
+        return appendText(row, length, value->as.b ? "true" : "false", value->as.b ? 4 : 5);
+    case PIGEON_TYPE_TEXT:
+    case PIGEON_TYPE_NAME:
+    {
+        const char * text = value->as.text ? value->as.text : "";
+        return appendText(row, length, text, strlen(text));
+    }
+    }
+    return length;
+}
+
+// }}}
@@ -0,0 +1,75 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+//
+// Host side pigeon log ingester.
+//
+// Takes a raw capture in pieces of any size, text lines and binary frames
+// mixed, and writes a CSV file per portal:
+//
+//   <portal>.csv         millis, then one column per stream value
+//   <portal>.events.csv  millis,key,value for every entry written
+//
+// Stream columns are named from the binary manifest when one was seen, and
+// v0, v1, ... otherwise. A new header row is written whenever they change.
+//
+// Memory use depends only on the number of portals, never on the length of
+// the capture.
+//
+
+
+
+// Typedefs {{{
+
+struct Ingest;
+typedef struct Ingest Ingest;
+
+typedef struct
+IngestStats
+{
+    unsigned long lines;
+    unsigned long frames;
+    unsigned long rows;
+    unsigned long errors;
+}
+IngestStats;
+
+// }}}
+
+
+
+// Methods {{{
+
+// With a NULL directory, everything is parsed and formatted but not written.
+Ingest *
+ingestInit(const char * directory);
+
+void
+ingestPush(Ingest*, const unsigned char * data, size_t size);
+
+IngestStats
+ingestStats(Ingest*);
+
+// Flushes and closes every file, then frees the ingester.
+void
+ingestFinish(Ingest*);
+
+// }}}
+
+
+
+// End C++ export structure
+#ifdef __cplusplus
+}
+#endif
+
+// End include guard
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// kalman-gains decay gain frame-delay speed-noise disturbance-noise measured-noise
+//
+// Works out the steady state gains for a flywheel's Kalman filter, and
+// prints them as a FlywheelKalman for FlywheelSetup.kalman.
+//
+//   decay, gain        model: acceleration = gain * action - decay * speed
+//   frame-delay        milliseconds between updates, as in the setup
+//   speed-noise        rpm/s the speed wanders by beyond the model
+//   disturbance-noise  rpm/s^2 the disturbance wanders by
+//   measured-noise     rpm standard deviation of the encoder reading
+//
+// Iterates the Riccati equation until the gains stop changing.
+//
+
+#define ITERATIONS 10000
+#define TOLERANCE 1e-9
+
+int main(int argc, char ** argv)
+{
+    if (argc != 7)
+    {
+        fprintf(
+            stderr,
+            "usage: %s decay gain frame-delay speed-noise disturbance-noise measured-noise\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    double decay = atof(argv[1]);
+    double gain = atof(argv[2]);
+    double dt = atof(argv[3]) / 1000.0;
+    double speedNoise = atof(argv[4]);
+    double disturbanceNoise = atof(argv[5]);
+    double measuredNoise = atof(argv[6]);
+    if (dt <= 0.0 || measuredNoise <= 0.0)
+    {
+        fprintf(stderr, "kalman-gains: frame-delay and measured-noise must be positive\n");
+        return 1;
+    }
+
+    // State is speed and disturbance. Only the speed is measured.
+    double f[2][2] = {{1.0 - decay * dt, dt}, {0.0, 1.0}};
+    double q[2] = {speedNoise * speedNoise * dt, disturbanceNoise * disturbanceNoise * dt};
+    double r = measuredNoise * measuredNoise;
+
+    double p[2][2] = {{r, 0.0}, {0.0, r}};
+    double k[2] = {0.0, 0.0};
+    int i;
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        // Predict: P = F P F' + Q
+        double fp[2][2];
+        for (int row = 0; row < 2; row++)
+        {
+            for (int column = 0; column < 2; column++)
+            {
+                fp[row][column] = f[row][0] * p[0][column] + f[row][1] * p[1][column];
+            }
+        }
+        double predicted[2][2];
+        for (int row = 0; row < 2; row++)
+        {
+            for (int column = 0; column < 2; column++)
+            {
+                predicted[row][column] =
+                    fp[row][0] * f[column][0] + fp[row][1] * f[column][1];
+            }
+        }
+        predicted[0][0] += q[0];
+        predicted[1][1] += q[1];
+
+        // Update: K = P H' / (H P H' + R), P = (I - K H) P
+        double s = predicted[0][0] + r;
+        double next[2] = {predicted[0][0] / s, predicted[1][0] / s};
+        for (int row = 0; row < 2; row++)
+        {
+            for (int column = 0; column < 2; column++)
+            {
+                p[row][column] = predicted[row][column] - next[row] * predicted[0][column];
+            }
+        }
+
+        double change = (next[0] - k[0]) * (next[0] - k[0]) + (next[1] - k[1]) * (next[1] - k[1]);
+        k[0] = next[0];
+        k[1] = next[1];
+        if (change < TOLERANCE * TOLERANCE) break;
+    }
+    if (i == ITERATIONS)
+    {
+        fprintf(stderr, "kalman-gains: did not converge, check the noise levels\n");
+        return 1;
+    }
+
+    printf(".kalman =\n");
+    printf("{\n");
+    printf("    .decay = %ff,\n", decay);
+    printf("    .gain = %ff,\n", gain);
+    printf("    .gainSpeed = %ff,\n", k[0]);
+    printf("    .gainDisturbance = %ff\n", k[1]);
+    printf("},\n");
+    return 0;
+}
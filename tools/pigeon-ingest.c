@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "ingest.h"
+
+//
+// pigeon-ingest [-o directory] [capture ...]
+//
+// Splits pigeon captures, text or binary, into a CSV file per portal.
+// Reads standard input when no capture, or "-", is given.
+//
+
+#define CHUNKSIZE 65536
+
+static int
+makeDirectory(const char * directory)
+{
+#ifdef _WIN32
+    int result = mkdir(directory);
+#else
+    int result = mkdir(directory, 0777);
+#endif
+    if (result != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "pigeon-ingest: cannot create %s\n", directory);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+ingestFile(Ingest * ingest, const char * path)
+{
+    FILE * file = stdin;
+    if (strcmp(path, "-") != 0) file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "pigeon-ingest: cannot read %s\n", path);
+        return -1;
+    }
+
+    unsigned char chunk[CHUNKSIZE];
+    size_t size;
+    while ((size = fread(chunk, 1, CHUNKSIZE, file)) > 0)
+    {
+        ingestPush(ingest, chunk, size);
+    }
+
+    if (file != stdin) fclose(file);
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * directory = ".";
+    int first = 1;
+    if (argc >= 3 && strcmp(argv[1], "-o") == 0)
+    {
+        directory = argv[2];
+        first = 3;
+    }
+    else if (argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+    {
+        fprintf(stderr, "usage: %s [-o directory] [capture ...]\n", argv[0]);
+        return 0;
+    }
+
+    if (makeDirectory(directory) != 0) return 1;
+
+    Ingest * ingest = ingestInit(directory);
+    int failed = 0;
+    if (first == argc)
+    {
+        failed |= ingestFile(ingest, "-");
+    }
+    for (int i = first; i < argc; i++)
+    {
+        failed |= ingestFile(ingest, argv[i]);
+    }
+
+    IngestStats stats = ingestStats(ingest);
+    ingestFinish(ingest);
+
+    fprintf(
+        stderr,
+        "pigeon-ingest: %lu lines, %lu frames, %lu rows, %lu errors\n",
+        stats.lines,
+        stats.frames,
+        stats.rows,
+        stats.errors
+    );
+    return failed ? 1 : 0;
+}